@@ -0,0 +1,385 @@
+#ifdef __MINGW32__
+#include <winsock.h>
+#else
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#endif
+#include <ctype.h>
+#include <iso646.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asmverify.h"
+#include "disasm.h"
+#include "elf.h"
+#include "mips.h"
+#include "reloc.h"
+
+struct label_s {
+	char name[64];
+	uint32_t addr;
+};
+
+struct verify_s {
+	uint8_t *frag;
+	struct fragsyms_s fs;
+	struct mips_asm_s *words;	// what each word assembled to
+	uint32_t pos;			// next byte of text/data/reloctab
+	uint32_t bss_pos;
+	bool in_bss;
+	struct label_s *labels;
+	size_t num_labels;
+	char *why;
+	size_t whylen;
+};
+
+static int fail(struct verify_s *v, const char *fmt, ...)
+	__attribute__(( format(printf, 2, 3) ));
+
+static int fail(struct verify_s *v, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(v->why, v->whylen, fmt, ap);
+	va_end(ap);
+	return -1;
+}
+
+static int add_label(struct verify_s *v, const char *name, size_t len,
+	uint32_t addr)
+{
+	struct label_s *l;
+
+	if (len >= sizeof(l->name)) return fail(v, "label too long");
+	l = realloc(v->labels, (v->num_labels + 1) * sizeof(*l));
+	if (!l) return fail(v, "out of memory");
+	v->labels = l;
+	l = &v->labels[v->num_labels++];
+	memcpy(l->name, name, len);
+	l->name[len] = '\0';
+	l->addr = addr;
+	return 0;
+}
+
+static int cmp_label(const void *a, const void *b)
+{
+	return strcmp(((struct label_s *)a)->name, ((struct label_s *)b)->name);
+}
+
+// the address a label is defined at, or the one its name spells out
+static bool resolve(struct verify_s *v, const char *name, uint32_t *addr)
+{
+	struct label_s key, *l;
+	const char *hex;
+	char *end;
+
+	snprintf(key.name, sizeof(key.name), "%s", name);
+	l = bsearch(&key, v->labels, v->num_labels, sizeof(key), cmp_label);
+	if (l) {
+		*addr = l->addr;
+		return true;
+	}
+	if (!strncmp(name, "func_", 5)) hex = name + 5;
+	else if (!strncmp(name, "D_", 2)) hex = name + 2;
+	else return false;
+	*addr = strtoul(hex, &end, 16);
+	return (end != hex) and !*end;
+}
+
+static char *trim(char *p)
+{
+	size_t n;
+	while (isspace((unsigned char)*p)) p++;
+	n = strlen(p);
+	while (n and isspace((unsigned char)p[n - 1])) p[--n] = '\0';
+	return p;
+}
+
+static int take_word(struct verify_s *v, struct mips_asm_s *a)
+{
+	if (v->in_bss) return fail(v, "code or data in .bss");
+	if (v->pos + 4 > v->fs.size)
+		return fail(v, "more than 0x%x bytes", v->fs.size);
+	v->words[v->pos / 4] = *a;
+	v->pos += 4;
+	return 0;
+}
+
+// first pass: assemble each line, leaving symbols for later
+static int parse_line(struct verify_s *v, char *line)
+{
+	char *p, *c;
+	struct mips_asm_s a = {0};
+	uint32_t here;
+
+	// drop the /* offset vaddr word */ prefix and # comments
+	while ((c = strstr(line, "/*"))) {
+		char *e = strstr(c, "*/");
+		if (!e) return fail(v, "unterminated comment");
+		memset(c, ' ', e + 2 - c);
+	}
+	if ((c = strchr(line, '#'))) *c = '\0';
+	p = trim(line);
+	if (!*p) return 0;
+
+	here = v->fs.vma + (v->in_bss? v->fs.size + v->bss_pos: v->pos);
+	if (!strncmp(p, ".set", 4) or !strncmp(p, ".globl", 6))
+		return 0;
+	if (!strncmp(p, ".section", 8)) {
+		v->in_bss = !strcmp(trim(p + 8), ".bss");
+		return 0;
+	}
+	if (!strncmp(p, ".space", 6)) {
+		if (!v->in_bss) return fail(v, ".space outside .bss");
+		v->bss_pos += strtoul(p + 6, NULL, 0);
+		return 0;
+	}
+	if (!strncmp(p, ".word", 5)) {
+		char *arg = trim(p + 5);
+		char *end;
+		if (isdigit((unsigned char)*arg)) {
+			a.insn = strtoul(arg, &end, 0);
+			if (*end) return fail(v, "bad .word %s", arg);
+		} else {
+			a.kind = 'w';
+			snprintf(a.sym, sizeof(a.sym), "%s", arg);
+		}
+		return take_word(v, &a);
+	}
+	size_t n = strcspn(p, ": \t=");
+	if (p[n] == ':')
+		return add_label(v, p, n, here);
+	if (strchr(p, '=')) {
+		// NAME = . + k
+		char *eq = strchr(p, '=');
+		char *rhs = trim(eq + 1);
+		if ((rhs[0] != '.') or (strchr(rhs, '+') == NULL))
+			return fail(v, "can't parse %s", p);
+		return add_label(v, p, n, here + strtoul(strchr(rhs, '+') + 1, NULL, 0));
+	}
+	if (Mips_Assemble(&a, p, here))
+		return fail(v, "can't assemble %s", p);
+	return take_word(v, &a);
+}
+
+static uint32_t kind_reloc(char kind)
+{
+	switch (kind) {
+	case 'j':
+		return RELOC_J;
+	case 'h':
+		return RELOC_LUI;
+	case 'l':
+		return RELOC_ADDIU;
+	case 'w':
+		return RELOC_PTR;
+	default:
+		return 0;
+	}
+}
+
+// second pass: fill in symbols and compare with the fragment
+static int check_words(struct verify_s *v)
+{
+	for (uint32_t i = 0; i < v->fs.size / 4; i++) {
+		struct mips_asm_s *a = &v->words[i];
+		uint32_t off = 4 * i;
+		uint32_t pc = v->fs.vma + off;
+		uint32_t type = v->fs.type[i] << 24;
+		uint32_t orig, addr = 0, insn = a->insn;
+
+		memcpy(&orig, v->frag + off, 4);
+		orig = ntohl(orig);
+		if (a->kind and !resolve(v, a->sym, &addr))
+			return fail(v, "0x%06x: undefined symbol %s", off, a->sym);
+
+		if (type and (kind_reloc(a->kind) != type))
+			return fail(v, "0x%06x: %s relocation not kept",
+				off, Reloc_TypeName(type));
+
+		// relocated or not, the field is what the symbol encodes to
+		switch (a->kind) {
+		case 'b':
+			insn |= ((addr - pc - 4) >> 2) & 0xFFFF;
+			break;
+		case 'j':
+			insn |= (addr >> 2) & 0x03FFFFFF;
+			break;
+		case 'h':
+			insn |= ((addr + 0x8000) >> 16) & 0xFFFF;
+			break;
+		case 'l':
+			insn |= addr & 0xFFFF;
+			break;
+		case 'w':
+			insn = addr;
+			break;
+		}
+		// the loader sets the top bit of a relocated %hi itself
+		if (type == RELOC_LUI) {
+			insn &= ~0x8000;
+			orig &= ~0x8000;
+		}
+		if (insn != orig)
+			return fail(v, "0x%06x: 0x%08x is not 0x%08x", off, insn, orig);
+	}
+	return 0;
+}
+
+// every label whose name spells out an address has to be at it
+static int check_labels(struct verify_s *v)
+{
+	for (size_t i = 0; i < v->num_labels; i++) {
+		struct label_s *l = &v->labels[i];
+		const char *hex = strchr(l->name, '_');
+		if (!strncmp(l->name, ".L", 2)) hex = l->name + 1;
+		if (!hex) continue;
+		if (strtoul(hex + 1, NULL, 16) != l->addr)
+			return fail(v, "%s is at 0x%08x", l->name, l->addr);
+	}
+	return 0;
+}
+
+/*
+ * Assemble a listing from Disasm_FragAsm and compare it with the
+ * fragment it came from. Every word, relocated fields included, has to
+ * assemble back to the original bit for bit once its symbol is filled in.
+ * Returns 0, or -1 with the first difference in why.
+ */
+int Asm_Verify(const char *text, size_t len, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi, char *why, size_t whylen)
+{
+	__label__ out_free;
+	struct verify_s v = {
+		.frag = frag,
+		.why = why,
+		.whylen = whylen,
+	};
+	char *copy, *line, *next;
+	int rc = -1;
+
+	copy = malloc(len + 1);
+	if (!copy) return fail(&v, "out of memory");
+	memcpy(copy, text, len);
+	copy[len] = '\0';
+	if (FragSyms_Build(&v.fs, frag, size, fi)) {
+		fail(&v, "out of memory");
+		free(copy);
+		return -1;
+	}
+	v.words = calloc(v.fs.size / 4 + 1, sizeof(*v.words));
+	if (!v.words) {
+		fail(&v, "out of memory");
+		goto out_free;
+	}
+
+	for (line = copy; line; line = next) {
+		next = strchr(line, '\n');
+		if (next) *next++ = '\0';
+		if (parse_line(&v, line)) goto out_free;
+	}
+	if (v.pos != v.fs.size) {
+		fail(&v, "0x%x bytes, not 0x%x", v.pos, v.fs.size);
+		goto out_free;
+	}
+	if (v.bss_pos != v.fs.ramsize - v.fs.size) {
+		fail(&v, "0x%x bytes of bss, not 0x%x", v.bss_pos,
+			v.fs.ramsize - v.fs.size);
+		goto out_free;
+	}
+	qsort(v.labels, v.num_labels, sizeof(*v.labels), cmp_label);
+	if (check_words(&v) or check_labels(&v)) goto out_free;
+	rc = 0;
+
+out_free:
+	free(v.labels);
+	free(v.words);
+	FragSyms_Free(&v.fs);
+	free(copy);
+	return rc;
+}
+
+/*
+ * Compare the object an outside assembler made of a listing with the
+ * fragment. .text, .data and .reloctab in a row have to be the fragment,
+ * except for fields either side relocates: the object holds addends
+ * there, and it relocates some jumps the fragment has resolved already.
+ * Returns 0, or -1 with the first difference in why.
+ */
+int Asm_VerifyObject(uint8_t *obj, size_t objsize, uint8_t *frag,
+	size_t size, char *why, size_t whylen)
+{
+	__label__ out_free;
+	static const char *secs[][2] = {
+		{ ".text", ".rel.text" },
+		{ ".data", ".rel.data" },
+		{ ".reloctab", ".rel.reloctab" },
+	};
+	struct verify_s v = { .why = why, .whylen = whylen };
+	uint32_t *mask, *got;
+	uint8_t *table;
+	uint32_t num, pos = 0;
+	int rc = -1;
+
+	size &= ~3;
+	mask = malloc(size + 4);
+	got = calloc(size / 4 + 1, 4);
+	if (!mask or !got) {
+		fail(&v, "out of memory");
+		goto out_free;
+	}
+	memset(mask, 0xff, size + 4);
+	table = Reloc_Table(frag, size, &num);
+	for (uint32_t i = 0; i < num; i++) {
+		uint32_t reloc = Reloc_Get(table, i);
+		uint32_t addr = reloc & RELOC_ADDR_MASK;
+		if (!(addr & 3) and (addr < size))
+			mask[addr / 4] &= ~Reloc_Mask(reloc);
+	}
+
+	for (size_t s = 0; s < sizeof(secs) / sizeof(secs[0]); s++) {
+		uint8_t *p, *rel;
+		uint32_t len, rel_len;
+
+		if (Elf_Section(obj, objsize, secs[s][0], &p, &len)) continue;
+		if (len > size - pos) {
+			fail(&v, "%s is past 0x%x bytes", secs[s][0], (uint32_t)size);
+			goto out_free;
+		}
+		memcpy((uint8_t *)got + pos, p, len);
+		if (!Elf_Section(obj, objsize, secs[s][1], &rel, &rel_len)) {
+			for (uint32_t r = 0; r + 8 <= rel_len; r += 8) {
+				uint32_t off, type;
+				memcpy(&off, rel + r, 4);
+				memcpy(&type, rel + r + 4, 4);
+				off = ntohl(off);
+				type = ntohl(type) & 0xff;
+				if (!(off & 3) and (off < len))
+					mask[(pos + off) / 4] &= ~Reloc_Mask(type << 24);
+			}
+		}
+		pos += len;
+	}
+	if (pos != size) {
+		fail(&v, "object has 0x%x bytes, not 0x%x", pos, (uint32_t)size);
+		goto out_free;
+	}
+
+	for (uint32_t i = 0; i < size / 4; i++) {
+		uint32_t orig, insn = ntohl(got[i]);
+		memcpy(&orig, frag + 4 * i, 4);
+		orig = ntohl(orig);
+		if ((insn & mask[i]) != (orig & mask[i])) {
+			fail(&v, "0x%06x: assembled to 0x%08x, not 0x%08x",
+				4 * i, insn, orig);
+			goto out_free;
+		}
+	}
+	rc = 0;
+
+out_free:
+	free(mask);
+	free(got);
+	return rc;
+}
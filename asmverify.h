@@ -0,0 +1,11 @@
+#ifndef _ASMVERIFY_H_
+#define _ASMVERIFY_H_
+#include <inttypes.h>
+#include <stddef.h>
+#include "fragment.h"
+
+int Asm_Verify(const char *text, size_t len, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi, char *why, size_t whylen);
+int Asm_VerifyObject(uint8_t *obj, size_t objsize, uint8_t *frag,
+	size_t size, char *why, size_t whylen);
+#endif
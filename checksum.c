@@ -0,0 +1,144 @@
+#ifdef __MINGW32__
+#include <winsock.h>
+#else
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#endif
+#include <iso646.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checksum.h"
+
+// CRC-32 of the boot code, 0x40 to 0x1000, for each CIC
+static const struct {
+	uint32_t crc;
+	int cic;
+	uint32_t seed;
+} cics[] = {
+	{ 0x6170A4A1, 6101, 0xF8CA4DDC },
+	{ 0x90BB6CB5, 6102, 0xF8CA4DDC },
+	{ 0x0B050EE0, 6103, 0xA3886759 },
+	{ 0x98BC2C86, 6105, 0xDF26F436 },
+	{ 0xACC8580A, 6106, 0x1FEA617A },
+};
+
+static uint32_t crc32(uint8_t *p, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	while (len--) {
+		crc ^= *p++;
+		for (int k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static uint32_t load_be32(uint8_t *p)
+{
+	uint32_t w;
+	memcpy(&w, p, 4);
+	return ntohl(w);
+}
+
+static uint32_t rol(uint32_t x, unsigned n)
+{
+	n &= 31;
+	return n? (x << n) | (x >> (32 - n)): x;
+}
+
+static int cic_index(uint8_t *rom)
+{
+	uint32_t crc = crc32(rom + 0x40, 0x1000 - 0x40);
+
+	for (size_t i = 0; i < sizeof(cics)/sizeof(cics[0]); i++)
+		if (cics[i].crc == crc) return i;
+	return -1;
+}
+
+// which CIC the boot code of a rom is for, or 0 if it's not a known one
+int Checksum_Cic(struct RomView_s *rom)
+{
+	uint8_t *p;
+	int i;
+
+	if (rom->size < CHECKSUM_START) return 0;
+	p = RomView_Get(rom, 0, CHECKSUM_START);
+	if (!p) return 0;
+	i = cic_index(p);
+	RomView_Put(rom, p);
+	return (i < 0)? 0: cics[i].cic;
+}
+
+/*
+ * Work out what CRC1 and CRC2 should be. Returns the CIC, 0 if the boot
+ * code isn't known, or -1 if the rom is too small or out of memory.
+ */
+int Checksum_Rom(struct RomView_s *rom, uint32_t crc[2])
+{
+	uint8_t *p;
+	uint32_t t1, t2, t3, t4, t5, t6;
+	int i, cic;
+
+	if (rom->size < CHECKSUM_START + CHECKSUM_LENGTH) return -1;
+	p = RomView_Get(rom, 0, CHECKSUM_START + CHECKSUM_LENGTH);
+	if (!p) return -1;
+	i = cic_index(p);
+	if (i < 0) {
+		RomView_Put(rom, p);
+		return 0;
+	}
+	cic = cics[i].cic;
+
+	t1 = t2 = t3 = t4 = t5 = t6 = cics[i].seed;
+	for (uint32_t off = CHECKSUM_START;
+	    off < CHECKSUM_START + CHECKSUM_LENGTH; off += 4) {
+		uint32_t d = load_be32(p + off);
+		uint32_t r;
+
+		if (t6 + d < t6) t4++;
+		t6 += d;
+		t3 ^= d;
+		r = rol(d, d & 31);
+		t5 += r;
+		if (t2 > d)
+			t2 ^= r;
+		else
+			t2 ^= t6 ^ d;
+		if (cic == 6105)
+			t1 += load_be32(p + 0x40 + 0x710 + (off & 0xFF)) ^ d;
+		else
+			t1 += t5 ^ d;
+	}
+	RomView_Put(rom, p);
+
+	switch (cic) {
+	case 6103:
+		crc[0] = (t6 ^ t4) + t3;
+		crc[1] = (t5 ^ t2) + t1;
+		break;
+	case 6106:
+		crc[0] = (t6 * t4) + t3;
+		crc[1] = (t5 * t2) + t1;
+		break;
+	default:
+		crc[0] = t6 ^ t4 ^ t3;
+		crc[1] = t5 ^ t2 ^ t1;
+		break;
+	}
+	return cic;
+}
+
+// write correct CRC1 and CRC2 into the header. Returns as Checksum_Rom.
+int Checksum_Fix(struct RomView_s *rom)
+{
+	uint32_t crc[2];
+	int cic = Checksum_Rom(rom, crc);
+
+	if (cic <= 0) return cic;
+	crc[0] = htonl(crc[0]);
+	crc[1] = htonl(crc[1]);
+	RomView_Write(rom, 0x10, crc, sizeof(crc));
+	memcpy(rom->header + 0x10, crc, sizeof(crc));
+	return cic;
+}
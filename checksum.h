@@ -0,0 +1,17 @@
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+#include <inttypes.h>
+#include "romview.h"
+
+/*
+ * The boot code checks CRC1 and CRC2 in the rom header against the
+ * first megabyte after it. How they are worked out depends on which CIC
+ * the cartridge has, which is told from the boot code.
+ */
+#define CHECKSUM_START	0x1000
+#define CHECKSUM_LENGTH	0x100000
+
+int Checksum_Cic(struct RomView_s *rom);
+int Checksum_Rom(struct RomView_s *rom, uint32_t crc[2]);
+int Checksum_Fix(struct RomView_s *rom);
+#endif
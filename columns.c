@@ -0,0 +1,75 @@
+#define _GNU_SOURCE
+#include <iso646.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "columns.h"
+
+static void put_le(uint8_t *p, uint64_t v, unsigned width)
+{
+	for (unsigned i = 0; i < width; i++)
+		p[i] = v >> (8 * i);
+}
+
+void Column_Init(struct column_s *c, const char *name,
+	enum column_type_e type, unsigned width)
+{
+	c->name = name;
+	c->type = type;
+	c->width = width;
+	OutBuf_Init(&c->data);
+}
+
+void Column_Free(struct column_s *c)
+{
+	OutBuf_Free(&c->data);
+}
+
+// a signed value goes in as its two's complement, cut to width
+void Column_Put(struct column_s *c, uint64_t v)
+{
+	uint8_t buf[8];
+
+	put_le(buf, v, c->width);
+	OutBuf_Write(&c->data, buf, c->width);
+}
+
+void Column_PutChars(struct column_s *c, const char *s)
+{
+	size_t len = strnlen(s, c->width);
+
+	OutBuf_Reserve(&c->data, c->width);
+	if (c->data.error) return;
+	memcpy(c->data.p + c->data.len, s, len);
+	memset(c->data.p + c->data.len + len, 0, c->width - len);
+	c->data.len += c->width;
+}
+
+// write dir/table.name.col. Returns 0, or -1 on error
+int Column_Write(struct column_s *c, const char *dir, const char *table)
+{
+	uint8_t hdr[COLUMN_HEADER] = {0};
+	char *path = NULL;
+	FILE *f;
+	int rc = 0;
+
+	if (c->data.error) return -1;
+	memcpy(hdr, COLUMN_MAGIC, sizeof(COLUMN_MAGIC));
+	put_le(hdr + 8, COLUMN_HEADER, 4);
+	put_le(hdr + 12, c->type, 4);
+	put_le(hdr + 16, c->width, 4);
+	put_le(hdr + 24, c->data.len / c->width, 8);
+	strncpy((char *)hdr + 32, c->name, 31);
+
+	if (asprintf(&path, "%s/%s.%s.col", dir, table, c->name) == -1)
+		return -1;
+	f = fopen(path, "wb");
+	free(path);
+	if (!f) return -1;
+	if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+		rc = -1;
+	if (c->data.len and (fwrite(c->data.p, 1, c->data.len, f) != c->data.len))
+		rc = -1;
+	if (fclose(f)) rc = -1;
+	return rc;
+}
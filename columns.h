@@ -0,0 +1,40 @@
+#ifndef _COLUMNS_H_
+#define _COLUMNS_H_
+#include <inttypes.h>
+#include <stddef.h>
+#include "outbuf.h"
+
+/*
+ * A column file is a 64 byte header and then one fixed-width value per
+ * row, little-endian, so it can be mapped and used as an array:
+ *	0	char magic[8]	"PSFCOL1\0"
+ *	8	u32 header size	64
+ *	12	u32 type	COLUMN_*
+ *	16	u32 width	bytes per value
+ *	20	u32 reserved
+ *	24	u64 rows
+ *	32	char name[32]	nul padded
+ */
+#define COLUMN_MAGIC	"PSFCOL1"
+#define COLUMN_HEADER	64
+
+enum column_type_e {
+	COLUMN_UINT = 0,
+	COLUMN_INT,
+	COLUMN_CHARS,	// nul padded text
+};
+
+struct column_s {
+	const char *name;
+	enum column_type_e type;
+	unsigned width;
+	struct outbuf_s data;
+};
+
+void Column_Init(struct column_s *c, const char *name,
+	enum column_type_e type, unsigned width);
+void Column_Free(struct column_s *c);
+void Column_Put(struct column_s *c, uint64_t v);
+void Column_PutChars(struct column_s *c, const char *s);
+int Column_Write(struct column_s *c, const char *dir, const char *table);
+#endif
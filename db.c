@@ -5,19 +5,45 @@
 #include <arpa/inet.h>
 #endif
 #include <ctype.h>
+#include <stdarg.h>
+#include <iso646.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include "db.h"
 #include "fragment.h"
+#include "hash.h"
+#include "reloc.h"
+#include "search.h"
+#include "vtab.h"
 
 int DB_Init(sqlite3 **db, char *filename) {
 	int rc = SQLITE_OK;
 	rc = sqlite3_open(filename, db);
 	if (rc != SQLITE_OK) return rc;
 
+	rc = VTab_Register(*db);
+	if (rc != SQLITE_OK) return rc;
+
+	rc = sqlite3_exec(*db,
+		"CREATE TABLE IF NOT EXISTS frags(pcode text, addr int, num int, entrypoint int, offset_code int, offset_relocs int, romsize int, ramsize int, vma int, hash int, fingerprint int);",
+		NULL, NULL, NULL
+	);
+	if (rc != SQLITE_OK) return rc;
+
 	rc = sqlite3_exec(*db,
-		"CREATE TABLE IF NOT EXISTS frags(pcode text, addr int, num int, entrypoint int, offset_code int, offset_relocs int, romsize int, ramsize int, vma int);",
+		"CREATE TABLE IF NOT EXISTS roms(pcode text primary key, size int, mtime int);"
+		"CREATE TABLE IF NOT EXISTS blocks(pcode text, num int, hash int);"
+		"CREATE TABLE IF NOT EXISTS blobs(hash integer primary key, data blob);",
 		NULL, NULL, NULL
 	);
 	if (rc != SQLITE_OK) return rc;
+
+	// databases made by older versions lack the newer columns
+	sqlite3_exec(*db, "ALTER TABLE frags ADD COLUMN hash int;",
+		NULL, NULL, NULL);
+	sqlite3_exec(*db, "ALTER TABLE frags ADD COLUMN fingerprint int;",
+		NULL, NULL, NULL);
 	return SQLITE_OK;
 }
 
@@ -45,7 +71,9 @@ int DB_AddFrag(
 	int64_t offset_relocs,
 	int64_t romsize,
 	int64_t ramsize,
-	int64_t vma
+	int64_t vma,
+	int64_t hash,
+	int64_t fingerprint
 ) {
 	__label__ err_prepare, err_bind, err_step;
 	int rc = SQLITE_OK;
@@ -65,7 +93,9 @@ int DB_AddFrag(
 				offset_relocs,
 				romsize,
 				ramsize,
-				vma
+				vma,
+				hash,
+				fingerprint
 			)
 			values(
 				:pcode,
@@ -76,7 +106,9 @@ int DB_AddFrag(
 				:offset_relocs,
 				:romsize,
 				:ramsize,
-				:vma
+				:vma,
+				:hash,
+				:fingerprint
 			);
 		)STATEMENT",
 		-1,
@@ -112,6 +144,12 @@ int DB_AddFrag(
 	rc = sqlite3_bind_int64(stmt, 9, vma);
 	if (rc != SQLITE_OK) goto err_bind;
 
+	rc = sqlite3_bind_int64(stmt, 10, hash);
+	if (rc != SQLITE_OK) goto err_bind;
+
+	rc = sqlite3_bind_int64(stmt, 11, fingerprint);
+	if (rc != SQLITE_OK) goto err_bind;
+
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) goto err_step;
 
@@ -230,31 +268,623 @@ out_finalize:
 	return addr;
 }
 
-int DB_FragSearch(sqlite3 *db, uint8_t *data, ssize_t size)
+int DB_AddFrags(sqlite3 *db, char *pcode, struct fraginfo_s *frags, size_t num)
 {
 	int rc = SQLITE_OK;
-	char pcode[6] = {0};
-	get_pcode(pcode, data);
-	DB_Begin(db);
-	for (ssize_t i = 0; i < (size - 15); i += 16) {
-		struct fragment_s *frag = (struct fragment_s *)(data + i);
-		if (!isfrag(frag)) continue;
+
+	for (size_t i = 0; i < num; i++) {
 		rc = DB_AddFrag(
 			db,
 			pcode,
-			i,
-			get_frag_num(frag),
-			get_entrypoint(frag),
-			ntohl(frag->offset_code),
-			ntohl(frag->offset_relocs),
-			ntohl(frag->romsize),
-			ntohl(frag->ramsize),
-			get_vma(frag)
+			frags[i].addr,
+			frags[i].num,
+			frags[i].entrypoint,
+			frags[i].offset_code,
+			frags[i].offset_relocs,
+			frags[i].romsize,
+			frags[i].ramsize,
+			frags[i].vma,
+			frags[i].hash,
+			frags[i].fingerprint
 		);
-		if (rc != SQLITE_OK) {
+		if (rc != SQLITE_OK) break;
+	}
+	return rc;
+}
+
+/*
+ * Add every relocation of the fragments to a relocs table, with the
+ * columns cmd_depends uses. target_addr and target_frag are null when
+ * the relocation can't be decoded.
+ */
+int DB_AddRelocs(sqlite3 *db, char *pcode, struct RomView_s *rom,
+	struct fraginfo_s *frags, size_t num)
+{
+	sqlite3_stmt *stmt;
+	int rc;
+
+	rc = sqlite3_exec(db,
+		"create table if not exists relocs(reloc_id integer primary key, pcode, fragnum, far, type, addr, target_addr, target_frag);",
+		NULL, NULL, NULL);
+	if (rc != SQLITE_OK) return rc;
+	rc = sqlite3_prepare_v2(db,
+		"insert into relocs(pcode, fragnum, far, type, addr, target_addr, target_frag) values (?, ?, ?, ?, ?, ?, ?);",
+		-1, &stmt, NULL);
+	if (rc != SQLITE_OK) return rc;
+
+	DB_Begin(db);
+	sqlite3_bind_text(stmt, 1, pcode, -1, SQLITE_TRANSIENT);
+	for (size_t i = 0; (rc == SQLITE_OK) and (i < num); i++) {
+		uint64_t size = frags[i].romsize;
+		uint8_t *bytes, *table;
+		uint32_t num_relocs;
+
+		if (size > rom->size - frags[i].addr) size = rom->size - frags[i].addr;
+		bytes = RomView_Get(rom, frags[i].addr, size);
+		if (!bytes) {
+			rc = SQLITE_NOMEM;
 			break;
 		}
+		table = Reloc_Table(bytes, size, &num_relocs);
+		sqlite3_bind_int64(stmt, 2, frags[i].num);
+		for (uint32_t j = 0; j < num_relocs; j++) {
+			struct reloc_s r;
+			Reloc_Decode(&r, Reloc_Get(table, j), bytes, size);
+			sqlite3_bind_int(stmt, 3, r.foreign);
+			sqlite3_bind_text(stmt, 4, r.type_name, -1, SQLITE_STATIC);
+			sqlite3_bind_int64(stmt, 5, r.addr);
+			if (r.loc == (uint32_t)-1) {
+				sqlite3_bind_null(stmt, 6);
+				sqlite3_bind_null(stmt, 7);
+			} else {
+				sqlite3_bind_int64(stmt, 6, r.loc);
+				sqlite3_bind_int64(stmt, 7, r.target_frag);
+			}
+			rc = sqlite3_step(stmt);
+			sqlite3_reset(stmt);
+			if (rc != SQLITE_DONE) break;
+			rc = SQLITE_OK;
+		}
+		RomView_Put(rom, bytes);
 	}
 	DB_End(db);
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+int DB_FragSearch(sqlite3 *db, struct RomView_s *rom)
+{
+	int rc = SQLITE_OK;
+	char pcode[6] = {0};
+	struct fraginfo_s *frags;
+	size_t num_frags;
+	get_pcode(pcode, rom->header);
+
+	if (Frag_Search(rom, &frags, &num_frags) != 0)
+		return SQLITE_NOMEM;
+
+	DB_Begin(db);
+	rc = DB_AddFrags(db, pcode, frags, num_frags);
+	DB_End(db);
+
+	free(frags);
+	return rc;
+}
+
+/*
+ * Run a statement whose first parameter is a pcode and whose others are
+ * the num_ints integers that follow.
+ */
+static int _DB_Run(sqlite3 *db, char *sql, char *pcode, int num_ints, ...)
+{
+	sqlite3_stmt *stmt;
+	va_list ap;
+	int rc;
+
+	rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+	if (rc != SQLITE_OK) return rc;
+
+	rc = sqlite3_bind_text(stmt, 1, pcode, -1, SQLITE_TRANSIENT);
+	va_start(ap, num_ints);
+	for (int i = 0; (rc == SQLITE_OK) and (i < num_ints); i++)
+		rc = sqlite3_bind_int64(stmt, i + 2, va_arg(ap, int64_t));
+	va_end(ap);
+
+	if (rc == SQLITE_OK) {
+		rc = sqlite3_step(stmt);
+		if (rc == SQLITE_DONE) rc = SQLITE_OK;
+	}
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+struct range_s {
+	uint64_t start, end;
+};
+
+static int range_cmp(const void *a, const void *b)
+{
+	const struct range_s *x = a, *y = b;
+	if (x->start < y->start) return -1;
+	return x->start > y->start;
+}
+
+static int range_push(struct range_s **v, size_t *n, uint64_t start, uint64_t end)
+{
+	struct range_s *newv;
+
+	if (!(*n & (*n - 1))) {
+		newv = realloc(*v, (*n? *n * 2: 1) * sizeof(**v));
+		if (!newv) return -1;
+		*v = newv;
+	}
+	(*v)[*n].start = start;
+	(*v)[*n].end = end;
+	(*n)++;
+	return 0;
+}
+
+// sort ranges and merge the ones that overlap or touch
+static size_t range_merge(struct range_s *v, size_t n)
+{
+	size_t out = 0;
+
+	if (!n) return 0;
+	qsort(v, n, sizeof(*v), range_cmp);
+	for (size_t i = 1; i < n; i++) {
+		if (v[i].start <= v[out].end) {
+			if (v[i].end > v[out].end) v[out].end = v[i].end;
+		} else {
+			v[++out] = v[i];
+		}
+	}
+	return out + 1;
+}
+
+/*
+ * Bring the fragments of a rom in the database up to date.
+ *
+ * Per-block hashes of the rom are kept next to its fragments. If the
+ * size and mtime are the same as last time, nothing is done. Otherwise
+ * only the blocks whose hash changed, and the fragments that overlap
+ * them, are scanned again. A rom that isn't in the database yet is
+ * scanned in full. Roms are told apart by pcode.
+ */
+int DB_UpdateRom(sqlite3 *db, struct RomView_s *rom, int64_t mtime_ns)
+{
+	__label__ out_end;
+	int rc = SQLITE_OK;
+	char pcode[6] = {0};
+	sqlite3_stmt *stmt = NULL, *del = NULL, *ins = NULL;
+	bool have_rom = false;
+	uint64_t old_size = 0;
+	int64_t old_mtime = 0;
+	uint64_t *hashes = NULL, *old_hashes = NULL;
+	size_t num_blocks, num_old = 0;
+	struct range_s *ranges = NULL;
+	size_t num_ranges = 0, num_dirty;
+	struct fraginfo_s *frags = NULL;
+	size_t num_frags;
+
+	get_pcode(pcode, rom->header);
+
+	rc = sqlite3_prepare_v2(db,
+		"select size, mtime from roms where pcode=?;",
+		-1, &stmt, NULL);
+	if (rc != SQLITE_OK) return rc;
+	sqlite3_bind_text(stmt, 1, pcode, -1, SQLITE_TRANSIENT);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		have_rom = true;
+		old_size = sqlite3_column_int64(stmt, 0);
+		old_mtime = sqlite3_column_int64(stmt, 1);
+	}
+	sqlite3_finalize(stmt);
+	stmt = NULL;
+
+	// a negative mtime means unknown, so the blocks are always checked
+	if (have_rom and (mtime_ns >= 0) and
+	    (old_size == rom->size) and (old_mtime == mtime_ns))
+		return SQLITE_OK;
+
+	hashes = Hash_Blocks(rom->data, rom->size, &num_blocks);
+	if (!hashes) return SQLITE_NOMEM;
+
+	DB_Begin(db);
+
+	if (!have_rom) {
+		// start over, including rows left by versions without roms
+		rc = _DB_Run(db, "delete from frags where pcode=?;", pcode, 0);
+		if (rc != SQLITE_OK) goto out_end;
+		rc = range_push(&ranges, &num_ranges, 0, rom->size)? SQLITE_NOMEM: SQLITE_OK;
+		if (rc != SQLITE_OK) goto out_end;
+	} else {
+		num_old = (old_size + HASH_BLOCK - 1) / HASH_BLOCK;
+		old_hashes = calloc(num_old + 1, sizeof(*old_hashes));
+		if (!old_hashes) {
+			rc = SQLITE_NOMEM;
+			goto out_end;
+		}
+		rc = sqlite3_prepare_v2(db,
+			"select num, hash from blocks where pcode=?;",
+			-1, &stmt, NULL);
+		if (rc != SQLITE_OK) goto out_end;
+		sqlite3_bind_text(stmt, 1, pcode, -1, SQLITE_TRANSIENT);
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			int64_t b = sqlite3_column_int64(stmt, 0);
+			if ((b >= 0) and ((uint64_t)b < num_old))
+				old_hashes[b] = sqlite3_column_int64(stmt, 1);
+		}
+		sqlite3_finalize(stmt);
+		stmt = NULL;
+
+		for (size_t b = 0; b < num_blocks; b++) {
+			if ((b < num_old) and (old_hashes[b] == hashes[b]))
+				continue;
+			uint64_t end = (b + 1) * (uint64_t)HASH_BLOCK;
+			if (end > rom->size) end = rom->size;
+			if (range_push(&ranges, &num_ranges, b * (uint64_t)HASH_BLOCK, end)) {
+				rc = SQLITE_NOMEM;
+				goto out_end;
+			}
+		}
+		// fragments that ran past a truncated end are dirty too
+		if (old_size > rom->size)
+			if (range_push(&ranges, &num_ranges, rom->size, old_size)) {
+				rc = SQLITE_NOMEM;
+				goto out_end;
+			}
+		num_dirty = num_ranges = range_merge(ranges, num_ranges);
+
+		// widen the dirty ranges to cover the fragments that overlap them
+		rc = sqlite3_prepare_v2(db,
+			"select addr, romsize from frags where pcode=?;",
+			-1, &stmt, NULL);
+		if (rc != SQLITE_OK) goto out_end;
+		sqlite3_bind_text(stmt, 1, pcode, -1, SQLITE_TRANSIENT);
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			uint64_t addr = sqlite3_column_int64(stmt, 0);
+			uint64_t end = addr + sqlite3_column_int64(stmt, 1);
+			for (size_t i = 0; i < num_dirty; i++) {
+				if ((addr >= ranges[i].end) or (end <= ranges[i].start))
+					continue;
+				if (range_push(&ranges, &num_ranges, addr, end)) {
+					rc = SQLITE_NOMEM;
+					goto out_end;
+				}
+				break;
+			}
+		}
+		sqlite3_finalize(stmt);
+		stmt = NULL;
+		num_ranges = range_merge(ranges, num_ranges);
+	}
+
+	rc = sqlite3_prepare_v2(db,
+		"delete from frags where pcode=? and addr>=? and addr<?;",
+		-1, &del, NULL);
+	if (rc != SQLITE_OK) goto out_end;
+	sqlite3_bind_text(del, 1, pcode, -1, SQLITE_TRANSIENT);
+	for (size_t i = 0; i < num_ranges; i++) {
+		sqlite3_bind_int64(del, 2, ranges[i].start);
+		sqlite3_bind_int64(del, 3, ranges[i].end);
+		rc = sqlite3_step(del);
+		sqlite3_reset(del);
+		if (rc != SQLITE_DONE) goto out_end;
+		rc = SQLITE_OK;
+		// all of it can come from an index or a profile instead
+		if ((ranges[i].start == 0) and (ranges[i].end >= rom->size)) {
+			if (Frag_Search(rom, &frags, &num_frags)) {
+				rc = SQLITE_NOMEM;
+				goto out_end;
+			}
+		} else if (Frag_SearchRange(rom, ranges[i].start, ranges[i].end,
+		    &frags, &num_frags)) {
+			rc = SQLITE_NOMEM;
+			goto out_end;
+		}
+		rc = DB_AddFrags(db, pcode, frags, num_frags);
+		free(frags);
+		if (rc != SQLITE_OK) goto out_end;
+	}
+
+	rc = _DB_Run(db, "delete from blocks where pcode=?;", pcode, 0);
+	if (rc != SQLITE_OK) goto out_end;
+	rc = sqlite3_prepare_v2(db,
+		"insert into blocks(pcode, num, hash) values(?, ?, ?);",
+		-1, &ins, NULL);
+	if (rc != SQLITE_OK) goto out_end;
+	sqlite3_bind_text(ins, 1, pcode, -1, SQLITE_TRANSIENT);
+	for (size_t b = 0; b < num_blocks; b++) {
+		sqlite3_bind_int64(ins, 2, b);
+		sqlite3_bind_int64(ins, 3, hashes[b]);
+		rc = sqlite3_step(ins);
+		sqlite3_reset(ins);
+		if (rc != SQLITE_DONE) goto out_end;
+	}
+	rc = _DB_Run(db,
+		"insert or replace into roms(pcode, size, mtime) values(?, ?, ?);",
+		pcode, 2, (int64_t)rom->size, mtime_ns);
+
+out_end:
+	sqlite3_finalize(stmt);
+	sqlite3_finalize(del);
+	sqlite3_finalize(ins);
+	if (rc == SQLITE_OK)
+		DB_End(db);
+	else
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+	free(ranges);
+	free(old_hashes);
+	free(hashes);
+	return rc;
+}
+
+/*
+ * Store the payload of every fragment of a rom in the blobs table, once
+ * per hash. The hash is the rowid, so a payload that's already there is
+ * skipped without reading it, and a new one is written straight into a
+ * zeroblob instead of being bound as a parameter. Payloads no fragment
+ * uses any more are dropped.
+ */
+int DB_AddBlobs(sqlite3 *db, struct RomView_s *rom)
+{
+	__label__ out_end;
+	sqlite3_stmt *stmt = NULL, *ins = NULL;
+	sqlite3_blob *blob = NULL;
+	char pcode[6] = {0};
+	int rc;
+
+	get_pcode(pcode, rom->header);
+	DB_Begin(db);
+	rc = sqlite3_prepare_v2(db,
+		"select distinct hash, addr, romsize from frags where pcode=? and hash not in (select hash from blobs);",
+		-1, &stmt, NULL);
+	if (rc != SQLITE_OK) goto out_end;
+	rc = sqlite3_prepare_v2(db,
+		"insert or ignore into blobs(hash, data) values(?, zeroblob(?));",
+		-1, &ins, NULL);
+	if (rc != SQLITE_OK) goto out_end;
+
+	sqlite3_bind_text(stmt, 1, pcode, -1, SQLITE_TRANSIENT);
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		int64_t hash = sqlite3_column_int64(stmt, 0);
+		uint64_t addr = sqlite3_column_int64(stmt, 1);
+		uint64_t len = sqlite3_column_int64(stmt, 2);
+		uint8_t *p;
+
+		// the same length Hash_Frags hashed
+		if (addr > rom->size) continue;
+		if (len > rom->size - addr) len = rom->size - addr;
+		sqlite3_bind_int64(ins, 1, hash);
+		sqlite3_bind_int64(ins, 2, len);
+		rc = sqlite3_step(ins);
+		sqlite3_reset(ins);
+		if (rc != SQLITE_DONE) goto out_end;
+		if (!sqlite3_changes(db) or !len) continue;
+
+		p = RomView_Get(rom, addr, len);
+		if (!p) {
+			rc = SQLITE_NOMEM;
+			goto out_end;
+		}
+		if (blob)
+			rc = sqlite3_blob_reopen(blob, hash);
+		else
+			rc = sqlite3_blob_open(db, "main", "blobs", "data", hash, 1, &blob);
+		if (rc == SQLITE_OK)
+			rc = sqlite3_blob_write(blob, p, len, 0);
+		RomView_Put(rom, p);
+		if (rc != SQLITE_OK) goto out_end;
+	}
+	if (rc != SQLITE_DONE) goto out_end;
+	rc = sqlite3_exec(db,
+		"delete from blobs where hash not in (select hash from frags);",
+		NULL, NULL, NULL);
+
+out_end:
+	if (blob) sqlite3_blob_close(blob);
+	sqlite3_finalize(ins);
+	sqlite3_finalize(stmt);
+	if (rc == SQLITE_OK)
+		DB_End(db);
+	else
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+	return rc;
+}
+
+/*
+ * Read the stored payload of fragment num, from the rom with this pcode
+ * or, if pcode is NULL, the only rom that has one. The payload is
+ * malloced, and the pcode it came from is put in pcode_out. Returns
+ * SQLITE_NOTFOUND if there's no such payload, or SQLITE_CONSTRAINT if
+ * several roms have one and no pcode was given.
+ */
+int DB_GetBlob(sqlite3 *db, int num, char *pcode, uint8_t **data,
+	size_t *size, char pcode_out[6])
+{
+	__label__ out_finalize;
+	sqlite3_stmt *stmt;
+	sqlite3_blob *blob = NULL;
+	int64_t hash;
+	int rc;
+
+	*data = NULL;
+	*size = 0;
+	rc = sqlite3_prepare_v2(db,
+		"select f.pcode, f.hash from frags f join blobs b on b.hash=f.hash where f.num=? and (?2 is null or f.pcode=?2) order by f.pcode limit 2;",
+		-1, &stmt, NULL);
+	if (rc != SQLITE_OK) return rc;
+	sqlite3_bind_int(stmt, 1, num);
+	if (pcode) sqlite3_bind_text(stmt, 2, pcode, -1, SQLITE_TRANSIENT);
+
+	rc = sqlite3_step(stmt);
+	if (rc != SQLITE_ROW) {
+		if (rc == SQLITE_DONE) rc = SQLITE_NOTFOUND;
+		goto out_finalize;
+	}
+	snprintf(pcode_out, 6, "%s", sqlite3_column_text(stmt, 0));
+	hash = sqlite3_column_int64(stmt, 1);
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW) {
+		rc = SQLITE_CONSTRAINT;
+		goto out_finalize;
+	}
+
+	rc = sqlite3_blob_open(db, "main", "blobs", "data", hash, 0, &blob);
+	if (rc != SQLITE_OK) goto out_finalize;
+	*size = sqlite3_blob_bytes(blob);
+	*data = malloc(*size? *size: 1);
+	if (!*data) {
+		rc = SQLITE_NOMEM;
+		goto out_finalize;
+	}
+	rc = sqlite3_blob_read(blob, *data, *size, 0);
+	if (rc != SQLITE_OK) {
+		free(*data);
+		*data = NULL;
+	}
+
+out_finalize:
+	if (blob) sqlite3_blob_close(blob);
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+// indexes that make lookups by number or hash fast, built after a merge
+static const char *db_indexes =
+	"CREATE INDEX IF NOT EXISTS frags_pcode_num ON frags(pcode, num);"
+	"CREATE INDEX IF NOT EXISTS frags_hash ON frags(hash);"
+	"CREATE INDEX IF NOT EXISTS blocks_pcode ON blocks(pcode);";
+
+int DB_DropIndexes(sqlite3 *db)
+{
+	return sqlite3_exec(db,
+		"DROP INDEX IF EXISTS frags_pcode_num;"
+		"DROP INDEX IF EXISTS frags_hash;"
+		"DROP INDEX IF EXISTS blocks_pcode;",
+		NULL, NULL, NULL);
+}
+
+int DB_CreateIndexes(sqlite3 *db)
+{
+	return sqlite3_exec(db, db_indexes, NULL, NULL, NULL);
+}
+
+// pcodes in both databases whose fragments differ
+static const char *merge_clash_frags =
+	"SELECT pcode FROM (SELECT pcode, addr, num, hash FROM src.frags"
+	" EXCEPT SELECT pcode, addr, num, hash FROM main.frags)"
+	" WHERE pcode IN (SELECT pcode FROM main.frags) AND pcode NOT IN temp.newroms"
+	" UNION SELECT pcode FROM (SELECT pcode, addr, num, hash FROM main.frags"
+	" EXCEPT SELECT pcode, addr, num, hash FROM src.frags)"
+	" WHERE pcode IN (SELECT pcode FROM src.frags) AND pcode NOT IN temp.newroms";
+
+// or whose block hashes do, where both have them
+static const char *merge_clash_blocks =
+	" UNION SELECT pcode FROM (SELECT pcode, num, hash FROM src.blocks"
+	" EXCEPT SELECT pcode, num, hash FROM main.blocks)"
+	" WHERE pcode IN (SELECT pcode FROM main.blocks) AND pcode NOT IN temp.newroms"
+	" UNION SELECT pcode FROM (SELECT pcode, num, hash FROM main.blocks"
+	" EXCEPT SELECT pcode, num, hash FROM src.blocks)"
+	" WHERE pcode IN (SELECT pcode FROM src.blocks) AND pcode NOT IN temp.newroms";
+
+/*
+ * Copy the roms of another database made by mkdb into this one, with
+ * INSERT ... SELECT so rows never come out to C. Roms are told apart by
+ * pcode as in DB_UpdateRom, and one that's already here is kept as is.
+ * If its fragments or block hashes aren't the same as the other
+ * database's, it's a different rom with the same pcode, and that is
+ * warned about. Payloads go in once per hash. *added is set to the
+ * number of roms copied, and *clashed to the number that differed.
+ */
+int DB_Merge(sqlite3 *db, char *filename, int *added, int *clashed)
+{
+	__label__ out_detach;
+	sqlite3_stmt *stmt;
+	bool src_blocks = false;
+	int rc;
+
+	*added = 0;
+	*clashed = 0;
+	rc = sqlite3_prepare_v2(db, "ATTACH DATABASE ? AS src;", -1, &stmt, NULL);
+	if (rc != SQLITE_OK) return rc;
+	sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_TRANSIENT);
+	rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	if (rc != SQLITE_DONE) {
+		fprintf(stderr, "DB_Merge: %s: %s\n", filename, sqlite3_errmsg(db));
+		return rc;
+	}
+
+	// roms without a roms row, from older versions, are still merged
+	rc = sqlite3_exec(db,
+		"BEGIN;"
+		"DROP TABLE IF EXISTS temp.newroms;"
+		"CREATE TEMP TABLE newroms AS SELECT DISTINCT pcode FROM src.frags"
+		" WHERE pcode NOT IN (SELECT pcode FROM main.frags);"
+		"INSERT INTO main.frags(pcode, addr, num, entrypoint, offset_code, offset_relocs, romsize, ramsize, vma, hash, fingerprint)"
+		" SELECT pcode, addr, num, entrypoint, offset_code, offset_relocs, romsize, ramsize, vma, hash, fingerprint"
+		" FROM src.frags WHERE pcode IN temp.newroms;",
+		NULL, NULL, NULL);
+	if (rc != SQLITE_OK) goto out_detach;
+
+	// the other tables may not be there in databases from older versions
+	rc = sqlite3_prepare_v2(db,
+		"SELECT name FROM src.sqlite_master WHERE type='table' AND name IN ('roms', 'blocks', 'blobs');",
+		-1, &stmt, NULL);
+	if (rc != SQLITE_OK) goto out_detach;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const char *name = (const char *)sqlite3_column_text(stmt, 0);
+		const char *sql;
+		if (!strcmp(name, "roms"))
+			sql = "INSERT OR REPLACE INTO main.roms(pcode, size, mtime)"
+				" SELECT pcode, size, mtime FROM src.roms WHERE pcode IN temp.newroms;";
+		else if (!strcmp(name, "blocks")) {
+			src_blocks = true;
+			sql = "INSERT INTO main.blocks(pcode, num, hash)"
+				" SELECT pcode, num, hash FROM src.blocks WHERE pcode IN temp.newroms;";
+		} else
+			sql = "INSERT OR IGNORE INTO main.blobs(hash, data)"
+				" SELECT hash, data FROM src.blobs WHERE hash IN"
+				" (SELECT hash FROM src.frags WHERE pcode IN temp.newroms);";
+		rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+		if (rc != SQLITE_OK) break;
+	}
+	sqlite3_finalize(stmt);
+	if (rc == SQLITE_DONE) rc = SQLITE_OK;
+	if (rc == SQLITE_OK) {
+		char *sql = sqlite3_mprintf("%s%s;", merge_clash_frags,
+			src_blocks? merge_clash_blocks: "");
+		if (!sql) rc = SQLITE_NOMEM;
+		else rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+		sqlite3_free(sql);
+		if (rc != SQLITE_OK) goto out_detach;
+		while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+			fprintf(stderr, "DB_Merge: %s: %s is a different rom from"
+				" the one already here, which is kept\n", filename,
+				(const char *)sqlite3_column_text(stmt, 0));
+			(*clashed)++;
+		}
+		sqlite3_finalize(stmt);
+		if (rc == SQLITE_DONE) rc = SQLITE_OK;
+	}
+	if (rc == SQLITE_OK) {
+		sqlite3_stmt *count;
+		rc = sqlite3_prepare_v2(db, "SELECT count(*) FROM temp.newroms;",
+			-1, &count, NULL);
+		if (rc == SQLITE_OK and sqlite3_step(count) == SQLITE_ROW)
+			*added = sqlite3_column_int(count, 0);
+		sqlite3_finalize(count);
+	}
+
+out_detach:
+	if (rc == SQLITE_OK)
+		rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		fprintf(stderr, "DB_Merge: %s: %s\n", filename, sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+	}
+	sqlite3_exec(db, "DROP TABLE IF EXISTS temp.newroms; DETACH DATABASE src;",
+		NULL, NULL, NULL);
 	return rc;
 }
@@ -3,7 +3,9 @@
 #include "sqlite3.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include "fragment.h"
 #include "pcode.h"
+#include "romview.h"
 
 int DB_Init(sqlite3 **db, char *filename);
 int DB_Close(sqlite3 *db);
@@ -19,9 +21,21 @@ int DB_AddFrag(
 	int64_t offset_relocs,
 	int64_t romsize,
 	int64_t ramsize,
-	int64_t vma
+	int64_t vma,
+	int64_t hash,
+	int64_t fingerprint
 );
+int DB_AddFrags(sqlite3 *db, char *pcode, struct fraginfo_s *frags, size_t num);
+int DB_AddRelocs(sqlite3 *db, char *pcode, struct RomView_s *rom,
+	struct fraginfo_s *frags, size_t num);
 int DB_GetRomSizeForNum(sqlite3 *db, int num);
 int DB_GetAddrForNum(sqlite3 *db, int num);
-int DB_FragSearch(sqlite3 *db, uint8_t *data, ssize_t size);
+int DB_FragSearch(sqlite3 *db, struct RomView_s *rom);
+int DB_UpdateRom(sqlite3 *db, struct RomView_s *rom, int64_t mtime_ns);
+int DB_AddBlobs(sqlite3 *db, struct RomView_s *rom);
+int DB_GetBlob(sqlite3 *db, int num, char *pcode, uint8_t **data,
+	size_t *size, char pcode_out[6]);
+int DB_DropIndexes(sqlite3 *db);
+int DB_CreateIndexes(sqlite3 *db);
+int DB_Merge(sqlite3 *db, char *filename, int *added, int *clashed);
 #endif
@@ -0,0 +1,91 @@
+#include <iso646.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "diff.h"
+
+/*
+ * Offset of the first byte that differs between a and b, or len if
+ * they're the same. Compares 64 bytes per step where SSE2 is around.
+ */
+size_t Diff_FirstMismatch(uint8_t *a, uint8_t *b, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 64 <= len; i += 64) {
+		__m128i e0 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((__m128i *)(a + i)),
+			_mm_loadu_si128((__m128i *)(b + i)));
+		__m128i e1 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((__m128i *)(a + i + 16)),
+			_mm_loadu_si128((__m128i *)(b + i + 16)));
+		__m128i e2 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((__m128i *)(a + i + 32)),
+			_mm_loadu_si128((__m128i *)(b + i + 32)));
+		__m128i e3 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((__m128i *)(a + i + 48)),
+			_mm_loadu_si128((__m128i *)(b + i + 48)));
+		__m128i all = _mm_and_si128(_mm_and_si128(e0, e1),
+			_mm_and_si128(e2, e3));
+		if (_mm_movemask_epi8(all) != 0xFFFF) break;
+	}
+	for (; i + 16 <= len; i += 16) {
+		unsigned eq = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((__m128i *)(a + i)),
+			_mm_loadu_si128((__m128i *)(b + i))));
+		if (eq != 0xFFFF)
+			return i + __builtin_ctz(~eq);
+	}
+#endif
+	for (; i < len; i++)
+		if (a[i] != b[i]) break;
+	return i;
+}
+
+// offset of the first byte that is the same in a and b, or len
+static size_t first_match(uint8_t *a, uint8_t *b, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		unsigned eq = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((__m128i *)(a + i)),
+			_mm_loadu_si128((__m128i *)(b + i))));
+		if (eq)
+			return i + __builtin_ctz(eq);
+	}
+#endif
+	for (; i < len; i++)
+		if (a[i] == b[i]) break;
+	return i;
+}
+
+/*
+ * Call cb with each run [start, end) of differing bytes. Runs closer
+ * than 4 bytes are merged, so a changed word is one range.
+ */
+void Diff_Ranges(uint8_t *a, uint8_t *b, size_t len, diff_cb cb, void *ctx)
+{
+	size_t i = 0, start, end;
+
+	for (;;) {
+		i += Diff_FirstMismatch(a + i, b + i, len - i);
+		if (i >= len) return;
+		start = i;
+		for (;;) {
+			end = i + first_match(a + i, b + i, len - i);
+			i = end;
+			if (i >= len) break;
+			size_t next = i + Diff_FirstMismatch(a + i, b + i, len - i);
+			if ((next >= len) or (next - end >= 4)) {
+				i = next;
+				break;
+			}
+			i = next;
+		}
+		cb(ctx, start, end);
+		if (end >= len) return;
+	}
+}
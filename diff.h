@@ -0,0 +1,10 @@
+#ifndef _DIFF_H_
+#define _DIFF_H_
+#include <inttypes.h>
+#include <stddef.h>
+
+typedef void (*diff_cb)(void *ctx, size_t start, size_t end);
+
+size_t Diff_FirstMismatch(uint8_t *a, uint8_t *b, size_t len);
+void Diff_Ranges(uint8_t *a, uint8_t *b, size_t len, diff_cb cb, void *ctx);
+#endif
@@ -0,0 +1,313 @@
+#ifdef __MINGW32__
+#include <winsock.h>
+#else
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#endif
+#include <iso646.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "disasm.h"
+#include "mips.h"
+#include "reloc.h"
+
+// how far back a %lo looks for the lui it goes with
+#define PAIR_WINDOW 64
+
+static uint32_t word_at(uint8_t *frag, uint32_t off)
+{
+	uint32_t w;
+	memcpy(&w, frag + off, 4);
+	return ntohl(w);
+}
+
+void FragSyms_Free(struct fragsyms_s *fs)
+{
+	free(fs->target);
+	free(fs->type);
+	free(fs->foreign);
+	free(fs->labels);
+	free(fs->funcs);
+	memset(fs, 0, sizeof(*fs));
+}
+
+static int cmp_addr(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static bool outside(struct fragsyms_s *fs, uint32_t addr)
+{
+	return (addr < fs->vma) or (addr - fs->vma >= fs->ramsize);
+}
+
+static void add_label(struct fragsyms_s *fs, uint32_t addr, uint8_t kind)
+{
+	if (!outside(fs, addr))
+		fs->labels[addr - fs->vma] |= kind;
+}
+
+// pair each %lo with the closest lui before it that sets its base
+static void pair_hilo(struct fragsyms_s *fs, uint8_t *frag)
+{
+	uint32_t nwords = fs->text_end / 4;
+	uint8_t *paired = calloc(nwords? nwords: 1, 1);
+
+	for (uint32_t k = 0; k < nwords; k++) {
+		if (fs->type[k] != RELOC_ADDIU >> 24) continue;
+		uint32_t lo = word_at(frag, 4 * k);
+		uint32_t stop = (k > PAIR_WINDOW)? k - PAIR_WINDOW: 0;
+		for (uint32_t w = k; w-- > stop; ) {
+			uint32_t hi = word_at(frag, 4 * w);
+			if (fs->type[w] != RELOC_LUI >> 24) continue;
+			if (((hi >> 16) & 31) != ((lo >> 21) & 31)) continue;
+			// the lui has the high half, and the %lo is signed
+			uint32_t full = fs->target[w] + (int16_t)lo;
+			fs->target[k] = full;
+			if (paired and !paired[w]) {
+				fs->target[w] = full;
+				paired[w] = 1;
+			}
+			break;
+		}
+	}
+	free(paired);
+}
+
+/*
+ * Work out the symbols of a fragment that is size bytes long. Returns 0,
+ * or -1 if out of memory.
+ */
+int FragSyms_Build(struct fragsyms_s *fs, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi)
+{
+	uint8_t *table;
+	uint32_t num, nwords;
+
+	memset(fs, 0, sizeof(*fs));
+	fs->vma = fi->vma;
+	fs->size = size & ~3;
+	fs->ramsize = (fi->ramsize > fs->size)? fi->ramsize: fs->size;
+	fs->text_end = get_text_end(fi);
+	if (fs->text_end > fs->size) fs->text_end = fs->size;
+	fs->text_end &= ~3;
+
+	nwords = fs->size / 4;
+	fs->target = calloc(nwords? nwords: 1, sizeof(*fs->target));
+	fs->type = calloc(nwords? nwords: 1, 1);
+	fs->foreign = calloc(nwords? nwords: 1, 1);
+	fs->labels = calloc(fs->ramsize? fs->ramsize: 1, 1);
+	fs->funcs = calloc(nwords? nwords: 1, sizeof(*fs->funcs));
+	if (!fs->target or !fs->type or !fs->foreign or !fs->labels or
+	    !fs->funcs) {
+		FragSyms_Free(fs);
+		return -1;
+	}
+
+	table = Reloc_Table(frag, fs->size, &num);
+	fs->relocs_start = table? (table - frag) - 4: fs->size;
+	fs->relocs_end = table? (table - frag) + 4 * num: fs->size;
+	for (uint32_t i = 0; i < num; i++) {
+		struct reloc_s r;
+		Reloc_Decode(&r, Reloc_Get(table, i), frag, fs->size);
+		if (r.loc == (uint32_t)-1) continue;
+		fs->target[r.addr / 4] = r.loc;
+		fs->type[r.addr / 4] = r.type >> 24;
+		fs->foreign[r.addr / 4] = r.foreign;
+	}
+	pair_hilo(fs, frag);
+
+	for (uint32_t w = 0; w < nwords; w++) {
+		if (!fs->type[w]) continue;
+		add_label(fs, fs->target[w], (fs->type[w] == RELOC_J >> 24)?
+			FRAGSYM_FUNC: FRAGSYM_DATA);
+		if ((fs->type[w] == RELOC_J >> 24) and outside(fs, fs->target[w]))
+			fs->funcs[fs->num_funcs++] = fs->target[w];
+	}
+	qsort(fs->funcs, fs->num_funcs, sizeof(*fs->funcs), cmp_addr);
+	for (uint32_t off = 0; off < fs->text_end; off += 4) {
+		uint32_t target;
+		bool is_jump;
+		if ((off >= 8) and (off < sizeof(struct fragment_s))) continue;
+		if (fs->type[off / 4]) continue;
+		if (Mips_Target(word_at(frag, off), fs->vma + off, &target, &is_jump))
+			add_label(fs, target, is_jump? FRAGSYM_FUNC: FRAGSYM_BRANCH);
+	}
+	add_label(fs, fi->entrypoint, FRAGSYM_FUNC);
+	return 0;
+}
+
+/*
+ * Name an address as func_, D_ or a local .L label. type is the
+ * relocation type >> 24 of the reference, or 0. An address outside the
+ * fragment is func_ for every reference if anything jumps to it.
+ */
+void FragSyms_Name(struct fragsyms_s *fs, char name[16], uint32_t addr,
+	uint32_t type)
+{
+	uint8_t l = 0;
+
+	if (!outside(fs, addr))
+		l = fs->labels[addr - fs->vma];
+	else if (bsearch(&addr, fs->funcs, fs->num_funcs, sizeof(addr), cmp_addr))
+		l = FRAGSYM_FUNC;
+	if ((type == RELOC_J >> 24) or (l & FRAGSYM_FUNC))
+		snprintf(name, 16, "func_%08X", addr);
+	else if (type or (l & FRAGSYM_DATA))
+		snprintf(name, 16, "D_%08X", addr);
+	else
+		snprintf(name, 16, ".L%08X", addr);
+}
+
+// the operand that replaces a relocated or branch field, or NULL
+static const char *operand(struct fragsyms_s *fs, char sym[24],
+	uint32_t insn, uint32_t off)
+{
+	char name[16];
+	uint32_t target;
+	bool is_jump;
+	uint8_t type = fs->type[off / 4];
+
+	switch (type) {
+	case RELOC_J >> 24:
+		FragSyms_Name(fs, sym, fs->target[off / 4], type);
+		return sym;
+	case RELOC_LUI >> 24:
+	case RELOC_ADDIU >> 24:
+		FragSyms_Name(fs, name, fs->target[off / 4], type);
+		snprintf(sym, 24, "%s(%s)",
+			(type == RELOC_LUI >> 24)? "%hi": "%lo", name);
+		return sym;
+	}
+	if (!Mips_Target(insn, fs->vma + off, &target, &is_jump)) return NULL;
+	if ((target < fs->vma) or (target - fs->vma >= fs->size)) return NULL;
+	FragSyms_Name(fs, sym, target, 0);
+	return sym;
+}
+
+// in a reassemblable listing, branches out of the fragment become words
+static bool is_branch(uint32_t insn, uint32_t pc)
+{
+	uint32_t target;
+	bool is_jump;
+	return Mips_Target(insn, pc, &target, &is_jump);
+}
+
+static void list_bss(struct outbuf_s *ob, struct fragsyms_s *fs)
+{
+	char sym[24];
+	uint32_t last = fs->size;
+
+	OutBuf_Puts(ob, "\n.section .bss\n");
+	for (uint32_t off = fs->size; off < fs->ramsize; off++) {
+		if (!fs->labels[off]) continue;
+		if (off > last) OutBuf_Printf(ob, ".space 0x%x\n", off - last);
+		FragSyms_Name(fs, sym, fs->vma + off, 0);
+		OutBuf_Puts(ob, sym);
+		OutBuf_Puts(ob, ":\n");
+		last = off;
+	}
+	if (fs->ramsize > last)
+		OutBuf_Printf(ob, ".space 0x%x\n", fs->ramsize - last);
+}
+
+static void list_frag(struct outbuf_s *ob, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi, bool reassemble)
+{
+	struct fragsyms_s fs;
+	char sym[24];
+
+	OutBuf_Printf(ob, "\n# fragment %d at 0x%" PRIx64
+		", vma 0x%08x, romsize 0x%x, ramsize 0x%x\n",
+		fi->num, fi->addr, fi->vma, fi->romsize, fi->ramsize);
+	if (FragSyms_Build(&fs, frag, size, fi)) {
+		ob->error = true;
+		return;
+	}
+	if (reassemble)
+		OutBuf_Puts(ob, ".set noat\n.set noreorder\n\n.section .text\n");
+
+	for (uint32_t off = 0; off < fs.size; off += 4) {
+		uint32_t addr = fs.vma + off;
+		uint32_t insn = word_at(frag, off);
+
+		if (reassemble and (off == fs.text_end) and (off < fs.relocs_start))
+			OutBuf_Puts(ob, "\n.section .data\n");
+		if (off == fs.relocs_start) {
+			if (reassemble)
+				OutBuf_Puts(ob, "\n.section .reloctab, \"a\"\n");
+			OutBuf_Printf(ob, "# %u relocations\n",
+				(fs.relocs_end - fs.relocs_start) / 4 - 1);
+			if (!reassemble) {
+				off = fs.relocs_end - 4;
+				continue;
+			}
+		}
+		if (fs.labels[off]) {
+			FragSyms_Name(&fs, sym, addr, 0);
+			OutBuf_Puts(ob, sym);
+			OutBuf_Puts(ob, ":\n");
+		}
+		for (unsigned k = 1; reassemble and (k < 4); k++) {
+			if (!fs.labels[off + k]) continue;
+			FragSyms_Name(&fs, sym, addr + k, 0);
+			OutBuf_Printf(ob, "%s = . + %u\n", sym, k);
+		}
+		OutBuf_Puts(ob, "/* ");
+		OutBuf_Hex(ob, off, 6);
+		OutBuf_Putc(ob, ' ');
+		OutBuf_Hex(ob, addr, 8);
+		OutBuf_Putc(ob, ' ');
+		OutBuf_Hex(ob, insn, 8);
+		OutBuf_Puts(ob, " */  ");
+
+		bool code = (off < fs.text_end) and
+			((off < 8) or (off >= sizeof(struct fragment_s)));
+		const char *op = code? operand(&fs, sym, insn, off): NULL;
+		if (code and reassemble and !op and is_branch(insn, addr))
+			code = false;
+		if (code and (fs.type[off / 4] != RELOC_PTR >> 24)) {
+			Mips_Disasm(ob, insn, addr, op);
+		} else if (fs.type[off / 4]) {
+			OutBuf_Puts(ob, ".word     ");
+			FragSyms_Name(&fs, sym, fs.target[off / 4], fs.type[off / 4]);
+			OutBuf_Puts(ob, sym);
+		} else {
+			OutBuf_Puts(ob, ".word     0x");
+			OutBuf_Hex(ob, insn, 8);
+		}
+		OutBuf_Putc(ob, '\n');
+	}
+	if (fs.ramsize > fs.size) {
+		if (reassemble)
+			list_bss(ob, &fs);
+		else
+			OutBuf_Printf(ob, "# bss 0x%08x-0x%08x\n",
+				fs.vma + fs.size, fs.vma + fs.ramsize);
+	}
+	FragSyms_Free(&fs);
+}
+
+/*
+ * Write an assembly listing of a fragment that is size bytes long. The
+ * header and data are written as words, the relocation table is left
+ * out since it's what the symbols came from.
+ */
+void Disasm_Frag(struct outbuf_s *ob, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi)
+{
+	list_frag(ob, frag, size, fi, false);
+}
+
+/*
+ * The same listing as something GNU as will take back: code, data,
+ * relocation table and bss go in their own sections, every local symbol
+ * is defined, and branches that leave the fragment are kept as words.
+ */
+void Disasm_FragAsm(struct outbuf_s *ob, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi)
+{
+	list_frag(ob, frag, size, fi, true);
+}
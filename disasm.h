@@ -0,0 +1,42 @@
+#ifndef _DISASM_H_
+#define _DISASM_H_
+#include <inttypes.h>
+#include <stddef.h>
+#include "fragment.h"
+#include "outbuf.h"
+
+// what a fragment address is labelled as
+#define FRAGSYM_FUNC	1	// jumped to
+#define FRAGSYM_DATA	2	// pointed at
+#define FRAGSYM_BRANCH	4	// branched to
+
+/*
+ * The symbols of one fragment, worked out from its relocation table and
+ * branches. Relocated words know the address they refer to; a lui and
+ * the %lo that pairs with it both get the full address.
+ */
+struct fragsyms_s {
+	uint32_t vma;
+	uint32_t size;		// bytes of fragment we have
+	uint32_t ramsize;
+	uint32_t text_end;
+	uint32_t relocs_start;	// the relocation table, count included
+	uint32_t relocs_end;
+	uint32_t *target;	// per word: address a relocated word refers to
+	uint8_t *type;		// per word: relocation type >> 24, 0 if none
+	uint8_t *foreign;	// per word: relocation is to another fragment
+	uint8_t *labels;	// per byte of ram: FRAGSYM_* bits
+	uint32_t *funcs;	// addresses outside it that are jumped to, sorted
+	size_t num_funcs;
+};
+
+int FragSyms_Build(struct fragsyms_s *fs, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi);
+void FragSyms_Free(struct fragsyms_s *fs);
+void FragSyms_Name(struct fragsyms_s *fs, char name[16], uint32_t addr,
+	uint32_t type);
+void Disasm_Frag(struct outbuf_s *ob, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi);
+void Disasm_FragAsm(struct outbuf_s *ob, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi);
+#endif
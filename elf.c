@@ -0,0 +1,401 @@
+#ifdef __MINGW32__
+#include <winsock.h>
+#else
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#endif
+#include <iso646.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "disasm.h"
+#include "elf.h"
+#include "reloc.h"
+
+// section header indexes, in the order they're written
+enum {
+	SEC_NULL,
+	SEC_TEXT,
+	SEC_DATA,
+	SEC_BSS,
+	SEC_REL_TEXT,
+	SEC_REL_DATA,
+	SEC_SYMTAB,
+	SEC_STRTAB,
+	SEC_SHSTRTAB,
+	NUM_SECS,
+};
+
+static const char *sec_names[NUM_SECS] = {
+	"", ".text", ".data", ".bss", ".rel.text", ".rel.data",
+	".symtab", ".strtab", ".shstrtab",
+};
+
+struct elfsym_s {
+	char name[16];
+	uint32_t value;
+	uint16_t shndx;
+	uint8_t info;
+};
+
+struct elfsec_s {
+	uint32_t type, flags, addr, offset, size, link, info, align, entsize;
+};
+
+static void put32(struct outbuf_s *ob, uint32_t v)
+{
+	v = htonl(v);
+	OutBuf_Write(ob, &v, 4);
+}
+
+static void put16(struct outbuf_s *ob, uint16_t v)
+{
+	v = htons(v);
+	OutBuf_Write(ob, &v, 2);
+}
+
+static void align(struct outbuf_s *ob, size_t a)
+{
+	while (ob->len % a) OutBuf_Putc(ob, '\0');
+}
+
+static int cmp_sym(const void *a, const void *b)
+{
+	return strcmp(((struct elfsym_s *)a)->name, ((struct elfsym_s *)b)->name);
+}
+
+// index into syms of a global symbol; by_name is syms[first..] sorted
+static uint32_t find_sym(struct elfsym_s *by_name, uint32_t *index,
+	size_t num, const char *name)
+{
+	struct elfsym_s key;
+	struct elfsym_s *s;
+
+	strcpy(key.name, name);
+	s = bsearch(&key, by_name, num, sizeof(key), cmp_sym);
+	return s? index[s - by_name]: 0;
+}
+
+static uint8_t rel_type(uint8_t type)
+{
+	switch (type << 24) {
+	case RELOC_PTR:
+		return R_MIPS_32;
+	case RELOC_J:
+		return R_MIPS_26;
+	case RELOC_LUI:
+		return R_MIPS_HI16;
+	case RELOC_ADDIU:
+		return R_MIPS_LO16;
+	default:
+		return 0;
+	}
+}
+
+// returns 0, or -1 with why if a relocation has no symbol
+static int write_rels(struct outbuf_s *ob, struct fragsyms_s *fs,
+	uint32_t start, uint32_t end, struct elfsym_s *by_name,
+	uint32_t *index, size_t num_globals, char *why, size_t whylen)
+{
+	char name[16];
+
+	for (uint32_t off = start; off < end; off += 4) {
+		uint8_t type = fs->type[off / 4];
+		uint32_t sym;
+		if (!rel_type(type)) continue;
+		FragSyms_Name(fs, name, fs->target[off / 4], type);
+		sym = find_sym(by_name, index, num_globals, name);
+		if (!sym) {
+			snprintf(why, whylen, "0x%06x: no symbol for %s %s",
+				off, Reloc_TypeName(type << 24), name);
+			return -1;
+		}
+		put32(ob, off - start);
+		put32(ob, (sym << 8) | rel_type(type));
+	}
+	return 0;
+}
+
+/*
+ * Write a fragment as a big-endian MIPS relocatable object. Code before
+ * offset_code is .text, the rest up to the relocation table is .data,
+ * and ramsize past the end of the fragment is .bss. Each relocation
+ * becomes an R_MIPS_* against a symbol named like the export-asm ones,
+ * defined here if it's in this fragment, with the relocated field zeroed
+ * so the addend is 0. Returns 0, or -1 with the reason in why.
+ */
+int Elf_Frag(struct outbuf_s *ob, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi, char *why, size_t whylen)
+{
+	__label__ out_free;
+	struct fragsyms_s fs;
+	struct elfsym_s *syms = NULL, *by_name = NULL;
+	uint32_t *index = NULL;
+	size_t num_syms = 0, num_globals, cap;
+	struct elfsec_s sec[NUM_SECS] = {{0}};
+	struct outbuf_s strtab;
+	uint32_t text_end, data_end, *name_off = NULL;
+	size_t start = ob->len;
+	int rc = -1;
+
+	snprintf(why, whylen, "out of memory");
+	if (FragSyms_Build(&fs, frag, size, fi)) return -1;
+	OutBuf_Init(&strtab);
+	text_end = fs.text_end;
+	data_end = (fs.relocs_start > text_end)? fs.relocs_start: text_end;
+
+	// null, a symbol per section, then one per label and outside target
+	cap = 4 + fs.ramsize + fs.size / 4;
+	syms = calloc(cap, sizeof(*syms));
+	if (!syms) goto out_free;
+	num_syms = 1;
+	for (uint16_t s = SEC_TEXT; s <= SEC_BSS; s++) {
+		syms[num_syms].shndx = s;
+		syms[num_syms++].info = (STB_LOCAL << 4) | STT_SECTION;
+	}
+	for (uint32_t off = 0; off < fs.ramsize; off++) {
+		uint8_t l = fs.labels[off];
+		struct elfsym_s *s;
+		if (!(l & (FRAGSYM_FUNC | FRAGSYM_DATA))) continue;
+		s = &syms[num_syms++];
+		FragSyms_Name(&fs, s->name, fs.vma + off, 0);
+		s->info = (STB_GLOBAL << 4)
+			| ((l & FRAGSYM_FUNC)? STT_FUNC: STT_OBJECT);
+		if (off < text_end) {
+			s->shndx = SEC_TEXT;
+			s->value = off;
+		} else if (off < data_end) {
+			s->shndx = SEC_DATA;
+			s->value = off - text_end;
+		} else if (off >= fs.size) {
+			s->shndx = SEC_BSS;
+			s->value = off - fs.size;
+		} else {
+			// in the relocation table, which isn't a section here
+			s->shndx = SHN_ABS;
+			s->value = fs.vma + off;
+		}
+	}
+	size_t first_undef = num_syms;
+	for (uint32_t w = 0; w < data_end / 4; w++) {
+		uint32_t target = fs.target[w];
+		if (!rel_type(fs.type[w])) continue;
+		if ((target >= fs.vma) and (target - fs.vma < fs.ramsize)) continue;
+		FragSyms_Name(&fs, syms[num_syms].name, target, fs.type[w]);
+		syms[num_syms++].info = (STB_GLOBAL << 4) | STT_NOTYPE;
+	}
+	// undefined symbols once each
+	qsort(syms + first_undef, num_syms - first_undef, sizeof(*syms), cmp_sym);
+	size_t n = first_undef;
+	for (size_t i = first_undef; i < num_syms; i++)
+		if ((n == first_undef) or strcmp(syms[i].name, syms[n - 1].name))
+			syms[n++] = syms[i];
+	num_syms = n;
+
+	num_globals = num_syms - 4;
+	by_name = malloc((num_globals + 1) * sizeof(*by_name));
+	index = malloc((num_globals + 1) * sizeof(*index));
+	name_off = calloc(num_syms, sizeof(*name_off));
+	if (!by_name or !index or !name_off) goto out_free;
+	for (size_t i = 0; i < num_globals; i++) {
+		by_name[i] = syms[4 + i];
+		by_name[i].value = 4 + i;
+	}
+	qsort(by_name, num_globals, sizeof(*by_name), cmp_sym);
+	for (size_t i = 0; i < num_globals; i++)
+		index[i] = by_name[i].value;
+
+	// the header is filled in once the sections are placed
+	OutBuf_Reserve(ob, 52);
+	for (int i = 0; i < 52; i++) OutBuf_Putc(ob, '\0');
+	align(ob, 16);
+
+	sec[SEC_TEXT] = (struct elfsec_s){
+		.type = SHT_PROGBITS, .flags = SHF_ALLOC | SHF_EXECINSTR,
+		.addr = fs.vma, .offset = ob->len - start, .size = text_end,
+		.align = 16,
+	};
+	size_t body = ob->len;
+	OutBuf_Write(ob, frag, data_end);
+	if (ob->error) goto out_free;
+	for (uint32_t w = 0; w < data_end / 4; w++) {
+		uint32_t word;
+		if (!rel_type(fs.type[w])) continue;
+		memcpy(&word, ob->p + body + 4 * w, 4);
+		word &= ~htonl(Reloc_Mask(fs.type[w] << 24));
+		memcpy(ob->p + body + 4 * w, &word, 4);
+	}
+	sec[SEC_DATA] = (struct elfsec_s){
+		.type = SHT_PROGBITS, .flags = SHF_ALLOC | SHF_WRITE,
+		.addr = fs.vma + text_end, .offset = sec[SEC_TEXT].offset + text_end,
+		.size = data_end - text_end, .align = 16,
+	};
+	sec[SEC_BSS] = (struct elfsec_s){
+		.type = SHT_NOBITS, .flags = SHF_ALLOC | SHF_WRITE,
+		.addr = fs.vma + fs.size, .offset = ob->len - start,
+		.size = fs.ramsize - fs.size, .align = 16,
+	};
+
+	align(ob, 4);
+	sec[SEC_REL_TEXT] = (struct elfsec_s){
+		.type = SHT_REL, .offset = ob->len - start, .link = SEC_SYMTAB,
+		.info = SEC_TEXT, .align = 4, .entsize = 8,
+	};
+	if (write_rels(ob, &fs, 0, text_end, by_name, index, num_globals,
+		why, whylen))
+		goto out_free;
+	sec[SEC_REL_TEXT].size = ob->len - start - sec[SEC_REL_TEXT].offset;
+	sec[SEC_REL_DATA] = (struct elfsec_s){
+		.type = SHT_REL, .offset = ob->len - start, .link = SEC_SYMTAB,
+		.info = SEC_DATA, .align = 4, .entsize = 8,
+	};
+	if (write_rels(ob, &fs, text_end, data_end, by_name, index, num_globals,
+		why, whylen))
+		goto out_free;
+	sec[SEC_REL_DATA].size = ob->len - start - sec[SEC_REL_DATA].offset;
+
+	OutBuf_Putc(&strtab, '\0');
+	for (size_t i = 4; i < num_syms; i++) {
+		name_off[i] = strtab.len;
+		OutBuf_Write(&strtab, syms[i].name, strlen(syms[i].name) + 1);
+	}
+	sec[SEC_SYMTAB] = (struct elfsec_s){
+		.type = SHT_SYMTAB, .offset = ob->len - start,
+		.size = num_syms * 16, .link = SEC_STRTAB, .info = 4,
+		.align = 4, .entsize = 16,
+	};
+	for (size_t i = 0; i < num_syms; i++) {
+		put32(ob, name_off[i]);
+		put32(ob, syms[i].value);
+		put32(ob, 0);
+		OutBuf_Putc(ob, syms[i].info);
+		OutBuf_Putc(ob, 0);
+		put16(ob, syms[i].shndx);
+	}
+	sec[SEC_STRTAB] = (struct elfsec_s){
+		.type = SHT_STRTAB, .offset = ob->len - start,
+		.size = strtab.len, .align = 1,
+	};
+	if (strtab.error) goto out_free;
+	OutBuf_Write(ob, strtab.p, strtab.len);
+
+	uint32_t sec_name[NUM_SECS];
+	sec[SEC_SHSTRTAB] = (struct elfsec_s){
+		.type = SHT_STRTAB, .offset = ob->len - start, .align = 1,
+	};
+	for (int s = 0; s < NUM_SECS; s++) {
+		sec_name[s] = ob->len - start - sec[SEC_SHSTRTAB].offset;
+		OutBuf_Write(ob, sec_names[s], strlen(sec_names[s]) + 1);
+	}
+	sec[SEC_SHSTRTAB].size = ob->len - start - sec[SEC_SHSTRTAB].offset;
+
+	align(ob, 4);
+	uint32_t shoff = ob->len - start;
+	for (int s = 0; s < NUM_SECS; s++) {
+		put32(ob, s? sec_name[s]: 0);
+		put32(ob, sec[s].type);
+		put32(ob, sec[s].flags);
+		put32(ob, sec[s].addr);
+		put32(ob, sec[s].offset);
+		put32(ob, sec[s].size);
+		put32(ob, sec[s].link);
+		put32(ob, sec[s].info);
+		put32(ob, sec[s].align);
+		put32(ob, sec[s].entsize);
+	}
+	if (ob->error) goto out_free;
+
+	// now the header, over the space left for it
+	struct outbuf_s hdr;
+	OutBuf_Init(&hdr);
+	static const uint8_t ident[16] = {
+		0x7F, 'E', 'L', 'F', 1, 2, 1,	// 32 bit, big-endian, v1
+	};
+	OutBuf_Write(&hdr, ident, sizeof(ident));
+	put16(&hdr, ET_REL);
+	put16(&hdr, EM_MIPS);
+	put32(&hdr, 1);
+	put32(&hdr, 0);			// entry
+	put32(&hdr, 0);			// phoff
+	put32(&hdr, shoff);
+	put32(&hdr, EF_MIPS_ARCH_3 | EF_MIPS_NOREORDER);
+	put16(&hdr, 52);
+	put16(&hdr, 0);			// phentsize
+	put16(&hdr, 0);			// phnum
+	put16(&hdr, 40);
+	put16(&hdr, NUM_SECS);
+	put16(&hdr, SEC_SHSTRTAB);
+	if (!hdr.error) {
+		memcpy(ob->p + start, hdr.p, 52);
+		rc = 0;
+	}
+	OutBuf_Free(&hdr);
+
+out_free:
+	OutBuf_Free(&strtab);
+	free(name_off);
+	free(index);
+	free(by_name);
+	free(syms);
+	FragSyms_Free(&fs);
+	return rc;
+}
+
+static uint32_t get32(uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+static uint16_t get16(uint8_t *p)
+{
+	uint16_t v;
+	memcpy(&v, p, 2);
+	return ntohs(v);
+}
+
+/*
+ * Find a section by name in a big-endian ELF32 object, such as one an
+ * assembler wrote. Returns 0 with its contents in data and len, or -1 if
+ * it isn't there or the object doesn't hang together.
+ */
+int Elf_Section(uint8_t *obj, size_t size, const char *name,
+	uint8_t **data, uint32_t *len)
+{
+	uint32_t shoff, shentsize, shnum, shstrndx;
+	uint32_t stroff, strsize;
+	uint8_t *sh;
+
+	if ((size < 52) or memcmp(obj, "\177ELF\1\2", 6)) return -1;
+	shoff = get32(obj + 0x20);
+	shentsize = get16(obj + 0x2e);
+	shnum = get16(obj + 0x30);
+	shstrndx = get16(obj + 0x32);
+	if ((shentsize < 40) or (shstrndx >= shnum) or (shoff > size) or
+	    ((uint64_t)shnum * shentsize > size - shoff))
+		return -1;
+
+	sh = obj + shoff + shstrndx * shentsize;
+	stroff = get32(sh + 0x10);
+	strsize = get32(sh + 0x14);
+	if ((stroff > size) or (strsize > size - stroff)) return -1;
+
+	for (uint32_t i = 1; i < shnum; i++) {
+		uint32_t off, sz, n;
+
+		sh = obj + shoff + i * shentsize;
+		n = get32(sh);
+		if ((n >= strsize) or !memchr(obj + stroff + n, '\0', strsize - n))
+			continue;
+		if (strcmp((char *)obj + stroff + n, name)) continue;
+		off = get32(sh + 0x10);
+		sz = get32(sh + 0x14);
+		if (get32(sh + 4) == SHT_NOBITS) sz = 0;
+		if ((off > size) or (sz > size - off)) return -1;
+		*data = obj + off;
+		*len = sz;
+		return 0;
+	}
+	return -1;
+}
@@ -0,0 +1,38 @@
+#ifndef _ELF_H_
+#define _ELF_H_
+#include <inttypes.h>
+#include <stddef.h>
+#include "fragment.h"
+#include "outbuf.h"
+
+// the few ELF constants a MIPS relocatable object needs
+#define ET_REL		1
+#define EM_MIPS		8
+#define SHT_PROGBITS	1
+#define SHT_SYMTAB	2
+#define SHT_STRTAB	3
+#define SHT_NOBITS	8
+#define SHT_REL		9
+#define SHF_WRITE	1
+#define SHF_ALLOC	2
+#define SHF_EXECINSTR	4
+#define SHN_UNDEF	0
+#define SHN_ABS		0xFFF1
+#define STB_LOCAL	0
+#define STB_GLOBAL	1
+#define STT_NOTYPE	0
+#define STT_OBJECT	1
+#define STT_FUNC	2
+#define STT_SECTION	3
+#define R_MIPS_32	2
+#define R_MIPS_26	4
+#define R_MIPS_HI16	5
+#define R_MIPS_LO16	6
+#define EF_MIPS_NOREORDER	0x00000001
+#define EF_MIPS_ARCH_3		0x20000000
+
+int Elf_Frag(struct outbuf_s *ob, uint8_t *frag, size_t size,
+	struct fraginfo_s *fi, char *why, size_t whylen);
+int Elf_Section(uint8_t *obj, size_t size, const char *name,
+	uint8_t **data, uint32_t *len);
+#endif
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <iso646.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fragindex.h"
+#include "reloc.h"
+
+// the size of one element of each section
+static const size_t section_width[FRAGINDEX_SECTIONS] = {
+	[FRAGINDEX_NUM] = 4,
+	[FRAGINDEX_ADDR] = 8,
+	[FRAGINDEX_ROMSIZE] = 4,
+	[FRAGINDEX_RAMSIZE] = 4,
+	[FRAGINDEX_VMA] = 4,
+	[FRAGINDEX_ENTRYPOINT] = 4,
+	[FRAGINDEX_OFFSET_CODE] = 4,
+	[FRAGINDEX_OFFSET_RELOCS] = 4,
+	[FRAGINDEX_HASH] = 8,
+	[FRAGINDEX_FINGERPRINT] = 8,
+	[FRAGINDEX_INTERVALS] = sizeof(struct fragindex_interval_s),
+	[FRAGINDEX_DEP_START] = 4,
+	[FRAGINDEX_DEPS] = 4,
+};
+
+static int cmp_interval(const void *a, const void *b)
+{
+	const struct fragindex_interval_s *x = a, *y = b;
+	if (x->start != y->start) return (x->start > y->start)? 1: -1;
+	return (x->frag > y->frag) - (x->frag < y->frag);
+}
+
+static int cmp_int32(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * The fragments a fragment refers to, like cmd_depends shows, appended
+ * to *deps. Returns 0, or -1 if out of memory.
+ */
+static int add_deps(struct RomView_s *rom, struct fraginfo_s *fi,
+	int32_t **deps, size_t *num, size_t *cap)
+{
+	uint64_t len = fi->romsize;
+	uint8_t *p, *table;
+	uint32_t num_relocs;
+	size_t first = *num;
+
+	if (len > rom->size - fi->addr) len = rom->size - fi->addr;
+	p = RomView_Get(rom, fi->addr, len);
+	if (!p) return -1;
+	table = Reloc_Table(p, len, &num_relocs);
+	for (uint32_t i = 0; i < num_relocs; i++) {
+		struct reloc_s r;
+		Reloc_Decode(&r, Reloc_Get(table, i), p, len);
+		if ((r.target_frag < 0) or (r.target_frag == fi->num)) continue;
+		if (*num == *cap) {
+			int32_t *n;
+			*cap = *cap? *cap * 2: 256;
+			n = realloc(*deps, *cap * sizeof(*n));
+			if (!n) {
+				RomView_Put(rom, p);
+				return -1;
+			}
+			*deps = n;
+		}
+		(*deps)[(*num)++] = r.target_frag;
+	}
+	RomView_Put(rom, p);
+
+	// sorted and distinct
+	size_t out = first;
+	qsort(*deps + first, *num - first, sizeof(**deps), cmp_int32);
+	for (size_t i = first; i < *num; i++)
+		if ((i == first) or ((*deps)[i] != (*deps)[out - 1]))
+			(*deps)[out++] = (*deps)[i];
+	*num = out;
+	return 0;
+}
+
+/*
+ * Write the index of a rom whose fragments have been found. Returns 0,
+ * or -1 on error.
+ */
+int FragIndex_Write(char *filename, struct RomView_s *rom,
+	struct fraginfo_s *frags, size_t num)
+{
+	__label__ out_free;
+	struct fragindex_header_s hdr = {0};
+	void *data[FRAGINDEX_SECTIONS] = {0};
+	size_t num_deps = 0, cap_deps = 0;
+	int32_t *deps = NULL;
+	uint64_t off;
+	FILE *f = NULL;
+	int rc = -1;
+
+	for (int s = 0; s < FRAGINDEX_SECTIONS; s++) {
+		size_t n = (s == FRAGINDEX_DEP_START)? num + 1: num;
+		if (s == FRAGINDEX_DEPS) continue;
+		data[s] = calloc(n + 1, section_width[s]);
+		if (!data[s]) goto out_free;
+		hdr.sections[s].size = n * section_width[s];
+	}
+
+	int32_t *nums = data[FRAGINDEX_NUM];
+	uint64_t *addrs = data[FRAGINDEX_ADDR];
+	uint32_t *romsizes = data[FRAGINDEX_ROMSIZE];
+	uint32_t *ramsizes = data[FRAGINDEX_RAMSIZE];
+	uint32_t *vmas = data[FRAGINDEX_VMA];
+	uint32_t *entrypoints = data[FRAGINDEX_ENTRYPOINT];
+	uint32_t *offset_codes = data[FRAGINDEX_OFFSET_CODE];
+	uint32_t *offset_relocs = data[FRAGINDEX_OFFSET_RELOCS];
+	uint64_t *hashes = data[FRAGINDEX_HASH];
+	uint64_t *fingerprints = data[FRAGINDEX_FINGERPRINT];
+	struct fragindex_interval_s *intervals = data[FRAGINDEX_INTERVALS];
+	uint32_t *dep_start = data[FRAGINDEX_DEP_START];
+
+	for (size_t i = 0; i < num; i++) {
+		nums[i] = frags[i].num;
+		addrs[i] = frags[i].addr;
+		romsizes[i] = frags[i].romsize;
+		ramsizes[i] = frags[i].ramsize;
+		vmas[i] = frags[i].vma;
+		entrypoints[i] = frags[i].entrypoint;
+		offset_codes[i] = frags[i].offset_code;
+		offset_relocs[i] = frags[i].offset_relocs;
+		hashes[i] = frags[i].hash;
+		fingerprints[i] = frags[i].fingerprint;
+		intervals[i].start = frags[i].vma;
+		intervals[i].end = (uint64_t)frags[i].vma + frags[i].ramsize;
+		intervals[i].frag = i;
+		dep_start[i] = num_deps;
+		if (add_deps(rom, &frags[i], &deps, &num_deps, &cap_deps))
+			goto out_free;
+	}
+	dep_start[num] = num_deps;
+	qsort(intervals, num, sizeof(*intervals), cmp_interval);
+	data[FRAGINDEX_DEPS] = deps;
+	hdr.sections[FRAGINDEX_DEPS].size = num_deps * sizeof(*deps);
+
+	memcpy(hdr.magic, FRAGINDEX_MAGIC, sizeof(hdr.magic));
+	hdr.version = FRAGINDEX_VERSION;
+	hdr.bom = FRAGINDEX_BOM;
+	hdr.page_size = FRAGINDEX_PAGE;
+	hdr.num_frags = num;
+	hdr.num_deps = num_deps;
+	hdr.rom_size = rom->size;
+	memcpy(hdr.rom_header, rom->header, sizeof(hdr.rom_header));
+	off = FRAGINDEX_PAGE;
+	for (int s = 0; s < FRAGINDEX_SECTIONS; s++) {
+		hdr.sections[s].offset = off;
+		off += (hdr.sections[s].size + FRAGINDEX_PAGE - 1) & ~(uint64_t)(FRAGINDEX_PAGE - 1);
+	}
+
+	f = fopen(filename, "wb");
+	if (!f) goto out_free;
+	rc = 0;
+	static const uint8_t zeros[FRAGINDEX_PAGE];
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) rc = -1;
+	if (fwrite(zeros, FRAGINDEX_PAGE - sizeof(hdr), 1, f) != 1) rc = -1;
+	for (int s = 0; (rc == 0) and (s < FRAGINDEX_SECTIONS); s++) {
+		size_t size = hdr.sections[s].size;
+		size_t pad = (FRAGINDEX_PAGE - size % FRAGINDEX_PAGE) % FRAGINDEX_PAGE;
+		if (size and (fwrite(data[s], size, 1, f) != 1)) rc = -1;
+		if (pad and (fwrite(zeros, pad, 1, f) != 1)) rc = -1;
+	}
+	if (fclose(f)) rc = -1;
+
+out_free:
+	for (int s = 0; s < FRAGINDEX_SECTIONS; s++)
+		if (s != FRAGINDEX_DEPS) free(data[s]);
+	free(deps);
+	return rc;
+}
+
+/*
+ * Map an index and point into it. Nothing is copied. Returns 0, or -1 if
+ * it can't be read or isn't an index this version understands.
+ */
+int FragIndex_Open(struct fragindex_s *fx, char *filename)
+{
+	__label__ out_bad;
+	const struct fragindex_header_s *hdr;
+	const void *sec[FRAGINDEX_SECTIONS];
+
+	memset(fx, 0, sizeof(*fx));
+	fx->m = MappedFile_Open(filename, false);
+	if (!fx->m.data) return -1;
+	hdr = fx->m.data;
+	if ((fx->m.size < FRAGINDEX_PAGE)
+		or memcmp(hdr->magic, FRAGINDEX_MAGIC, sizeof(hdr->magic))
+		or (hdr->version != FRAGINDEX_VERSION)
+		or (hdr->bom != FRAGINDEX_BOM))
+		goto out_bad;
+	for (int s = 0; s < FRAGINDEX_SECTIONS; s++) {
+		uint64_t off = hdr->sections[s].offset;
+		uint64_t size = hdr->sections[s].size;
+		size_t n = (s == FRAGINDEX_DEPS)? hdr->num_deps:
+			(s == FRAGINDEX_DEP_START)? hdr->num_frags + 1: hdr->num_frags;
+		sec[s] = NULL;
+		if (!off and ((s == FRAGINDEX_DEP_START) or (s == FRAGINDEX_DEPS)))
+			continue;
+		if ((off % FRAGINDEX_PAGE) or (off > fx->m.size)
+			or (size > fx->m.size - off)
+			or (size != n * section_width[s]))
+			goto out_bad;
+		sec[s] = (uint8_t *)fx->m.data + off;
+	}
+
+	fx->hdr = hdr;
+	fx->num = sec[FRAGINDEX_NUM];
+	fx->addr = sec[FRAGINDEX_ADDR];
+	fx->romsize = sec[FRAGINDEX_ROMSIZE];
+	fx->ramsize = sec[FRAGINDEX_RAMSIZE];
+	fx->vma = sec[FRAGINDEX_VMA];
+	fx->entrypoint = sec[FRAGINDEX_ENTRYPOINT];
+	fx->offset_code = sec[FRAGINDEX_OFFSET_CODE];
+	fx->offset_relocs = sec[FRAGINDEX_OFFSET_RELOCS];
+	fx->hash = sec[FRAGINDEX_HASH];
+	fx->fingerprint = sec[FRAGINDEX_FINGERPRINT];
+	fx->intervals = sec[FRAGINDEX_INTERVALS];
+	if (sec[FRAGINDEX_DEP_START] and sec[FRAGINDEX_DEPS]) {
+		fx->dep_start = sec[FRAGINDEX_DEP_START];
+		fx->deps = sec[FRAGINDEX_DEPS];
+	}
+	return 0;
+
+out_bad:
+	MappedFile_Close(fx->m);
+	memset(fx, 0, sizeof(*fx));
+	return -1;
+}
+
+void FragIndex_Close(struct fragindex_s *fx)
+{
+	if (fx->m.data) MappedFile_Close(fx->m);
+	memset(fx, 0, sizeof(*fx));
+}
+
+/*
+ * Whether an index was made from this rom: same size and header, and a
+ * fragment header still at every address it lists. A change inside a
+ * fragment isn't noticed, so an index is rebuilt when the rom is.
+ */
+bool FragIndex_Matches(struct fragindex_s *fx, struct RomView_s *rom)
+{
+	struct fragment_s frag;
+
+	if (!fx->hdr or (fx->hdr->rom_size != rom->size)) return false;
+	if (memcmp(fx->hdr->rom_header, rom->header, sizeof(rom->header)))
+		return false;
+	for (uint32_t i = 0; i < fx->hdr->num_frags; i++) {
+		if (fx->addr[i] > rom->size - sizeof(frag)) return false;
+		RomView_Read(rom, &frag, fx->addr[i], sizeof(frag));
+		if (!isfrag(&frag)) return false;
+	}
+	return true;
+}
+
+// entry i of the fragment table
+void FragIndex_Get(struct fragindex_s *fx, size_t i, struct fraginfo_s *fi)
+{
+	fi->addr = fx->addr[i];
+	fi->num = fx->num[i];
+	fi->entrypoint = fx->entrypoint[i];
+	fi->offset_code = fx->offset_code[i];
+	fi->offset_relocs = fx->offset_relocs[i];
+	fi->romsize = fx->romsize[i];
+	fi->ramsize = fx->ramsize[i];
+	fi->vma = fx->vma[i];
+	fi->hash = fx->hash[i];
+	fi->fingerprint = fx->fingerprint[i];
+}
+
+// the fragment table as Frag_Search returns it
+int FragIndex_Frags(struct fragindex_s *fx, struct fraginfo_s **frags,
+	size_t *num)
+{
+	size_t n = fx->hdr->num_frags;
+	struct fraginfo_s *v = calloc(n + 1, sizeof(*v));
+
+	*frags = NULL;
+	*num = 0;
+	if (!v) return -1;
+	for (size_t i = 0; i < n; i++)
+		FragIndex_Get(fx, i, &v[i]);
+	*frags = v;
+	*num = n;
+	return 0;
+}
+
+/*
+ * The fragment numbers that fragment num refers to, sorted and distinct,
+ * as depends shows them. Returns 0 with *deps pointing into the index,
+ * 1 if there's no such fragment, or -1 if the index has no graph.
+ */
+int FragIndex_Deps(struct fragindex_s *fx, int32_t num,
+	const int32_t **deps, size_t *n)
+{
+	if (!fx->dep_start) return -1;
+	for (uint32_t i = 0; i < fx->hdr->num_frags; i++) {
+		if (fx->num[i] != num) continue;
+		if ((fx->dep_start[i] > fx->dep_start[i + 1])
+			or (fx->dep_start[i + 1] > fx->hdr->num_deps))
+			return -1;
+		*deps = fx->deps + fx->dep_start[i];
+		*n = fx->dep_start[i + 1] - fx->dep_start[i];
+		return 0;
+	}
+	return 1;
+}
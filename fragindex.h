@@ -0,0 +1,98 @@
+#ifndef _FRAGINDEX_H_
+#define _FRAGINDEX_H_
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "fragment.h"
+#include "mapfile.h"
+#include "romview.h"
+
+/*
+ * A .psfidx file holds the fragment table of one rom in a form that is
+ * used straight from the mapping. Every section starts on a page, and
+ * values are in host order; the byte order mark tells if the file came
+ * from a machine that disagrees.
+ *
+ * The fragment table is one array per field, in rom order. The interval
+ * table is the ram ranges [vma, vma+ramsize) of the fragments sorted by
+ * vma, for finding what's linked at an address. The dependency graph,
+ * which depends answers from, is in CSR form: the fragment numbers
+ * fragment i depends on are deps[dep_start[i]] .. deps[dep_start[i + 1] - 1].
+ * A file without one has no DEPS sections.
+ *
+ * Version 1 had rom ranges in the interval table, and version 2 had none.
+ */
+#define FRAGINDEX_MAGIC		"PSFIDX\0\0"
+#define FRAGINDEX_VERSION	3
+#define FRAGINDEX_BOM		0x01020304
+#define FRAGINDEX_PAGE		4096
+
+enum fragindex_section_e {
+	FRAGINDEX_NUM = 0,	// int32_t
+	FRAGINDEX_ADDR,		// uint64_t
+	FRAGINDEX_ROMSIZE,	// uint32_t
+	FRAGINDEX_RAMSIZE,	// uint32_t
+	FRAGINDEX_VMA,		// uint32_t
+	FRAGINDEX_ENTRYPOINT,	// uint32_t
+	FRAGINDEX_OFFSET_CODE,	// uint32_t
+	FRAGINDEX_OFFSET_RELOCS,	// uint32_t
+	FRAGINDEX_HASH,		// uint64_t
+	FRAGINDEX_FINGERPRINT,	// uint64_t
+	FRAGINDEX_INTERVALS,	// struct fragindex_interval_s
+	FRAGINDEX_DEP_START,	// uint32_t, num_frags + 1 of them
+	FRAGINDEX_DEPS,		// int32_t
+	FRAGINDEX_SECTIONS
+};
+
+struct fragindex_header_s {
+	char magic[8];
+	uint32_t version;
+	uint32_t bom;
+	uint32_t page_size;
+	uint32_t num_frags;
+	uint32_t num_deps;
+	uint32_t reserved;
+	uint64_t rom_size;
+	uint8_t rom_header[0x40];	// normalized
+	struct {
+		uint64_t offset;	// from the start of the file, 0 if absent
+		uint64_t size;
+	} sections[FRAGINDEX_SECTIONS];
+};
+
+struct fragindex_interval_s {
+	uint64_t start;		// vma
+	uint64_t end;		// vma + ramsize
+	uint32_t frag;		// index into the fragment table
+	uint32_t reserved;
+};
+
+struct fragindex_s {
+	struct MappedFile_s m;
+	const struct fragindex_header_s *hdr;
+	const int32_t *num;
+	const uint64_t *addr;
+	const uint32_t *romsize;
+	const uint32_t *ramsize;
+	const uint32_t *vma;
+	const uint32_t *entrypoint;
+	const uint32_t *offset_code;
+	const uint32_t *offset_relocs;
+	const uint64_t *hash;
+	const uint64_t *fingerprint;
+	const struct fragindex_interval_s *intervals;
+	const uint32_t *dep_start;	// NULL if there's no graph
+	const int32_t *deps;
+};
+
+int FragIndex_Write(char *filename, struct RomView_s *rom,
+	struct fraginfo_s *frags, size_t num);
+int FragIndex_Open(struct fragindex_s *fx, char *filename);
+void FragIndex_Close(struct fragindex_s *fx);
+bool FragIndex_Matches(struct fragindex_s *fx, struct RomView_s *rom);
+void FragIndex_Get(struct fragindex_s *fx, size_t i, struct fraginfo_s *fi);
+int FragIndex_Frags(struct fragindex_s *fx, struct fraginfo_s **frags,
+	size_t *num);
+int FragIndex_Deps(struct fragindex_s *fx, int32_t num,
+	const int32_t **deps, size_t *n);
+#endif
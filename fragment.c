@@ -4,6 +4,7 @@
 #define _GNU_SOURCE
 #include <arpa/inet.h>
 #endif
+#include <iso646.h>
 #include "fragment.h"
 int32_t get_frag_num(struct fragment_s *frag)
 {
@@ -11,8 +12,13 @@ int32_t get_frag_num(struct fragment_s *frag)
 	unsigned opcode = (ep1 & 0xfc000000) >> (32-6);
 	uint32_t address = (ep1 & 0x03ffffff) << 2;
 	if (opcode != 2) return -1;
-	int fragnum = ((address >> 20) & 0xff) - 0x10;
-	return fragnum;
+	return get_addr_frag_num(address);
+}
+
+// fragment n is linked at 0x80000000 + ((n + 0x10) << 20)
+int32_t get_addr_frag_num(uint32_t addr)
+{
+	return (int32_t)((addr >> 20) & 0xff) - 0x10;
 }
 
 uint32_t get_entrypoint_offset(struct fragment_s *frag)
@@ -42,3 +48,29 @@ bool isfrag(struct fragment_s *frag)
 	if (ntohl(frag->magic2) != 0x4d454e54) return false;
 	return true;
 }
+
+void get_fraginfo(struct fraginfo_s *fi, struct fragment_s *frag, uint64_t addr)
+{
+	fi->addr = addr;
+	fi->num = get_frag_num(frag);
+	fi->entrypoint = get_entrypoint(frag);
+	fi->offset_code = ntohl(frag->offset_code);
+	fi->offset_relocs = ntohl(frag->offset_relocs);
+	fi->romsize = ntohl(frag->romsize);
+	fi->ramsize = ntohl(frag->ramsize);
+	fi->vma = get_vma(frag);
+	fi->hash = 0;
+	fi->fingerprint = 0;
+}
+
+/*
+ * offset_code is where the code ends and the data starts. Fragments
+ * that don't have a sane one are treated as all code up to the relocs.
+ */
+uint32_t get_text_end(struct fraginfo_s *fi)
+{
+	if ((fi->offset_code >= sizeof(struct fragment_s))
+		and (fi->offset_code <= fi->offset_relocs))
+		return fi->offset_code;
+	return fi->offset_relocs;
+}
@@ -15,9 +15,26 @@ struct fragment_s {
 	char data[];
 } __attribute__(( packed ));
 
+// decoded header of a fragment found in a rom
+struct fraginfo_s {
+	uint64_t addr;
+	int32_t num;
+	uint32_t entrypoint;
+	uint32_t offset_code;
+	uint32_t offset_relocs;
+	uint32_t romsize;
+	uint32_t ramsize;
+	uint32_t vma;
+	uint64_t hash;		// of the whole fragment, see Hash_Frags
+	uint64_t fingerprint;	// with relocated fields masked out
+};
+
 int32_t get_frag_num(struct fragment_s *frag);
+int32_t get_addr_frag_num(uint32_t addr);
 uint32_t get_vma(struct fragment_s *frag);
 uint32_t get_entrypoint_offset(struct fragment_s *frag);
 uint32_t get_entrypoint(struct fragment_s *frag);
 bool isfrag(struct fragment_s *frag);
+void get_fraginfo(struct fraginfo_s *fi, struct fragment_s *frag, uint64_t addr);
+uint32_t get_text_end(struct fraginfo_s *fi);
 #endif
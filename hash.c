@@ -0,0 +1,256 @@
+#include <iso646.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "pool.h"
+#include "reloc.h"
+
+#define P1 11400714785074694791ULL
+#define P2 14029467366897019727ULL
+#define P3 1609587929392839161ULL
+#define P4 9650029242287828579ULL
+#define P5 2870177450012600261ULL
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input)
+{
+	acc += input * P2;
+	acc = rotl(acc, 31);
+	return acc * P1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t val)
+{
+	acc ^= round64(0, val);
+	return acc * P1 + P4;
+}
+
+void XXH64_Reset(struct xxh64_s *s, uint64_t seed)
+{
+	s->v[0] = seed + P1 + P2;
+	s->v[1] = seed + P2;
+	s->v[2] = seed;
+	s->v[3] = seed - P1;
+	s->total = 0;
+	s->buflen = 0;
+}
+
+void XXH64_Update(struct xxh64_s *s, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	s->total += len;
+	if (s->buflen + len < 32) {
+		memcpy(s->buf + s->buflen, p, len);
+		s->buflen += len;
+		return;
+	}
+	if (s->buflen) {
+		size_t n = 32 - s->buflen;
+		memcpy(s->buf + s->buflen, p, n);
+		for (int i = 0; i < 4; i++)
+			s->v[i] = round64(s->v[i], read64(s->buf + 8*i));
+		p += n;
+		len -= n;
+		s->buflen = 0;
+	}
+	for (; len >= 32; p += 32, len -= 32) {
+		s->v[0] = round64(s->v[0], read64(p));
+		s->v[1] = round64(s->v[1], read64(p + 8));
+		s->v[2] = round64(s->v[2], read64(p + 16));
+		s->v[3] = round64(s->v[3], read64(p + 24));
+	}
+	memcpy(s->buf, p, len);
+	s->buflen = len;
+}
+
+uint64_t XXH64_Digest(struct xxh64_s *s)
+{
+	uint64_t h;
+	const uint8_t *p = s->buf;
+	size_t len = s->buflen;
+
+	if (s->total >= 32) {
+		h = rotl(s->v[0], 1) + rotl(s->v[1], 7)
+			+ rotl(s->v[2], 12) + rotl(s->v[3], 18);
+		for (int i = 0; i < 4; i++)
+			h = merge64(h, s->v[i]);
+	} else {
+		h = s->v[2] + P5;
+	}
+	h += s->total;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		h ^= round64(0, read64(p));
+		h = rotl(h, 27) * P1 + P4;
+	}
+	if (len >= 4) {
+		h ^= (uint64_t)read32(p) * P1;
+		h = rotl(h, 23) * P2 + P3;
+		p += 4;
+		len -= 4;
+	}
+	for (; len; p++, len--) {
+		h ^= (*p) * P5;
+		h = rotl(h, 11) * P1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t XXH64(const void *data, size_t len, uint64_t seed)
+{
+	struct xxh64_s s;
+	XXH64_Reset(&s, seed);
+	XXH64_Update(&s, data, len);
+	return XXH64_Digest(&s);
+}
+
+#define U64MAP_EMPTY ((size_t)-1)
+
+// a map that will hold up to num entries
+int U64Map_Init(struct u64map_s *m, size_t num)
+{
+	size_t cap = 16;
+
+	while (cap < num * 2) cap *= 2;
+	m->mask = cap - 1;
+	m->keys = malloc(cap * sizeof(*m->keys));
+	m->vals = malloc(cap * sizeof(*m->vals));
+	if (!m->keys or !m->vals) {
+		U64Map_Free(m);
+		return -1;
+	}
+	for (size_t i = 0; i < cap; i++)
+		m->vals[i] = U64MAP_EMPTY;
+	return 0;
+}
+
+void U64Map_Free(struct u64map_s *m)
+{
+	free(m->keys);
+	free(m->vals);
+	m->keys = NULL;
+	m->vals = NULL;
+}
+
+void U64Map_Put(struct u64map_s *m, uint64_t key, size_t val)
+{
+	// keys are already hashes, but mix them in case the low bits aren't
+	size_t i = (key * P1) >> 32;
+
+	while (m->vals[i & m->mask] != U64MAP_EMPTY) i++;
+	m->keys[i & m->mask] = key;
+	m->vals[i & m->mask] = val;
+}
+
+/*
+ * Look up the values stored under key, in insertion order. Start with
+ * *iter = 0 and call again until it returns false.
+ */
+bool U64Map_Get(struct u64map_s *m, uint64_t key, size_t *iter, size_t *val)
+{
+	size_t i = ((key * P1) >> 32) + *iter;
+
+	for (; m->vals[i & m->mask] != U64MAP_EMPTY; i++) {
+		if (m->keys[i & m->mask] != key) continue;
+		*val = m->vals[i & m->mask];
+		*iter = i - ((key * P1) >> 32) + 1;
+		return true;
+	}
+	return false;
+}
+
+struct hashblocks_s {
+	uint8_t *data;
+	uint64_t size;
+	uint64_t *hashes;
+};
+
+static void block_worker(void *ctx, size_t index)
+{
+	struct hashblocks_s *h = ctx;
+	uint64_t off = (uint64_t)index * HASH_BLOCK;
+	uint64_t len = HASH_BLOCK;
+
+	if (len > h->size - off) len = h->size - off;
+	h->hashes[index] = XXH64(h->data + off, len, 0);
+}
+
+/*
+ * Hash each HASH_BLOCK of raw rom bytes, in parallel, so a later run can
+ * tell which parts of the rom were patched. Returns a malloc'd array.
+ */
+uint64_t *Hash_Blocks(uint8_t *data, uint64_t size, size_t *num)
+{
+	struct hashblocks_s h = { .data = data, .size = size };
+
+	*num = (size + HASH_BLOCK - 1) / HASH_BLOCK;
+	h.hashes = malloc((*num? *num: 1) * sizeof(*h.hashes));
+	if (!h.hashes) return NULL;
+	Pool_Run(*num, block_worker, &h);
+	return h.hashes;
+}
+
+// fill in the hash and fingerprint of a fragment from its bytes
+void Hash_Frag(struct fraginfo_s *fi, uint8_t *data, size_t len)
+{
+	fi->hash = XXH64(data, len, 0);
+	fi->fingerprint = Reloc_Fingerprint(data, len);
+}
+
+struct hashfrags_s {
+	struct RomView_s *rom;
+	struct fraginfo_s *frags;
+};
+
+static void hash_worker(void *ctx, size_t index)
+{
+	struct hashfrags_s *h = ctx;
+	struct fraginfo_s *fi = &h->frags[index];
+	uint64_t len = fi->romsize;
+	uint8_t *p;
+
+	// a bogus header can claim more than the rom has left
+	if (len > h->rom->size - fi->addr) len = h->rom->size - fi->addr;
+	p = RomView_Get(h->rom, fi->addr, len);
+	if (!p) return;
+	Hash_Frag(fi, p, len);
+	RomView_Put(h->rom, p);
+}
+
+// fill in the hash and fingerprint of each fragment, in parallel
+void Hash_Frags(struct RomView_s *rom, struct fraginfo_s *frags, size_t num)
+{
+	struct hashfrags_s h = { .rom = rom, .frags = frags };
+	Pool_Run(num, hash_worker, &h);
+}
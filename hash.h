@@ -0,0 +1,46 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "fragment.h"
+#include "romview.h"
+
+/*
+ * XXH64. Fast, and 64 bits is plenty to tell fragments apart across a
+ * corpus of roms.
+ */
+struct xxh64_s {
+	uint64_t v[4];
+	uint64_t total;
+	uint8_t buf[32];
+	size_t buflen;
+};
+
+void XXH64_Reset(struct xxh64_s *s, uint64_t seed);
+void XXH64_Update(struct xxh64_s *s, const void *data, size_t len);
+uint64_t XXH64_Digest(struct xxh64_s *s);
+uint64_t XXH64(const void *data, size_t len, uint64_t seed);
+
+/*
+ * Open-addressed map from 64-bit hashes to array indexes, sized once up
+ * front. Several values may share a key; Get walks them with *iter.
+ */
+struct u64map_s {
+	uint64_t *keys;
+	size_t *vals;
+	size_t mask;
+};
+
+int U64Map_Init(struct u64map_s *m, size_t num);
+void U64Map_Free(struct u64map_s *m);
+void U64Map_Put(struct u64map_s *m, uint64_t key, size_t val);
+bool U64Map_Get(struct u64map_s *m, uint64_t key, size_t *iter, size_t *val);
+
+// rom bytes covered by each hash of Hash_Blocks
+#define HASH_BLOCK (65536)
+
+uint64_t *Hash_Blocks(uint8_t *data, uint64_t size, size_t *num);
+void Hash_Frag(struct fraginfo_s *fi, uint8_t *data, size_t len);
+void Hash_Frags(struct RomView_s *rom, struct fraginfo_s *frags, size_t num);
+#endif
@@ -0,0 +1,229 @@
+#include <iso646.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "image.h"
+#include "pcode.h"
+#include "pool.h"
+
+struct hit_s {
+	uint64_t offset;
+	enum rom_order_e order;
+};
+
+struct hits_s {
+	struct hit_s *v;
+	size_t n, cap;
+};
+
+struct chunk_s {
+	struct hits_s roms;
+	struct hits_s frags;
+	int error;
+};
+
+struct imagescan_s {
+	uint8_t *data;
+	uint64_t size;
+	struct chunk_s *chunks;
+};
+
+// rom header magic and "FRAGMENT" as they appear in each byte order
+static const struct {
+	enum rom_order_e order;
+	char rom[4];
+	char frag[8];
+} patterns[] = {
+	{ ROM_ORDER_Z64, "\x80\x37\x12\x40", "FRAGMENT" },
+	{ ROM_ORDER_V64, "\x37\x80\x40\x12", "RFGAEMTN" },
+	{ ROM_ORDER_N64, "\x40\x12\x37\x80", "GARFTNEM" },
+};
+
+static int hits_push(struct hits_s *h, uint64_t offset, enum rom_order_e order)
+{
+	if (h->n == h->cap) {
+		size_t cap = h->cap? h->cap * 2: 64;
+		struct hit_s *v = realloc(h->v, cap * sizeof(*v));
+		if (!v) return -1;
+		h->v = v;
+		h->cap = cap;
+	}
+	h->v[h->n].offset = offset;
+	h->v[h->n].order = order;
+	h->n++;
+	return 0;
+}
+
+static int hit_cmp(const void *a, const void *b)
+{
+	const struct hit_s *x = a, *y = b;
+	if (x->offset < y->offset) return -1;
+	return x->offset > y->offset;
+}
+
+// memmem, which MinGW doesn't have
+static uint8_t *find_bytes(uint8_t *p, size_t size, const char *needle,
+	size_t len)
+{
+	uint8_t *end = p + size;
+
+	while ((size_t)(end - p) >= len) {
+		p = memchr(p, needle[0], (end - p) - len + 1);
+		if (!p) return NULL;
+		if (!memcmp(p, needle, len)) return p;
+		p++;
+	}
+	return NULL;
+}
+
+/*
+ * Find every occurrence of needle that starts inside [start, end). The
+ * search may read past end to finish a match.
+ */
+static int find_all(struct imagescan_s *s, uint64_t start, uint64_t end,
+	const char *needle, size_t len, int64_t bias,
+	enum rom_order_e order, struct hits_s *out)
+{
+	uint64_t stop = end + len - 1;
+	uint8_t *p, *base = s->data;
+
+	if (stop > s->size) stop = s->size;
+	p = base + start;
+	while ((p = find_bytes(p, (base + stop) - p, needle, len))) {
+		uint64_t off = p - base;
+		if (off >= end) break;
+		if ((int64_t)off + bias >= 0)
+			if (hits_push(out, off + bias, order)) return -1;
+		p++;
+	}
+	return 0;
+}
+
+static void image_worker(void *ctx, size_t index)
+{
+	struct imagescan_s *s = ctx;
+	struct chunk_s *c = &s->chunks[index];
+	uint64_t start = (uint64_t)index * IMAGE_CHUNK;
+	uint64_t end = start + IMAGE_CHUNK;
+
+	if (end > s->size) end = s->size;
+	for (size_t i = 0; i < sizeof(patterns)/sizeof(patterns[0]); i++) {
+		c->error |= find_all(s, start, end, patterns[i].rom, 4, 0,
+			patterns[i].order, &c->roms);
+		// the magic is 8 bytes into the header
+		c->error |= find_all(s, start, end, patterns[i].frag, 8, -8,
+			patterns[i].order, &c->frags);
+	}
+}
+
+static bool plausible_rom(struct RomView_s *rom)
+{
+	// the game code should be printable
+	for (int i = 0x3b; i < 0x3f; i++)
+		if ((rom->header[i] < 0x20) or (rom->header[i] > 0x7e))
+			return false;
+	return true;
+}
+
+/*
+ * Find the roms in an image and the fragments in each rom, in a single
+ * parallel pass over the data. The header and fragment magics are
+ * searched for together, then each fragment is matched up with the rom
+ * it lies in, the same as DB_FragSearch would have found it.
+ */
+int Image_Scan(struct image_s *img, uint8_t *data, uint64_t size)
+{
+	__label__ out_free;
+	struct imagescan_s s = { .data = data, .size = size };
+	size_t num_chunks = (size + IMAGE_CHUNK - 1) / IMAGE_CHUNK;
+	struct hits_s roms = {0}, frags = {0};
+	int rc = -1;
+
+	img->roms = NULL;
+	img->num_roms = 0;
+
+	s.chunks = calloc(num_chunks? num_chunks: 1, sizeof(*s.chunks));
+	if (!s.chunks) return -1;
+	Pool_Run(num_chunks, image_worker, &s);
+
+	for (size_t i = 0; i < num_chunks; i++) {
+		struct chunk_s *c = &s.chunks[i];
+		if (c->error) goto out_free;
+		for (size_t j = 0; j < c->roms.n; j++)
+			if (hits_push(&roms, c->roms.v[j].offset, c->roms.v[j].order))
+				goto out_free;
+		for (size_t j = 0; j < c->frags.n; j++)
+			if (hits_push(&frags, c->frags.v[j].offset, c->frags.v[j].order))
+				goto out_free;
+	}
+	qsort(roms.v, roms.n, sizeof(*roms.v), hit_cmp);
+	qsort(frags.v, frags.n, sizeof(*frags.v), hit_cmp);
+
+	img->roms = calloc(roms.n? roms.n: 1, sizeof(*img->roms));
+	if (!img->roms) goto out_free;
+	for (size_t i = 0; i < roms.n; i++) {
+		struct imagerom_s *r = &img->roms[img->num_roms];
+		if ((size - roms.v[i].offset) < 0x40) continue;
+		RomView_Init(&r->rom, data + roms.v[i].offset, 0x40);
+		if ((r->rom.order != roms.v[i].order) or !plausible_rom(&r->rom))
+			continue;
+		r->offset = roms.v[i].offset;
+		get_pcode(r->pcode, r->rom.header);
+		img->num_roms++;
+	}
+	for (size_t i = 0; i < img->num_roms; i++) {
+		struct imagerom_s *r = &img->roms[i];
+		uint64_t end = (i + 1 < img->num_roms)? img->roms[i+1].offset: size;
+		r->rom.size = end - r->offset;
+	}
+
+	// both lists are sorted, so walk them together
+	size_t ri = 0;
+	for (size_t i = 0; i < frags.n; i++) {
+		uint64_t off = frags.v[i].offset;
+		while ((ri < img->num_roms) and
+		    (off >= img->roms[ri].offset + img->roms[ri].rom.size))
+			ri++;
+		if (ri == img->num_roms) break;
+		struct imagerom_s *r = &img->roms[ri];
+		if (off < r->offset) continue;
+		uint64_t addr = off - r->offset;
+		if ((addr % 16) or (frags.v[i].order != r->rom.order)) continue;
+		if (addr + sizeof(struct fragment_s) > r->rom.size) continue;
+
+		struct fragment_s frag;
+		RomView_Read(&r->rom, &frag, addr, sizeof(frag));
+		if (!isfrag(&frag)) continue;
+		if (!(r->num_frags & (r->num_frags - 1))) {
+			size_t cap = r->num_frags? r->num_frags * 2: 1;
+			struct fraginfo_s *v = realloc(r->frags, cap * sizeof(*v));
+			if (!v) goto out_free;
+			r->frags = v;
+		}
+		get_fraginfo(&r->frags[r->num_frags++], &frag, addr);
+	}
+	for (size_t i = 0; i < img->num_roms; i++)
+		Hash_Frags(&img->roms[i].rom, img->roms[i].frags,
+			img->roms[i].num_frags);
+	rc = 0;
+
+out_free:
+	for (size_t i = 0; i < num_chunks; i++) {
+		free(s.chunks[i].roms.v);
+		free(s.chunks[i].frags.v);
+	}
+	free(s.chunks);
+	free(roms.v);
+	free(frags.v);
+	if (rc) Image_Free(img);
+	return rc;
+}
+
+void Image_Free(struct image_s *img)
+{
+	for (size_t i = 0; i < img->num_roms; i++)
+		free(img->roms[i].frags);
+	free(img->roms);
+	img->roms = NULL;
+	img->num_roms = 0;
+}
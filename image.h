@@ -0,0 +1,27 @@
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+#include <inttypes.h>
+#include <stddef.h>
+#include "fragment.h"
+#include "romview.h"
+
+// bytes of image that one worker searches at a time
+#define IMAGE_CHUNK (1048576)
+
+// a rom found inside a bigger image
+struct imagerom_s {
+	uint64_t offset;	// of the rom header within the image
+	struct RomView_s rom;	// runs to the next rom or the end of the image
+	char pcode[6];
+	struct fraginfo_s *frags;	// addr is relative to the rom
+	size_t num_frags;
+};
+
+struct image_s {
+	struct imagerom_s *roms;
+	size_t num_roms;
+};
+
+int Image_Scan(struct image_s *img, uint8_t *data, uint64_t size);
+void Image_Free(struct image_s *img);
+#endif
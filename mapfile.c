@@ -71,6 +71,7 @@ struct MappedFile_s MappedFile_Create(char *filename, size_t size)
 	}
 
 	m.data = (void *) p;
+	m._malloced = false;
 	goto out_ok;
 
 out_error:
@@ -94,11 +95,20 @@ out_ok:
 }
 
 struct MappedFile_s MappedFile_Open(char *filename, bool writable)
+{
+	return MappedFile_OpenFlags(filename, writable? MAPFILE_WRITABLE: 0);
+}
+
+struct MappedFile_s MappedFile_OpenFlags(char *filename, unsigned flags)
 {
 	__label__ out_error, out_ok;
 	LPVOID p;
 	BOOL rc;
 	struct MappedFile_s m;
+	bool writable = flags & MAPFILE_WRITABLE;
+
+	// the access pattern hints have no equivalent here
+	m._malloced = false;
 
 	m._hFile = CreateFile(
 		filename,
@@ -135,7 +145,7 @@ struct MappedFile_s MappedFile_Open(char *filename, bool writable)
 
 	p = MapViewOfFile(
 		m._hMapping,
-		writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_COPY,
+		writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ,
 		0,
 		0,
 		0
@@ -164,6 +174,9 @@ void MappedFile_Close(struct MappedFile_s m)
 
 /* __MINGW32__ */
 #else
+#define _GNU_SOURCE
+#include <errno.h>
+#include <iso646.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -179,12 +192,13 @@ struct MappedFile_s MappedFile_Create(char *filename, size_t size)
 	__label__ out_error, out_ok, out_close;
 	struct MappedFile_s m;
 
+	m._malloced = false;
 	m._fd = open(filename, O_RDWR | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
-	if (!m._fd) goto out_error;
+	if (m._fd < 0) goto out_error;
 	close(m._fd);
 	if (truncate(filename, size) < 0) goto out_error;
 	m._fd = open(filename, O_RDWR);
-	if (!m._fd) goto out_error;
+	if (m._fd < 0) goto out_error;
 
 	m.data = mmap(
 		NULL,
@@ -194,7 +208,7 @@ struct MappedFile_s MappedFile_Create(char *filename, size_t size)
 		m._fd,
 		0
 	);
-	if (m.data == NULL) {
+	if (m.data == MAP_FAILED) {
 		goto out_close;
 	}
 
@@ -212,39 +226,143 @@ out_ok:
 	return m;
 }
 
+/*
+ * Fallback for things that can't be mapped, like pipes and some network
+ * filesystems. Callers want the whole file addressable, so it is read
+ * into memory, MAPFILE_CHUNK at a time: pread for regular files, read
+ * until EOF for everything else. With MAPFILE_SEQUENTIAL the kernel is
+ * told to read ahead and drop pages behind. Something that only needs
+ * one pass over a pipe should use FragStream_Scan instead.
+ */
+static void *_MappedFile_Slurp(int fd, struct stat *sb, uint64_t *size,
+	unsigned flags)
+{
+	__label__ out_error;
+	uint8_t *buf = NULL, *newbuf;
+	size_t cap, len = 0, want;
+	ssize_t got;
+	bool seekable = S_ISREG(sb->st_mode);
+
+	cap = seekable? sb->st_size : MAPFILE_CHUNK;
+	if (cap == 0) cap = 4096;
+	buf = malloc(cap);
+	if (!buf) goto out_error;
+#ifdef POSIX_FADV_SEQUENTIAL
+	if (seekable and (flags & MAPFILE_SEQUENTIAL))
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	for (;;) {
+		if (len == cap) {
+			if (seekable) break;
+			cap *= 2;
+			newbuf = realloc(buf, cap);
+			if (!newbuf) goto out_error;
+			buf = newbuf;
+		}
+		want = cap - len;
+		if (want > MAPFILE_CHUNK) want = MAPFILE_CHUNK;
+		if (seekable)
+			got = pread(fd, buf + len, want, len);
+		else
+			got = read(fd, buf + len, want);
+		if (got < 0) {
+			if (errno == EINTR) continue;
+			goto out_error;
+		}
+		if (got == 0) break;
+#ifdef POSIX_FADV_DONTNEED
+		if (seekable and (flags & MAPFILE_SEQUENTIAL))
+			posix_fadvise(fd, len, got, POSIX_FADV_DONTNEED);
+#endif
+		len += got;
+	}
+
+	*size = len;
+	return buf;
+
+out_error:
+	free(buf);
+	return NULL;
+}
+
 struct MappedFile_s MappedFile_Open(char *filename, bool writable)
+{
+	return MappedFile_OpenFlags(filename, writable? MAPFILE_WRITABLE: 0);
+}
+
+struct MappedFile_s MappedFile_OpenFlags(char *filename, unsigned flags)
 {
 	__label__ out_error, out_ok, out_close;
 	struct MappedFile_s m;
 	struct stat sb;
+	bool writable = flags & MAPFILE_WRITABLE;
+	int mflags;
+
+	m._malloced = false;
 
-	if (stat(filename, &sb) == -1) {
+	if (!strcmp(filename, "-")) {
+		if (writable) goto out_error;
+		m._fd = STDIN_FILENO;
+	} else {
+		m._fd = open(filename, writable ? O_RDWR : O_RDONLY);
+	}
+	if (m._fd < 0) {
 		goto out_error;
 	}
+
+	if (fstat(m._fd, &sb) == -1) {
+		goto out_close;
+	}
 	m.size = sb.st_size;
 
-	m._fd = open(filename, writable ? O_RDWR : O_RDONLY);
-	if (!m._fd) {
-		goto out_error;
+	if (!S_ISREG(sb.st_mode) or (sb.st_size == 0)) {
+		m.data = MAP_FAILED;
+	} else {
+		/*
+		 * Read-only mappings are PROT_READ so they aren't charged
+		 * copy-on-write commit for the whole file.
+		 */
+		mflags = writable ? MAP_SHARED : MAP_PRIVATE;
+#ifdef MAP_POPULATE
+		if ((flags & MAPFILE_POPULATE) and
+		    (sb.st_size <= MAPFILE_POPULATE_MAX))
+			mflags |= MAP_POPULATE;
+#endif
+		m.data = mmap(
+			NULL,
+			sb.st_size,
+			writable ? (PROT_READ|PROT_WRITE) : PROT_READ,
+			mflags,
+			m._fd,
+			0
+		);
 	}
 
-	m.data = mmap(
-		NULL,
-		sb.st_size,
-		PROT_READ|PROT_WRITE,
-		writable ? MAP_SHARED : MAP_PRIVATE,
-		m._fd,
-		0
-	);
-	if (m.data == NULL) {
-		goto out_close;
+	if (m.data == MAP_FAILED) {
+		if (writable) goto out_close;
+		m.data = _MappedFile_Slurp(m._fd, &sb, &m.size, flags);
+		if (m.data == NULL) goto out_close;
+		m._malloced = true;
+		goto out_ok;
 	}
 
+	// hints are best-effort, so errors are ignored
+	if (flags & MAPFILE_SEQUENTIAL)
+		posix_madvise(m.data, m.size, POSIX_MADV_SEQUENTIAL);
+	if (flags & MAPFILE_WILLNEED)
+		posix_madvise(m.data, m.size, POSIX_MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+	if (flags & MAPFILE_HUGEPAGE)
+		madvise(m.data, m.size, MADV_HUGEPAGE);
+#endif
+
 	goto out_ok;
 
 out_close:
-	close(m._fd);
+	if (m._fd != STDIN_FILENO) close(m._fd);
 out_error:
+	m.size = 0;
 	m.data = NULL;
 out_ok:
 	return m;
@@ -252,8 +370,11 @@ out_ok:
 
 void MappedFile_Close(struct MappedFile_s m)
 {
-	munmap(m.data, m.size);
-	close(m._fd);
+	if (m._malloced)
+		free(m.data);
+	else
+		munmap(m.data, m.size);
+	if (m._fd != STDIN_FILENO) close(m._fd);
 }
 
 /* __MINGW32__ */
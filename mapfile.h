@@ -4,11 +4,32 @@
 #ifdef __MINGW32__
 #include <windows.h>
 #endif
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+/* flags for MappedFile_OpenFlags */
+enum {
+	MAPFILE_WRITABLE	= 1 << 0,	// shared read/write mapping
+	MAPFILE_SEQUENTIAL	= 1 << 1,	// MADV_SEQUENTIAL, or FADV_ when read in
+	MAPFILE_WILLNEED	= 1 << 2,	// MADV_WILLNEED
+	MAPFILE_POPULATE	= 1 << 3,	// MAP_POPULATE, small files only
+	MAPFILE_HUGEPAGE	= 1 << 4,	// MADV_HUGEPAGE, if the fs allows it
+};
+
+// hints used by commands that walk the whole rom
+#define MAPFILE_SCAN (MAPFILE_WILLNEED | MAPFILE_POPULATE | MAPFILE_HUGEPAGE)
+
+// MAPFILE_POPULATE is ignored for files bigger than this
+#define MAPFILE_POPULATE_MAX (64 * 1048576)
+
+// bytes per read when a file can't be mapped and is read in instead
+#define MAPFILE_CHUNK (1048576)
 
 struct MappedFile_s {
 	void *data;
 	uint64_t size;
+	bool _malloced;	// data was read into memory instead of mapped
 #ifdef __MINGW32__
 	HANDLE _hFile;
 	HANDLE _hMapping;
@@ -19,6 +40,7 @@ struct MappedFile_s {
 
 struct MappedFile_s MappedFile_Create(char *filename, size_t size);
 struct MappedFile_s MappedFile_Open(char *filename, bool writable);
+struct MappedFile_s MappedFile_OpenFlags(char *filename, unsigned flags);
 void MappedFile_Close(struct MappedFile_s m);
 
 /* _MAPFILE_H_ */
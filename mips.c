@@ -0,0 +1,640 @@
+#include <ctype.h>
+#include <iso646.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mips.h"
+
+// aliases come before the instructions they are special cases of
+const struct mips_op_s Mips_Ops[] = {
+	{ "nop",       0x00000000, 0xffffffff, ""       },
+	{ "b",         0x10000000, 0xffff0000, "b"      },
+	{ "beqz",      0x10000000, 0xfc1f0000, "s,b"    },
+	{ "bnez",      0x14000000, 0xfc1f0000, "s,b"    },
+	{ "bal",       0x04110000, 0xffff0000, "b"      },
+	{ "sll",       0x00000000, 0xffe0003f, "d,t,h"  },
+	{ "srl",       0x00000002, 0xffe0003f, "d,t,h"  },
+	{ "sra",       0x00000003, 0xffe0003f, "d,t,h"  },
+	{ "sllv",      0x00000004, 0xfc0007ff, "d,t,s"  },
+	{ "srlv",      0x00000006, 0xfc0007ff, "d,t,s"  },
+	{ "srav",      0x00000007, 0xfc0007ff, "d,t,s"  },
+	{ "jr",        0x00000008, 0xfc1fffff, "s"      },
+	{ "jalr",      0x0000f809, 0xfc1fffff, "s"      },
+	{ "jalr",      0x00000009, 0xfc1f07ff, "d,s"    },
+	{ "syscall",   0x0000000c, 0xfc00003f, "Y"      },
+	{ "break",     0x0000000d, 0xfc00003f, "B"      },
+	{ "sync",      0x0000000f, 0xffffffff, ""       },
+	{ "mfhi",      0x00000010, 0xffff07ff, "d"      },
+	{ "mthi",      0x00000011, 0xfc1fffff, "s"      },
+	{ "mflo",      0x00000012, 0xffff07ff, "d"      },
+	{ "mtlo",      0x00000013, 0xfc1fffff, "s"      },
+	{ "dsllv",     0x00000014, 0xfc0007ff, "d,t,s"  },
+	{ "dsrlv",     0x00000016, 0xfc0007ff, "d,t,s"  },
+	{ "dsrav",     0x00000017, 0xfc0007ff, "d,t,s"  },
+	{ "mult",      0x00000018, 0xfc00ffff, "s,t"    },
+	{ "multu",     0x00000019, 0xfc00ffff, "s,t"    },
+	{ "dmult",     0x0000001c, 0xfc00ffff, "s,t"    },
+	{ "dmultu",    0x0000001d, 0xfc00ffff, "s,t"    },
+	{ "div",       0x0000001a, 0xfc00ffff, "z,s,t"  },
+	{ "divu",      0x0000001b, 0xfc00ffff, "z,s,t"  },
+	{ "ddiv",      0x0000001e, 0xfc00ffff, "z,s,t"  },
+	{ "ddivu",     0x0000001f, 0xfc00ffff, "z,s,t"  },
+	{ "add",       0x00000020, 0xfc0007ff, "d,s,t"  },
+	{ "addu",      0x00000021, 0xfc0007ff, "d,s,t"  },
+	{ "sub",       0x00000022, 0xfc0007ff, "d,s,t"  },
+	{ "subu",      0x00000023, 0xfc0007ff, "d,s,t"  },
+	{ "and",       0x00000024, 0xfc0007ff, "d,s,t"  },
+	{ "or",        0x00000025, 0xfc0007ff, "d,s,t"  },
+	{ "xor",       0x00000026, 0xfc0007ff, "d,s,t"  },
+	{ "nor",       0x00000027, 0xfc0007ff, "d,s,t"  },
+	{ "slt",       0x0000002a, 0xfc0007ff, "d,s,t"  },
+	{ "sltu",      0x0000002b, 0xfc0007ff, "d,s,t"  },
+	{ "dadd",      0x0000002c, 0xfc0007ff, "d,s,t"  },
+	{ "daddu",     0x0000002d, 0xfc0007ff, "d,s,t"  },
+	{ "dsub",      0x0000002e, 0xfc0007ff, "d,s,t"  },
+	{ "dsubu",     0x0000002f, 0xfc0007ff, "d,s,t"  },
+	{ "tge",       0x00000030, 0xfc00ffff, "s,t"    },
+	{ "tgeu",      0x00000031, 0xfc00ffff, "s,t"    },
+	{ "tlt",       0x00000032, 0xfc00ffff, "s,t"    },
+	{ "tltu",      0x00000033, 0xfc00ffff, "s,t"    },
+	{ "teq",       0x00000034, 0xfc00ffff, "s,t"    },
+	{ "tne",       0x00000036, 0xfc00ffff, "s,t"    },
+	{ "dsll",      0x00000038, 0xffe0003f, "d,t,h"  },
+	{ "dsrl",      0x0000003a, 0xffe0003f, "d,t,h"  },
+	{ "dsra",      0x0000003b, 0xffe0003f, "d,t,h"  },
+	{ "dsll32",    0x0000003c, 0xffe0003f, "d,t,h"  },
+	{ "dsrl32",    0x0000003e, 0xffe0003f, "d,t,h"  },
+	{ "dsra32",    0x0000003f, 0xffe0003f, "d,t,h"  },
+	{ "bltz",      0x04000000, 0xfc1f0000, "s,b"    },
+	{ "bgez",      0x04010000, 0xfc1f0000, "s,b"    },
+	{ "bltzl",     0x04020000, 0xfc1f0000, "s,b"    },
+	{ "bgezl",     0x04030000, 0xfc1f0000, "s,b"    },
+	{ "tgei",      0x04080000, 0xfc1f0000, "s,i"    },
+	{ "tgeiu",     0x04090000, 0xfc1f0000, "s,i"    },
+	{ "tlti",      0x040a0000, 0xfc1f0000, "s,i"    },
+	{ "tltiu",     0x040b0000, 0xfc1f0000, "s,i"    },
+	{ "teqi",      0x040c0000, 0xfc1f0000, "s,i"    },
+	{ "tnei",      0x040e0000, 0xfc1f0000, "s,i"    },
+	{ "bltzal",    0x04100000, 0xfc1f0000, "s,b"    },
+	{ "bgezal",    0x04110000, 0xfc1f0000, "s,b"    },
+	{ "bltzall",   0x04120000, 0xfc1f0000, "s,b"    },
+	{ "bgezall",   0x04130000, 0xfc1f0000, "s,b"    },
+	{ "j",         0x08000000, 0xfc000000, "j"      },
+	{ "jal",       0x0c000000, 0xfc000000, "j"      },
+	{ "beq",       0x10000000, 0xfc000000, "s,t,b"  },
+	{ "bne",       0x14000000, 0xfc000000, "s,t,b"  },
+	{ "blez",      0x18000000, 0xfc1f0000, "s,b"    },
+	{ "bgtz",      0x1c000000, 0xfc1f0000, "s,b"    },
+	{ "addi",      0x20000000, 0xfc000000, "t,s,i"  },
+	{ "addiu",     0x24000000, 0xfc000000, "t,s,i"  },
+	{ "slti",      0x28000000, 0xfc000000, "t,s,i"  },
+	{ "sltiu",     0x2c000000, 0xfc000000, "t,s,i"  },
+	{ "andi",      0x30000000, 0xfc000000, "t,s,u"  },
+	{ "ori",       0x34000000, 0xfc000000, "t,s,u"  },
+	{ "xori",      0x38000000, 0xfc000000, "t,s,u"  },
+	{ "lui",       0x3c000000, 0xffe00000, "t,u"    },
+	{ "mfc0",      0x40000000, 0xffe007ff, "t,c"    },
+	{ "dmfc0",     0x40200000, 0xffe007ff, "t,c"    },
+	{ "mtc0",      0x40800000, 0xffe007ff, "t,c"    },
+	{ "dmtc0",     0x40a00000, 0xffe007ff, "t,c"    },
+	{ "tlbr",      0x42000001, 0xffffffff, ""       },
+	{ "tlbwi",     0x42000002, 0xffffffff, ""       },
+	{ "tlbwr",     0x42000006, 0xffffffff, ""       },
+	{ "tlbp",      0x42000008, 0xffffffff, ""       },
+	{ "eret",      0x42000018, 0xffffffff, ""       },
+	{ "mfc1",      0x44000000, 0xffe007ff, "t,S"    },
+	{ "dmfc1",     0x44200000, 0xffe007ff, "t,S"    },
+	{ "cfc1",      0x44400000, 0xffe007ff, "t,c"    },
+	{ "mtc1",      0x44800000, 0xffe007ff, "t,S"    },
+	{ "dmtc1",     0x44a00000, 0xffe007ff, "t,S"    },
+	{ "ctc1",      0x44c00000, 0xffe007ff, "t,c"    },
+	{ "bc1f",      0x45000000, 0xffff0000, "b"      },
+	{ "bc1t",      0x45010000, 0xffff0000, "b"      },
+	{ "bc1fl",     0x45020000, 0xffff0000, "b"      },
+	{ "bc1tl",     0x45030000, 0xffff0000, "b"      },
+	{ "add.s",     0x46000000, 0xffe0003f, "D,S,T"  },
+	{ "sub.s",     0x46000001, 0xffe0003f, "D,S,T"  },
+	{ "mul.s",     0x46000002, 0xffe0003f, "D,S,T"  },
+	{ "div.s",     0x46000003, 0xffe0003f, "D,S,T"  },
+	{ "sqrt.s",    0x46000004, 0xffff003f, "D,S"    },
+	{ "abs.s",     0x46000005, 0xffff003f, "D,S"    },
+	{ "mov.s",     0x46000006, 0xffff003f, "D,S"    },
+	{ "neg.s",     0x46000007, 0xffff003f, "D,S"    },
+	{ "round.l.s", 0x46000008, 0xffff003f, "D,S"    },
+	{ "trunc.l.s", 0x46000009, 0xffff003f, "D,S"    },
+	{ "ceil.l.s",  0x4600000a, 0xffff003f, "D,S"    },
+	{ "floor.l.s", 0x4600000b, 0xffff003f, "D,S"    },
+	{ "round.w.s", 0x4600000c, 0xffff003f, "D,S"    },
+	{ "trunc.w.s", 0x4600000d, 0xffff003f, "D,S"    },
+	{ "ceil.w.s",  0x4600000e, 0xffff003f, "D,S"    },
+	{ "floor.w.s", 0x4600000f, 0xffff003f, "D,S"    },
+	{ "add.d",     0x46200000, 0xffe0003f, "D,S,T"  },
+	{ "sub.d",     0x46200001, 0xffe0003f, "D,S,T"  },
+	{ "mul.d",     0x46200002, 0xffe0003f, "D,S,T"  },
+	{ "div.d",     0x46200003, 0xffe0003f, "D,S,T"  },
+	{ "sqrt.d",    0x46200004, 0xffff003f, "D,S"    },
+	{ "abs.d",     0x46200005, 0xffff003f, "D,S"    },
+	{ "mov.d",     0x46200006, 0xffff003f, "D,S"    },
+	{ "neg.d",     0x46200007, 0xffff003f, "D,S"    },
+	{ "round.l.d", 0x46200008, 0xffff003f, "D,S"    },
+	{ "trunc.l.d", 0x46200009, 0xffff003f, "D,S"    },
+	{ "ceil.l.d",  0x4620000a, 0xffff003f, "D,S"    },
+	{ "floor.l.d", 0x4620000b, 0xffff003f, "D,S"    },
+	{ "round.w.d", 0x4620000c, 0xffff003f, "D,S"    },
+	{ "trunc.w.d", 0x4620000d, 0xffff003f, "D,S"    },
+	{ "ceil.w.d",  0x4620000e, 0xffff003f, "D,S"    },
+	{ "floor.w.d", 0x4620000f, 0xffff003f, "D,S"    },
+	{ "cvt.s.d",   0x46200020, 0xffff003f, "D,S"    },
+	{ "cvt.s.w",   0x46800020, 0xffff003f, "D,S"    },
+	{ "cvt.s.l",   0x46a00020, 0xffff003f, "D,S"    },
+	{ "cvt.d.s",   0x46000021, 0xffff003f, "D,S"    },
+	{ "cvt.d.w",   0x46800021, 0xffff003f, "D,S"    },
+	{ "cvt.d.l",   0x46a00021, 0xffff003f, "D,S"    },
+	{ "cvt.w.s",   0x46000024, 0xffff003f, "D,S"    },
+	{ "cvt.w.d",   0x46200024, 0xffff003f, "D,S"    },
+	{ "cvt.l.s",   0x46000025, 0xffff003f, "D,S"    },
+	{ "cvt.l.d",   0x46200025, 0xffff003f, "D,S"    },
+	{ "c.f.s",     0x46000030, 0xffe007ff, "S,T"    },
+	{ "c.un.s",    0x46000031, 0xffe007ff, "S,T"    },
+	{ "c.eq.s",    0x46000032, 0xffe007ff, "S,T"    },
+	{ "c.ueq.s",   0x46000033, 0xffe007ff, "S,T"    },
+	{ "c.olt.s",   0x46000034, 0xffe007ff, "S,T"    },
+	{ "c.ult.s",   0x46000035, 0xffe007ff, "S,T"    },
+	{ "c.ole.s",   0x46000036, 0xffe007ff, "S,T"    },
+	{ "c.ule.s",   0x46000037, 0xffe007ff, "S,T"    },
+	{ "c.sf.s",    0x46000038, 0xffe007ff, "S,T"    },
+	{ "c.ngle.s",  0x46000039, 0xffe007ff, "S,T"    },
+	{ "c.seq.s",   0x4600003a, 0xffe007ff, "S,T"    },
+	{ "c.ngl.s",   0x4600003b, 0xffe007ff, "S,T"    },
+	{ "c.lt.s",    0x4600003c, 0xffe007ff, "S,T"    },
+	{ "c.nge.s",   0x4600003d, 0xffe007ff, "S,T"    },
+	{ "c.le.s",    0x4600003e, 0xffe007ff, "S,T"    },
+	{ "c.ngt.s",   0x4600003f, 0xffe007ff, "S,T"    },
+	{ "c.f.d",     0x46200030, 0xffe007ff, "S,T"    },
+	{ "c.un.d",    0x46200031, 0xffe007ff, "S,T"    },
+	{ "c.eq.d",    0x46200032, 0xffe007ff, "S,T"    },
+	{ "c.ueq.d",   0x46200033, 0xffe007ff, "S,T"    },
+	{ "c.olt.d",   0x46200034, 0xffe007ff, "S,T"    },
+	{ "c.ult.d",   0x46200035, 0xffe007ff, "S,T"    },
+	{ "c.ole.d",   0x46200036, 0xffe007ff, "S,T"    },
+	{ "c.ule.d",   0x46200037, 0xffe007ff, "S,T"    },
+	{ "c.sf.d",    0x46200038, 0xffe007ff, "S,T"    },
+	{ "c.ngle.d",  0x46200039, 0xffe007ff, "S,T"    },
+	{ "c.seq.d",   0x4620003a, 0xffe007ff, "S,T"    },
+	{ "c.ngl.d",   0x4620003b, 0xffe007ff, "S,T"    },
+	{ "c.lt.d",    0x4620003c, 0xffe007ff, "S,T"    },
+	{ "c.nge.d",   0x4620003d, 0xffe007ff, "S,T"    },
+	{ "c.le.d",    0x4620003e, 0xffe007ff, "S,T"    },
+	{ "c.ngt.d",   0x4620003f, 0xffe007ff, "S,T"    },
+	{ "beql",      0x50000000, 0xfc000000, "s,t,b"  },
+	{ "bnel",      0x54000000, 0xfc000000, "s,t,b"  },
+	{ "blezl",     0x58000000, 0xfc1f0000, "s,b"    },
+	{ "bgtzl",     0x5c000000, 0xfc1f0000, "s,b"    },
+	{ "daddi",     0x60000000, 0xfc000000, "t,s,i"  },
+	{ "daddiu",    0x64000000, 0xfc000000, "t,s,i"  },
+	{ "ldl",       0x68000000, 0xfc000000, "t,o"    },
+	{ "ldr",       0x6c000000, 0xfc000000, "t,o"    },
+	{ "lb",        0x80000000, 0xfc000000, "t,o"    },
+	{ "lh",        0x84000000, 0xfc000000, "t,o"    },
+	{ "lwl",       0x88000000, 0xfc000000, "t,o"    },
+	{ "lw",        0x8c000000, 0xfc000000, "t,o"    },
+	{ "lbu",       0x90000000, 0xfc000000, "t,o"    },
+	{ "lhu",       0x94000000, 0xfc000000, "t,o"    },
+	{ "lwr",       0x98000000, 0xfc000000, "t,o"    },
+	{ "lwu",       0x9c000000, 0xfc000000, "t,o"    },
+	{ "sb",        0xa0000000, 0xfc000000, "t,o"    },
+	{ "sh",        0xa4000000, 0xfc000000, "t,o"    },
+	{ "swl",       0xa8000000, 0xfc000000, "t,o"    },
+	{ "sw",        0xac000000, 0xfc000000, "t,o"    },
+	{ "sdl",       0xb0000000, 0xfc000000, "t,o"    },
+	{ "sdr",       0xb4000000, 0xfc000000, "t,o"    },
+	{ "swr",       0xb8000000, 0xfc000000, "t,o"    },
+	{ "ll",        0xc0000000, 0xfc000000, "t,o"    },
+	{ "lld",       0xd0000000, 0xfc000000, "t,o"    },
+	{ "ld",        0xdc000000, 0xfc000000, "t,o"    },
+	{ "sc",        0xe0000000, 0xfc000000, "t,o"    },
+	{ "scd",       0xf0000000, 0xfc000000, "t,o"    },
+	{ "sd",        0xfc000000, 0xfc000000, "t,o"    },
+	{ "cache",     0xbc000000, 0xfc000000, "x,o"    },
+	{ "lwc1",      0xc4000000, 0xfc000000, "T,o"    },
+	{ "ldc1",      0xd4000000, 0xfc000000, "T,o"    },
+	{ "swc1",      0xe4000000, 0xfc000000, "T,o"    },
+	{ "sdc1",      0xf4000000, 0xfc000000, "T,o"    },
+};
+const unsigned Mips_NumOps = sizeof(Mips_Ops) / sizeof(Mips_Ops[0]);
+
+const char *Mips_GprNames[32] = {
+	"$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+	"$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+	"$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+	"$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra",
+};
+
+// Mips_Ops indices bucketed by primary opcode, in table order
+static uint16_t bucket_start[65];
+static uint16_t bucket[sizeof(Mips_Ops) / sizeof(Mips_Ops[0])];
+static pthread_once_t bucket_once = PTHREAD_ONCE_INIT;
+
+// Mips_Ops indices sorted by name, for the assembler
+static uint16_t by_name[sizeof(Mips_Ops) / sizeof(Mips_Ops[0])];
+
+static int cmp_name(const void *a, const void *b)
+{
+	const uint16_t *x = a, *y = b;
+	int rc = strcmp(Mips_Ops[*x].name, Mips_Ops[*y].name);
+	// keep table order between forms of the same name
+	return rc? rc: (int)*x - (int)*y;
+}
+
+static void build_buckets(void)
+{
+	unsigned count[64] = {0};
+	unsigned fill[64];
+
+	for (unsigned i = 0; i < Mips_NumOps; i++)
+		count[Mips_Ops[i].match >> 26]++;
+	bucket_start[0] = 0;
+	for (unsigned op = 0; op < 64; op++) {
+		bucket_start[op + 1] = bucket_start[op] + count[op];
+		fill[op] = bucket_start[op];
+	}
+	for (unsigned i = 0; i < Mips_NumOps; i++)
+		bucket[fill[Mips_Ops[i].match >> 26]++] = i;
+
+	for (unsigned i = 0; i < Mips_NumOps; i++)
+		by_name[i] = i;
+	qsort(by_name, Mips_NumOps, sizeof(by_name[0]), cmp_name);
+}
+
+// find the form of an instruction, or NULL if it isn't one we know
+const struct mips_op_s *Mips_Decode(uint32_t insn)
+{
+	unsigned op = insn >> 26;
+
+	pthread_once(&bucket_once, build_buckets);
+	for (unsigned i = bucket_start[op]; i < bucket_start[op + 1]; i++) {
+		const struct mips_op_s *o = &Mips_Ops[bucket[i]];
+		if ((insn & o->mask) == o->match) return o;
+	}
+	return NULL;
+}
+
+/*
+ * Where a branch or jump at pc goes. Returns false for anything else,
+ * including jr and jalr.
+ */
+bool Mips_Target(uint32_t insn, uint32_t pc, uint32_t *target, bool *is_jump)
+{
+	const struct mips_op_s *o = Mips_Decode(insn);
+	if (!o) return false;
+
+	for (const char *f = o->fmt; *f; f++) {
+		switch (*f) {
+		case 'b':
+			*target = pc + 4 + ((int32_t)(int16_t)insn << 2);
+			*is_jump = false;
+			return true;
+		case 'j':
+			*target = ((pc + 4) & 0xF0000000) | ((insn & 0x03FFFFFF) << 2);
+			*is_jump = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void put_fpr(struct outbuf_s *ob, unsigned r)
+{
+	OutBuf_Puts(ob, "$f");
+	OutBuf_Dec(ob, r);
+}
+
+static void put_hex(struct outbuf_s *ob, uint32_t v)
+{
+	OutBuf_Puts(ob, "0x");
+	OutBuf_Hex(ob, v, 1);
+}
+
+/*
+ * Write one instruction, without a newline. If sym isn't NULL it is
+ * written in place of the immediate, offset or target.
+ */
+void Mips_Disasm(struct outbuf_s *ob, uint32_t insn, uint32_t pc, const char *sym)
+{
+	const struct mips_op_s *o = Mips_Decode(insn);
+	unsigned rs = (insn >> 21) & 31;
+	unsigned rt = (insn >> 16) & 31;
+	unsigned rd = (insn >> 11) & 31;
+	unsigned sa = (insn >> 6) & 31;
+	int16_t imm = insn & 0xFFFF;
+	size_t start;
+
+	if (!o) {
+		OutBuf_Puts(ob, ".word     ");
+		put_hex(ob, insn);
+		return;
+	}
+
+	start = ob->len;
+	OutBuf_Puts(ob, o->name);
+	if (!*o->fmt) return;
+	do OutBuf_Putc(ob, ' '); while (ob->len < start + 10);
+
+	for (const char *f = o->fmt; *f; f++) {
+		switch (*f) {
+		case ',':
+			OutBuf_Puts(ob, ", ");
+			break;
+		case 's':
+			OutBuf_Puts(ob, Mips_GprNames[rs]);
+			break;
+		case 't':
+			OutBuf_Puts(ob, Mips_GprNames[rt]);
+			break;
+		case 'd':
+			OutBuf_Puts(ob, Mips_GprNames[rd]);
+			break;
+		case 'z':
+			OutBuf_Puts(ob, Mips_GprNames[0]);
+			break;
+		case 'S':
+			put_fpr(ob, rd);
+			break;
+		case 'T':
+			put_fpr(ob, rt);
+			break;
+		case 'D':
+			put_fpr(ob, sa);
+			break;
+		case 'c':
+			OutBuf_Putc(ob, '$');
+			OutBuf_Dec(ob, rd);
+			break;
+		case 'h':
+			OutBuf_Dec(ob, sa);
+			break;
+		case 'x':
+			put_hex(ob, rt);
+			break;
+		case 'i':
+			if (sym) OutBuf_Puts(ob, sym);
+			else OutBuf_Dec(ob, imm);
+			break;
+		case 'u':
+			if (sym) OutBuf_Puts(ob, sym);
+			else put_hex(ob, (uint16_t)imm);
+			break;
+		case 'o':
+			if (sym) OutBuf_Puts(ob, sym);
+			else OutBuf_Dec(ob, imm);
+			OutBuf_Putc(ob, '(');
+			OutBuf_Puts(ob, Mips_GprNames[rs]);
+			OutBuf_Putc(ob, ')');
+			break;
+		case 'b':
+		case 'j': {
+			uint32_t target;
+			bool is_jump;
+			if (sym) {
+				OutBuf_Puts(ob, sym);
+				break;
+			}
+			Mips_Target(insn, pc, &target, &is_jump);
+			put_hex(ob, target);
+			break;
+		}
+		case 'Y':
+			put_hex(ob, (insn >> 6) & 0xFFFFF);
+			break;
+		case 'B':
+			OutBuf_Dec(ob, (insn >> 16) & 0x3FF);
+			OutBuf_Puts(ob, ", ");
+			OutBuf_Dec(ob, (insn >> 6) & 0x3FF);
+			break;
+		}
+	}
+}
+
+static const char *skip_space(const char *p)
+{
+	while ((*p == ' ') or (*p == '\t')) p++;
+	return p;
+}
+
+static bool parse_num(const char **pp, int64_t *v)
+{
+	char *end;
+	*v = strtoll(*pp, &end, 0);
+	if (end == *pp) return false;
+	*pp = end;
+	return true;
+}
+
+static bool parse_gpr(const char **pp, unsigned *r)
+{
+	const char *p = *pp;
+	int64_t n;
+
+	if (*p != '$') return false;
+	if (isdigit((unsigned char)p[1])) {
+		p++;
+		if (!parse_num(&p, &n) or (n < 0) or (n > 31)) return false;
+		*r = n;
+		*pp = p;
+		return true;
+	}
+	for (unsigned i = 0; i < 32; i++) {
+		size_t len = strlen(Mips_GprNames[i]);
+		if (strncmp(p, Mips_GprNames[i], len) or isalnum((unsigned char)p[len]))
+			continue;
+		*r = i;
+		*pp = p + len;
+		return true;
+	}
+	return false;
+}
+
+static bool parse_reg(const char **pp, const char *prefix, unsigned *r)
+{
+	const char *p = *pp;
+	size_t len = strlen(prefix);
+	int64_t n;
+
+	if (strncmp(p, prefix, len)) return false;
+	p += len;
+	if (!isdigit((unsigned char)*p)) return false;
+	if (!parse_num(&p, &n) or (n < 0) or (n > 31)) return false;
+	*r = n;
+	*pp = p;
+	return true;
+}
+
+static bool parse_sym(const char **pp, char sym[64])
+{
+	const char *p = *pp;
+	size_t n = 0;
+
+	if (!isalpha((unsigned char)*p) and (*p != '_') and (*p != '.'))
+		return false;
+	while (isalnum((unsigned char)p[n]) or (p[n] == '_') or (p[n] == '.')) {
+		if (n == 63) return false;
+		sym[n] = p[n];
+		n++;
+	}
+	sym[n] = '\0';
+	*pp = p + n;
+	return true;
+}
+
+// an immediate, or %hi(sym) or %lo(sym)
+static bool parse_imm(const char **pp, struct mips_asm_s *out, int64_t *v)
+{
+	const char *p = *pp;
+
+	*v = 0;
+	if (!strncmp(p, "%hi(", 4) or !strncmp(p, "%lo(", 4)) {
+		out->kind = p[1];
+		p += 4;
+		if (!parse_sym(&p, out->sym) or (*p != ')')) return false;
+		*pp = p + 1;
+		return true;
+	}
+	if (!parse_num(&p, v) or (*v < -32768) or (*v > 65535)) return false;
+	*pp = p;
+	return true;
+}
+
+// try one form against the operands
+static bool assemble_op(const struct mips_op_s *o, const char *p,
+	uint32_t pc, struct mips_asm_s *out)
+{
+	uint32_t insn = o->match;
+	unsigned r;
+	int64_t v;
+
+	out->kind = 0;
+	out->sym[0] = '\0';
+	for (const char *f = o->fmt; *f; f++) {
+		p = skip_space(p);
+		switch (*f) {
+		case ',':
+			if (*p++ != ',') return false;
+			break;
+		case 's':
+			if (!parse_gpr(&p, &r)) return false;
+			insn |= r << 21;
+			break;
+		case 't':
+			if (!parse_gpr(&p, &r)) return false;
+			insn |= r << 16;
+			break;
+		case 'd':
+			if (!parse_gpr(&p, &r)) return false;
+			insn |= r << 11;
+			break;
+		case 'z':
+			if (!parse_gpr(&p, &r) or r) return false;
+			break;
+		case 'S':
+			if (!parse_reg(&p, "$f", &r)) return false;
+			insn |= r << 11;
+			break;
+		case 'T':
+			if (!parse_reg(&p, "$f", &r)) return false;
+			insn |= r << 16;
+			break;
+		case 'D':
+			if (!parse_reg(&p, "$f", &r)) return false;
+			insn |= r << 6;
+			break;
+		case 'c':
+			if (!parse_reg(&p, "$", &r)) return false;
+			insn |= r << 11;
+			break;
+		case 'h':
+			if (!parse_num(&p, &v) or (v < 0) or (v > 31)) return false;
+			insn |= v << 6;
+			break;
+		case 'x':
+			if (!parse_num(&p, &v) or (v < 0) or (v > 31)) return false;
+			insn |= v << 16;
+			break;
+		case 'i':
+		case 'u':
+			if (!parse_imm(&p, out, &v)) return false;
+			insn |= v & 0xFFFF;
+			break;
+		case 'o':
+			if (*p == '(') v = 0;
+			else if (!parse_imm(&p, out, &v)) return false;
+			insn |= v & 0xFFFF;
+			if (*p++ != '(') return false;
+			if (!parse_gpr(&p, &r)) return false;
+			if (*p++ != ')') return false;
+			insn |= r << 21;
+			break;
+		case 'b':
+		case 'j':
+			if (parse_sym(&p, out->sym)) {
+				out->kind = *f;
+				break;
+			}
+			if (!parse_num(&p, &v)) return false;
+			if (*f == 'j')
+				insn |= ((uint32_t)v >> 2) & 0x03FFFFFF;
+			else
+				insn |= (((uint32_t)v - pc - 4) >> 2) & 0xFFFF;
+			break;
+		case 'Y':
+			if (!parse_num(&p, &v) or (v < 0) or (v > 0xFFFFF)) return false;
+			insn |= v << 6;
+			break;
+		case 'B':
+			if (!parse_num(&p, &v) or (v < 0) or (v > 0x3FF)) return false;
+			insn |= v << 16;
+			p = skip_space(p);
+			if (*p++ != ',') return false;
+			p = skip_space(p);
+			if (!parse_num(&p, &v) or (v < 0) or (v > 0x3FF)) return false;
+			insn |= v << 6;
+			break;
+		}
+	}
+	p = skip_space(p);
+	if (*p and (*p != '#')) return false;
+	// an operand spilled into a field the form fixes
+	if ((insn & o->mask) != o->match) return false;
+	out->insn = insn;
+	return true;
+}
+
+/*
+ * Assemble one instruction as written by Mips_Disasm, with the mnemonic
+ * first and nothing after the operands but an optional # comment.
+ * Returns 0, or -1 if it isn't something we can encode.
+ */
+int Mips_Assemble(struct mips_asm_s *out, const char *line, uint32_t pc)
+{
+	char name[16];
+	size_t n = 0;
+	unsigned lo = 0, hi;
+	const char *p = skip_space(line);
+
+	pthread_once(&bucket_once, build_buckets);
+	while (*p and !isspace((unsigned char)*p)) {
+		if (n == sizeof(name) - 1) return -1;
+		name[n++] = *p++;
+	}
+	name[n] = '\0';
+
+	// find the first form of that name, then try each in table order
+	hi = Mips_NumOps;
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (strcmp(Mips_Ops[by_name[mid]].name, name) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	for (; (lo < Mips_NumOps) and !strcmp(Mips_Ops[by_name[lo]].name, name); lo++)
+		if (assemble_op(&Mips_Ops[by_name[lo]], p, pc, out)) return 0;
+	return -1;
+}
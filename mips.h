@@ -0,0 +1,48 @@
+#ifndef _MIPS_H_
+#define _MIPS_H_
+#include <inttypes.h>
+#include <stdbool.h>
+#include "outbuf.h"
+
+/*
+ * One R4300 instruction form. An instruction matches if
+ * (insn & mask) == match. The operands are listed in fmt:
+ *	s t d	gpr in the rs, rt, rd field
+ *	S T D	fpr in the fs, ft, fd field
+ *	c	cop0/cop1 control register in the rd field
+ *	z	a literal $zero, for the three operand divides
+ *	h	shift amount
+ *	i u	signed or unsigned 16 bit immediate
+ *	o	signed 16 bit offset and base register, "i(s)"
+ *	b	branch target
+ *	j	jump target
+ *	x	cache op in the rt field
+ *	Y B	syscall and break codes
+ */
+struct mips_op_s {
+	const char *name;
+	uint32_t match;
+	uint32_t mask;
+	const char *fmt;
+};
+
+/*
+ * An assembled instruction. A symbolic operand is left as zero in insn
+ * for the caller to resolve.
+ */
+struct mips_asm_s {
+	uint32_t insn;
+	char kind;		// 'h' %hi, 'l' %lo, 'j' jump, 'b' branch, 0 if none
+	char sym[64];
+};
+
+extern const struct mips_op_s Mips_Ops[];
+extern const unsigned Mips_NumOps;
+
+const struct mips_op_s *Mips_Decode(uint32_t insn);
+bool Mips_Target(uint32_t insn, uint32_t pc, uint32_t *target, bool *is_jump);
+void Mips_Disasm(struct outbuf_s *ob, uint32_t insn, uint32_t pc, const char *sym);
+int Mips_Assemble(struct mips_asm_s *out, const char *line, uint32_t pc);
+
+extern const char *Mips_GprNames[32];
+#endif
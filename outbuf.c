@@ -0,0 +1,119 @@
+#include <iso646.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "outbuf.h"
+
+void OutBuf_Init(struct outbuf_s *ob)
+{
+	ob->p = NULL;
+	ob->len = 0;
+	ob->cap = 0;
+	ob->error = false;
+}
+
+void OutBuf_Free(struct outbuf_s *ob)
+{
+	free(ob->p);
+	OutBuf_Init(ob);
+}
+
+// make room for n more bytes
+void OutBuf_Reserve(struct outbuf_s *ob, size_t n)
+{
+	size_t cap;
+	char *p;
+
+	if (ob->error or (ob->len + n <= ob->cap)) return;
+	cap = ob->cap? ob->cap: 65536;
+	while (cap < ob->len + n) cap *= 2;
+	p = realloc(ob->p, cap);
+	if (!p) {
+		ob->error = true;
+		return;
+	}
+	ob->p = p;
+	ob->cap = cap;
+}
+
+void OutBuf_Write(struct outbuf_s *ob, const void *data, size_t len)
+{
+	OutBuf_Reserve(ob, len);
+	if (ob->error) return;
+	memcpy(ob->p + ob->len, data, len);
+	ob->len += len;
+}
+
+void OutBuf_Puts(struct outbuf_s *ob, const char *s)
+{
+	OutBuf_Write(ob, s, strlen(s));
+}
+
+void OutBuf_Printf(struct outbuf_s *ob, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	OutBuf_Reserve(ob, 256);
+	if (ob->error) return;
+	va_start(ap, fmt);
+	n = vsnprintf(ob->p + ob->len, ob->cap - ob->len, fmt, ap);
+	va_end(ap);
+	if (n < 0) {
+		ob->error = true;
+		return;
+	}
+	if ((size_t)n >= ob->cap - ob->len) {
+		OutBuf_Reserve(ob, n + 1);
+		if (ob->error) return;
+		va_start(ap, fmt);
+		vsnprintf(ob->p + ob->len, ob->cap - ob->len, fmt, ap);
+		va_end(ap);
+	}
+	ob->len += n;
+}
+
+// lowercase hex, zero-padded to digits
+void OutBuf_Hex(struct outbuf_s *ob, uint64_t v, int digits)
+{
+	static const char hex[] = "0123456789abcdef";
+	char tmp[16];
+	int n = 0;
+
+	do {
+		tmp[n++] = hex[v & 15];
+		v >>= 4;
+	} while (v and (n < 16));
+	while (n < digits) tmp[n++] = '0';
+	OutBuf_Reserve(ob, n);
+	if (ob->error) return;
+	while (n) ob->p[ob->len++] = tmp[--n];
+}
+
+void OutBuf_Dec(struct outbuf_s *ob, int64_t v)
+{
+	char tmp[24];
+	int n = 0;
+	uint64_t u = (v < 0)? -(uint64_t)v: (uint64_t)v;
+
+	do {
+		tmp[n++] = '0' + (u % 10);
+		u /= 10;
+	} while (u);
+	if (v < 0) tmp[n++] = '-';
+	OutBuf_Reserve(ob, n);
+	if (ob->error) return;
+	while (n) ob->p[ob->len++] = tmp[--n];
+}
+
+// write out and empty the buffer. returns 0, or -1 on any error
+int OutBuf_Flush(struct outbuf_s *ob, FILE *f)
+{
+	int rc = ob->error? -1: 0;
+
+	if (ob->len and (fwrite(ob->p, 1, ob->len, f) != ob->len))
+		rc = -1;
+	ob->len = 0;
+	ob->error = false;
+	return rc;
+}
@@ -0,0 +1,37 @@
+#ifndef _OUTBUF_H_
+#define _OUTBUF_H_
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * A growable text buffer with cheap formatting, for output that is too
+ * big to go through printf a line at a time. Allocation failures are
+ * sticky and reported by OutBuf_Flush.
+ */
+struct outbuf_s {
+	char *p;
+	size_t len;
+	size_t cap;
+	bool error;
+};
+
+void OutBuf_Init(struct outbuf_s *ob);
+void OutBuf_Free(struct outbuf_s *ob);
+void OutBuf_Reserve(struct outbuf_s *ob, size_t n);
+void OutBuf_Write(struct outbuf_s *ob, const void *data, size_t len);
+void OutBuf_Puts(struct outbuf_s *ob, const char *s);
+void OutBuf_Printf(struct outbuf_s *ob, const char *fmt, ...)
+	__attribute__(( format(printf, 2, 3) ));
+void OutBuf_Hex(struct outbuf_s *ob, uint64_t v, int digits);
+void OutBuf_Dec(struct outbuf_s *ob, int64_t v);
+int OutBuf_Flush(struct outbuf_s *ob, FILE *f);
+
+static inline void OutBuf_Putc(struct outbuf_s *ob, char c)
+{
+	if (ob->len == ob->cap) OutBuf_Reserve(ob, 1);
+	if (ob->error) return;
+	ob->p[ob->len++] = c;
+}
+#endif
@@ -0,0 +1,83 @@
+#ifdef __MINGW32__
+#include <windows.h>
+#endif
+#include <iso646.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pool.h"
+
+#define POOL_MAX_THREADS (64)
+
+struct pool_s {
+	pool_fn fn;
+	void *ctx;
+	size_t count;
+	size_t next;
+};
+
+/*
+ * Number of worker threads: PSFRAG_THREADS if set, otherwise one per
+ * online cpu.
+ */
+unsigned Pool_Threads(void)
+{
+	char *env = getenv("PSFRAG_THREADS");
+	long n = 0;
+
+	if (env) n = atol(env);
+	if (n <= 0) {
+#ifdef __MINGW32__
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		n = si.dwNumberOfProcessors;
+#else
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	}
+	if (n < 1) n = 1;
+	if (n > POOL_MAX_THREADS) n = POOL_MAX_THREADS;
+	return n;
+}
+
+static void *pool_worker(void *arg)
+{
+	struct pool_s *pool = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->count)
+		pool->fn(pool->ctx, i);
+	return NULL;
+}
+
+/*
+ * Call fn(ctx, i) for every i in [0, count), spread over the worker
+ * threads, and wait for all of them. Items are handed out one at a time,
+ * so uneven items balance themselves. Returns 0, or -1 if no thread
+ * could be started (the items then run on the calling thread).
+ */
+int Pool_Run(size_t count, pool_fn fn, void *ctx)
+{
+	pthread_t threads[POOL_MAX_THREADS];
+	struct pool_s pool = {
+		.fn = fn,
+		.ctx = ctx,
+		.count = count,
+		.next = 0,
+	};
+	unsigned n = Pool_Threads();
+	unsigned started = 0;
+
+	if (n > count) n = count;
+	// the calling thread is one of the workers
+	for (unsigned t = 1; t < n; t++) {
+		if (pthread_create(&threads[started], NULL, pool_worker, &pool))
+			break;
+		started++;
+	}
+	pool_worker(&pool);
+	for (unsigned t = 0; t < started; t++)
+		pthread_join(threads[t], NULL);
+
+	return ((n > 1) and (started == 0))? -1: 0;
+}
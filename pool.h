@@ -0,0 +1,9 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+#include <stddef.h>
+
+typedef void (*pool_fn)(void *ctx, size_t index);
+
+unsigned Pool_Threads(void);
+int Pool_Run(size_t count, pool_fn fn, void *ctx);
+#endif
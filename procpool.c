@@ -0,0 +1,70 @@
+#ifndef __MINGW32__
+#include <errno.h>
+#include <iso646.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "procpool.h"
+
+extern char **environ;
+
+/*
+ * Run argvs[0..count) with posix_spawnp, no more than max_procs at a
+ * time. Returns 0 once all of them have exited, or -1 if waiting failed.
+ */
+int ProcPool_Run(char ***argvs, size_t count, unsigned max_procs,
+	procpool_cb cb, void *ctx)
+{
+	pid_t *pids;
+	size_t *indexes;	// what each slot of pids is running
+	size_t next = 0;
+	unsigned running = 0;
+	int rc = 0;
+
+	if (max_procs < 1) max_procs = 1;
+	pids = calloc(max_procs, sizeof(*pids));
+	indexes = calloc(max_procs, sizeof(*indexes));
+	if (!pids or !indexes) {
+		free(pids);
+		free(indexes);
+		return -1;
+	}
+
+	while ((next < count) or running) {
+		while ((next < count) and (running < max_procs)) {
+			unsigned slot = 0;
+			while (pids[slot]) slot++;
+			if (posix_spawnp(&pids[slot], argvs[next][0], NULL, NULL,
+				argvs[next], environ)) {
+				pids[slot] = 0;
+				cb(ctx, next++, -1);
+				continue;
+			}
+			indexes[slot] = next++;
+			running++;
+		}
+		if (!running) break;
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR) continue;
+			rc = -1;
+			break;
+		}
+		for (unsigned slot = 0; slot < max_procs; slot++) {
+			if (pids[slot] != pid) continue;
+			pids[slot] = 0;
+			running--;
+			cb(ctx, indexes[slot],
+				WIFEXITED(status)? WEXITSTATUS(status): -1);
+			break;
+		}
+	}
+
+	free(indexes);
+	free(pids);
+	return rc;
+}
+#endif
@@ -0,0 +1,13 @@
+#ifndef _PROCPOOL_H_
+#define _PROCPOOL_H_
+#include <stddef.h>
+
+/*
+ * Called as each process exits, in the order they finish. status is the
+ * exit code, or -1 if it couldn't be started or died from a signal.
+ */
+typedef void (*procpool_cb)(void *ctx, size_t index, int status);
+
+int ProcPool_Run(char ***argvs, size_t count, unsigned max_procs,
+	procpool_cb cb, void *ctx);
+#endif
@@ -0,0 +1,111 @@
+#include <inttypes.h>
+#include <iso646.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "pcode.h"
+#include "profile.h"
+
+static uint64_t header_crc(struct RomView_s *rom)
+{
+	uint64_t crc = 0;
+
+	for (int i = 0x10; i < 0x18; i++)
+		crc = (crc << 8) | rom->header[i];
+	return crc;
+}
+
+static bool header_matches(struct RomView_s *rom, const struct fraginfo_s *want)
+{
+	struct fragment_s frag;
+	struct fraginfo_s fi;
+
+	if (want->addr > rom->size - sizeof(frag)) return false;
+	RomView_Read(rom, &frag, want->addr, sizeof(frag));
+	if (!isfrag(&frag)) return false;
+	get_fraginfo(&fi, &frag, want->addr);
+	return (fi.num == want->num)
+		and (fi.entrypoint == want->entrypoint)
+		and (fi.offset_code == want->offset_code)
+		and (fi.offset_relocs == want->offset_relocs)
+		and (fi.romsize == want->romsize)
+		and (fi.ramsize == want->ramsize);
+}
+
+static bool payload_matches(struct RomView_s *rom, const struct fraginfo_s *want)
+{
+	uint8_t *p;
+	uint64_t hash;
+
+	if (want->romsize > rom->size - want->addr) return false;
+	p = RomView_Get(rom, want->addr, want->romsize);
+	if (!p) return false;
+	hash = XXH64(p, want->romsize, 0);
+	RomView_Put(rom, p);
+	return hash == want->hash;
+}
+
+// check a rom against one profile: every header, and a few of the payloads
+static bool profile_matches(const struct profile_s *p, struct RomView_s *rom)
+{
+	char pcode[6];
+
+	if ((p->rom_size != rom->size) or (p->crc != header_crc(rom)))
+		return false;
+	if (strcmp(p->pcode, get_pcode(pcode, rom->header))) return false;
+	for (size_t i = 0; i < p->num_frags; i++)
+		if (!header_matches(rom, &p->frags[i])) return false;
+	for (size_t k = 0; (k < PROFILE_SAMPLES) and p->num_frags; k++) {
+		size_t i = k * (p->num_frags - 1) / (PROFILE_SAMPLES - 1);
+		if (!payload_matches(rom, &p->frags[i])) return false;
+	}
+	return true;
+}
+
+/*
+ * The compiled in profile of a rom, or NULL if it isn't a known one.
+ * $PSFRAG_NO_PROFILES turns them off, for rom hacks that change
+ * fragments without changing their headers.
+ */
+const struct profile_s *Profile_Match(struct RomView_s *rom)
+{
+	if (getenv("PSFRAG_NO_PROFILES")) return NULL;
+	for (size_t i = 0; i < Num_Profiles; i++)
+		if (profile_matches(&Profiles[i], rom)) return &Profiles[i];
+	return NULL;
+}
+
+// a malloc'd copy of the fragment table of a profile, as Frag_Search gives
+int Profile_Frags(const struct profile_s *p, struct fraginfo_s **frags,
+	size_t *num)
+{
+	*frags = malloc((p->num_frags? p->num_frags: 1) * sizeof(**frags));
+	*num = 0;
+	if (!*frags) return -1;
+	memcpy(*frags, p->frags, p->num_frags * sizeof(**frags));
+	*num = p->num_frags;
+	return 0;
+}
+
+// write the fragment table of a rom as profiles.awk reads it
+void Profile_Write(FILE *f, struct RomView_s *rom, struct fraginfo_s *frags,
+	size_t num)
+{
+	char pcode[6];
+
+	get_pcode(pcode, rom->header);
+	fprintf(f, "pcode,crc,rom_size,addr,num,entrypoint,offset_code,"
+		"offset_relocs,romsize,ramsize,vma,hash,fingerprint\n");
+	for (size_t i = 0; i < num; i++) {
+		struct fraginfo_s *fi = &frags[i];
+		fprintf(f, "%s,0x%016" PRIx64 ",0x%" PRIx64 ",0x%" PRIx64
+			",%d,0x%08x,0x%x,0x%x,0x%x,0x%x,0x%08x"
+			",0x%016" PRIx64 ",0x%016" PRIx64 "\n",
+			pcode, header_crc(rom), rom->size, fi->addr,
+			fi->num, fi->entrypoint, fi->offset_code,
+			fi->offset_relocs, fi->romsize, fi->ramsize, fi->vma,
+			fi->hash, fi->fingerprint);
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "fragment.h"
+#include "romview.h"
+
+// how many fragments of a profiled rom have their payloads hashed to check it
+#define PROFILE_SAMPLES (3)
+
+/*
+ * A rom whose fragment table is compiled in, so it never has to be
+ * scanned. The tables come from the .csv files in profiles/, written by
+ * "psfrag profile", and are turned into profiles.c when building.
+ */
+struct profile_s {
+	const char *pcode;
+	uint64_t crc;		// CRC1 and CRC2 from the rom header
+	uint64_t rom_size;
+	const struct fraginfo_s *frags;
+	size_t num_frags;
+};
+
+extern const struct profile_s Profiles[];
+extern const size_t Num_Profiles;
+
+const struct profile_s *Profile_Match(struct RomView_s *rom);
+int Profile_Frags(const struct profile_s *p, struct fraginfo_s **frags,
+	size_t *num);
+void Profile_Write(FILE *f, struct RomView_s *rom, struct fraginfo_s *frags,
+	size_t num);
+#endif
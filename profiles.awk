@@ -0,0 +1,57 @@
+# Turn the fragment tables written by "psfrag profile" into profiles.c.
+# Rows are grouped into one profile per pcode, crc and rom size, in the
+# order they are first seen.
+
+BEGIN {
+	FS = ","
+	n = 0
+}
+
+/^pcode,/ || /^#/ || NF == 0 { next }
+
+NF != 13 {
+	printf "%s:%d: expected 13 fields\n", FILENAME, FNR > "/dev/stderr"
+	bad = 1
+	exit 1
+}
+
+{
+	key = $1 "," $2 "," $3
+	if (!(key in id)) {
+		id[key] = n
+		pcode[n] = $1
+		crc[n] = $2
+		size[n] = $3
+		count[n] = 0
+		rows[n] = ""
+		n++
+	}
+	p = id[key]
+	rows[p] = rows[p] sprintf("\t{ .addr = %sULL, .num = %s, " \
+		".entrypoint = %s, .offset_code = %s, .offset_relocs = %s, " \
+		".romsize = %s, .ramsize = %s, .vma = %s, " \
+		".hash = %sULL, .fingerprint = %sULL },\n", \
+		$4, $5, $6, $7, $8, $9, $10, $11, $12, $13)
+	count[p]++
+}
+
+END {
+	if (bad) exit 1
+	print "// made by profiles.awk from the .csv files in profiles/"
+	print "#include \"profile.h\""
+	for (p = 0; p < n; p++) {
+		print ""
+		printf "static const struct fraginfo_s frags_%d[] = {\n", p
+		printf "%s", rows[p]
+		print "};"
+	}
+	print ""
+	print "const struct profile_s Profiles[] = {"
+	for (p = 0; p < n; p++)
+		printf "\t{ \"%s\", %sULL, %sULL, frags_%d, %d },\n", \
+			pcode[p], crc[p], size[p], p, count[p]
+	print "\t{ NULL, 0, 0, NULL, 0 },"
+	print "};"
+	print ""
+	printf "const size_t Num_Profiles = %d;\n", n
+}
@@ -1,31 +1,82 @@
 #ifdef __MINGW32__
+#include <io.h>
 #include <winsock2.h>
 #else
 #define _GNU_SOURCE
 #include <arpa/inet.h>
 #endif
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <iso646.h>
+#include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "asmverify.h"
+#include "checksum.h"
+#include "columns.h"
 #include "db.h"
+#include "diff.h"
+#include "disasm.h"
+#include "elf.h"
+#include "fragindex.h"
 #include "fragment.h"
+#include "hash.h"
+#include "image.h"
 #include "mapfile.h"
+#include "outbuf.h"
 #include "pcode.h"
+#include "pool.h"
+#include "procpool.h"
+#include "profile.h"
+#include "ramscan.h"
+#include "reloc.h"
+#include "romview.h"
+#include "search.h"
 #include "sqlite3.h"
+#include "stream.h"
+#include "symbolize.h"
+#include "verify.h"
 #include "version.h"
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 sqlite3 *db;
 
+#define DECOMPILER "retdec-decompiler.py"
+#define DECOMPILE_CACHE ".psfrag-cache"
+#define LLVM_MC "llvm-mc"
+
 char *cmd_mkdb(int argc, char **argv);
+char *cmd_mergedb(int argc, char **argv);
 char *cmd_scan(int argc, char **argv);
 char *cmd_depends(int argc, char **argv);
 char *cmd_decompile(int argc, char **argv);
+char *cmd_decompile_all(int argc, char **argv);
 char *cmd_extract(int argc, char **argv);
 char *cmd_extract_all(int argc, char **argv);
+char *cmd_scan_image(int argc, char **argv);
+char *cmd_match(int argc, char **argv);
+char *cmd_diff(int argc, char **argv);
+char *cmd_insert(int argc, char **argv);
+char *cmd_verify(int argc, char **argv);
+char *cmd_disasm(int argc, char **argv);
+char *cmd_export_asm(int argc, char **argv);
+char *cmd_export_elf(int argc, char **argv);
+char *cmd_export_columns(int argc, char **argv);
+char *cmd_symbolize(int argc, char **argv);
+char *cmd_identify_ram(int argc, char **argv);
+char *cmd_query(int argc, char **argv);
+char *cmd_index(int argc, char **argv);
+char *cmd_profile(int argc, char **argv);
 
 struct cmd_s {
 	char *command;
@@ -34,20 +85,30 @@ struct cmd_s {
 } cmds[] = {
 	{
 		.command = "scan",
-		.help = "scan <rom>\n"
-			"\t\tshow fragments within a rom",
+		.help = "scan <rom> [--extract]\n"
+			"\t\tshow fragments within a rom. use - to read from stdin.\n"
+			"\t\t--extract also writes out each fragment as it is found",
 		.handler = cmd_scan,
 	},
+	{
+		.command = "scan-image",
+		.help = "scan-image <file>\n"
+			"\t\tfind roms inside a bigger image and show their fragments",
+		.handler = cmd_scan_image,
+	},
 	{
 		.command = "depends",
 		.help = "depends <rom> <fragnum>\n"
+			"\tdepends --db <db> <fragnum> [pcode]\n"
 			"\t\tshow what fragments this one depends on",
 		.handler = cmd_depends,
 	},
 	{
 		.command = "extract",
 		.help = "extract <rom> <fragnum>\n"
-			"\t\textract one fragment",
+			"\textract --db <db> <fragnum> [pcode]\n"
+			"\t\textract one fragment, from a rom or from a database\n"
+			"\t\tmade with mkdb --with-blobs",
 		.handler = cmd_extract,
 	},
 	{
@@ -56,12 +117,118 @@ struct cmd_s {
 			"\t\textract all fragments",
 		.handler = cmd_extract_all,
 	},
+	{
+		.command = "match",
+		.help = "match <romA> <romB>\n"
+			"\t\tpair up fragments of two roms by fingerprint",
+		.handler = cmd_match,
+	},
+	{
+		.command = "diff",
+		.help = "diff <romA> <romB>\n"
+			"\t\tshow fragments added, removed, moved, resized or changed",
+		.handler = cmd_diff,
+	},
+	{
+		.command = "insert",
+		.help = "insert <rom> <fragnum> <file> [<fragnum> <file>]... [--relocate-layout]\n"
+			"\t\twrite fragments back into a rom. with --relocate-layout,\n"
+			"\t\tfragments after one that outgrew its slot are moved up.\n"
+			"\t\tthe rom's table of fragment ranges and its checksums\n"
+			"\t\tare updated to match",
+		.handler = cmd_insert,
+	},
+	{
+		.command = "verify",
+		.help = "verify <rom>\n"
+			"\t\tcheck the headers and relocation tables of all fragments.\n"
+			"\t\tproblems are shown as CSV, and fail the command",
+		.handler = cmd_verify,
+	},
+	{
+		.command = "disasm",
+		.help = "disasm <rom> <fragnum>|all\n"
+			"\t\tshow an assembly listing of fragments, with symbols\n"
+			"\t\tfrom their relocations",
+		.handler = cmd_disasm,
+	},
+	{
+		.command = "export-asm",
+		.help = "export-asm <rom> [dir] [--llvm-mc]\n"
+			"\t\twrite each fragment as a .s file for GNU as, and check\n"
+			"\t\tthat it assembles back to the same fragment. --llvm-mc\n"
+			"\t\talso assembles each one with llvm-mc, or $PSFRAG_LLVM_MC",
+		.handler = cmd_export_asm,
+	},
+	{
+		.command = "export-elf",
+		.help = "export-elf <rom> [dir]\n"
+			"\t\twrite each fragment as a MIPS ELF relocatable object",
+		.handler = cmd_export_elf,
+	},
+	{
+		.command = "export-columns",
+		.help = "export-columns <rom|db> <dir>\n"
+			"\t\twrite the frags and relocs tables as one file per\n"
+			"\t\tcolumn of little-endian fixed-width values",
+		.handler = cmd_export_columns,
+	},
+	{
+		.command = "symbolize",
+		.help = "symbolize <rom> [trace] [--symbols <file>] [--loaded <n,n,...>]\n"
+			"\t\tadd the fragment and offset, and symbol if known, to each\n"
+			"\t\taddress in a trace. reads stdin without a trace. --loaded\n"
+			"\t\tpicks between fragments that share an address",
+		.handler = cmd_symbolize,
+	},
+	{
+		.command = "identify-ram",
+		.help = "identify-ram <rom> <ramdump> [--threshold N]\n"
+			"\t\tfind which fragments are loaded in a ram dump, and where.\n"
+			"\t\tshows those with at least N% of their code intact (90)",
+		.handler = cmd_identify_ram,
+	},
+	{
+		.command = "query",
+		.help = "query <rom> <sql> [--json]\n"
+			"\t\trun SQL against the frags and relocs tables of a rom,\n"
+			"\t\tand show the rows as CSV or JSON",
+		.handler = cmd_query,
+	},
+	{
+		.command = "index",
+		.help = "index <rom> [out]\n"
+			"\t\twrite a .psfidx index of the fragments of a rom. any\n"
+			"\t\tcommand given --index <file> reads it instead of scanning,\n"
+			"\t\tand depends takes the dependencies and symbolize the\n"
+			"\t\tram ranges from it too. a streamed scan, scan-image and\n"
+			"\t\tprofile always scan",
+		.handler = cmd_index,
+	},
+	{
+		.command = "profile",
+		.help = "profile <rom>\n"
+			"\t\tshow the fragment table of a rom as CSV. saved in\n"
+			"\t\tprofiles/, it's built in and the rom is never scanned.\n"
+			"\t\t$PSFRAG_NO_PROFILES turns the built in ones off",
+		.handler = cmd_profile,
+	},
 	{
 		.command = "mkdb",
-		.help = "mkdb <rom> <sqlite3 database>\n"
-			"\t\tpopulate an SQLite3 database with fragment data",
+		.help = "mkdb <rom> <sqlite3 database> [--with-blobs]\n"
+			"\t\tpopulate an SQLite3 database with fragment data.\n"
+			"\t\tif the rom is already in it, only rescan what changed.\n"
+			"\t\t--with-blobs also stores each fragment, once per hash",
 		.handler = cmd_mkdb,
 	},
+	{
+		.command = "mergedb",
+		.help = "mergedb <out> <in>...\n"
+			"\t\tcopy the roms of databases made by mkdb into one.\n"
+			"\t\troms already in <out> are kept, with a warning if\n"
+			"\t\tthe one being merged has the same pcode but differs",
+		.handler = cmd_mergedb,
+	},
 #ifndef __MINGW32__
 	// this doesn't work on windows :(
 	{
@@ -70,6 +237,15 @@ struct cmd_s {
 			"\t\tcreates .c file. requires avast's retdec",
 		.handler = cmd_decompile,
 	},
+	{
+		.command = "decompile-all",
+		.help = "decompile-all <rom> [--jobs N]\n"
+			"\t\tdecompile every fragment, N at a time. results are\n"
+			"\t\tcached by decompiler and fragment hash in\n"
+			"\t\t" DECOMPILE_CACHE ", or $PSFRAG_CACHE.\n"
+			"\t\t$PSFRAG_DECOMPILER replaces retdec",
+		.handler = cmd_decompile_all,
+	},
 #endif
 	{
 		// end
@@ -115,7 +291,7 @@ int dump_frags()
 	sqlite3_stmt *stmt;
 	rc = sqlite3_prepare_v2(
 		db,
-		"select pcode,addr,num,entrypoint,offset_code,offset_relocs,romsize,ramsize,vma from frags order by num;",
+		"select pcode,addr,num,entrypoint,offset_code,offset_relocs,romsize,ramsize,vma,hash,fingerprint from frags order by num;",
 		-1,
 		&stmt,
 		NULL
@@ -125,7 +301,7 @@ int dump_frags()
 		goto out_return;
 	}
 
-	printf("pcode,addr,num,entrypoint,offset_code,offset_relocs,romsize,ramsize,vma\n");
+	printf("pcode,addr,num,entrypoint,offset_code,offset_relocs,romsize,ramsize,vma,hash,fingerprint\n");
 
 	while (SQLITE_DONE != (rc=sqlite3_step(stmt))) switch (rc) {
 	case SQLITE_BUSY:
@@ -143,7 +319,7 @@ int dump_frags()
 		goto out_finalize;
 		break;
 	case SQLITE_ROW:
-		printf("%s,%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 "\n",
+		printf("%s,%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%" PRIuLEAST32 ",%016" PRIx64 ",%016" PRIx64 "\n",
 			sqlite3_column_text(stmt, 0),
 			(uint_least32_t)sqlite3_column_int64(stmt, 1),
 			(uint_least32_t)sqlite3_column_int64(stmt, 2),
@@ -152,7 +328,9 @@ int dump_frags()
 			(uint_least32_t)sqlite3_column_int64(stmt, 5),
 			(uint_least32_t)sqlite3_column_int64(stmt, 6),
 			(uint_least32_t)sqlite3_column_int64(stmt, 7),
-			(uint_least32_t)sqlite3_column_int64(stmt, 8)
+			(uint_least32_t)sqlite3_column_int64(stmt, 8),
+			(uint64_t)sqlite3_column_int64(stmt, 9),
+			(uint64_t)sqlite3_column_int64(stmt, 10)
 		);
 		break;
 	}
@@ -167,59 +345,2042 @@ out_return:
 		return 0;
 }
 
-char *cmd_scan(int argc, char **argv)
+static int _scan_stream_cb(void *ctx, char *pcode, struct fraginfo_s *fi)
+{
+	return DB_AddFrag(
+		ctx,
+		pcode,
+		fi->addr,
+		fi->num,
+		fi->entrypoint,
+		fi->offset_code,
+		fi->offset_relocs,
+		fi->romsize,
+		fi->ramsize,
+		fi->vma,
+		fi->hash,
+		fi->fingerprint
+	);
+}
+
+/*
+ * Scan input that is piped in or that should be extracted on the fly,
+ * one block at a time instead of mapping it.
+ */
+char *_cmd_scan_stream(char *filename, bool extract)
+{
+	__label__ out_return, out_dbclose, out_close;
+	char *msg = NULL;
+	int fd;
+	int rc;
+
+	rc = DB_Init(&db, ":memory:");
+	if (rc != SQLITE_OK) {
+		msg = "DB_Init oopsed";
+		goto out_return;
+	}
+
+	if (!strcmp(filename, "-")) {
+		fd = STDIN_FILENO;
+#ifdef __MINGW32__
+		_setmode(fd, O_BINARY);
+#endif
+	} else {
+		fd = open(filename, O_RDONLY | O_BINARY);
+	}
+	if (fd < 0) {
+		msg = "couldn't open rom";
+		goto out_dbclose;
+	}
+	Frag_IgnoreIndex("a stream");
+
+	DB_Begin(db);
+	rc = FragStream_Scan(fd, _scan_stream_cb, db, extract);
+	DB_End(db);
+	if (rc == FRAGSTREAM_NOMEM) {
+		msg = "out of memory";
+		goto out_close;
+	} else if (rc != 0) {
+		msg = "FragStream_Scan oopsed";
+		goto out_close;
+	}
+
+	dump_frags();
+
+out_close:
+	if (fd != STDIN_FILENO) close(fd);
+out_dbclose:
+	DB_Close(db);
+out_return:
+	return msg;
+}
+
+char *cmd_scan(int argc, char **argv)
+{
+	__label__ out_return;
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct stat sb;
+	char *msg = NULL;
+	int rc;
+
+	if (argc < 3) {
+		msg = "must specify a pokemon stadium rom";
+		goto out_return;
+	}
+
+	if ((argc >= 4) and !strcmp(argv[3], "--extract"))
+		return _cmd_scan_stream(argv[2], true);
+	if (!strcmp(argv[2], "-"))
+		return _cmd_scan_stream(argv[2], false);
+	if ((stat(argv[2], &sb) == 0) and !S_ISREG(sb.st_mode))
+		return _cmd_scan_stream(argv[2], false);
+
+	rc = DB_Init(&db, ":memory:");
+	if (rc != SQLITE_OK) {
+		msg = "DB_Init oopsed";
+		goto out_return;
+	}
+
+	m = MappedFile_OpenFlags(argv[2], MAPFILE_SCAN);
+	if (m.data == NULL) {
+		msg = "couldn't open rom";
+		goto out_dbclose;
+	}
+
+	if (m.size < (1048576 + 4096)) {
+		msg = "rom too small";
+		goto out_unmap;
+	}
+
+	RomView_Init(&rom, m.data, m.size);
+
+	rc = DB_FragSearch(db, &rom);
+	if (rc != SQLITE_OK) {
+		msg = "DB_FragSearch oopsed";
+		goto out_unmap;
+	}
+
+	dump_frags();
+
+out_unmap:
+	MappedFile_Close(m);
+out_dbclose:
+	DB_Close(db);
+out_return:
+	if (msg) {
+		return msg;
+	} else {
+		return NULL;
+	}
+}
+
+char *cmd_scan_image(int argc, char **argv)
+{
+	__label__ out_return, out_unmap;
+	struct MappedFile_s m;
+	struct image_s img;
+	char *msg = NULL;
+	int rc;
+
+	if (argc < 3) {
+		msg = "must specify an image file";
+		goto out_return;
+	}
+
+	// an image is only walked front to back
+	m = MappedFile_OpenFlags(argv[2], MAPFILE_SCAN | MAPFILE_SEQUENTIAL);
+	if (m.data == NULL) {
+		msg = "couldn't open image";
+		goto out_return;
+	}
+	Frag_IgnoreIndex("an image");
+
+	rc = Image_Scan(&img, m.data, m.size);
+	if (rc != 0) {
+		msg = "Image_Scan oopsed";
+		goto out_unmap;
+	}
+
+	printf("rom_offset,order,pcode,addr,num,entrypoint,offset_code,offset_relocs,romsize,ramsize,vma,hash,fingerprint\n");
+	for (size_t i = 0; i < img.num_roms; i++) {
+		struct imagerom_s *r = &img.roms[i];
+		for (size_t j = 0; j < r->num_frags; j++) {
+			struct fraginfo_s *fi = &r->frags[j];
+			printf("%" PRIu64 ",%s,%s,%" PRIu64 ",%" PRId32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%016" PRIx64 ",%016" PRIx64 "\n",
+				r->offset,
+				RomView_OrderName(r->rom.order),
+				r->pcode,
+				fi->addr,
+				fi->num,
+				fi->entrypoint,
+				fi->offset_code,
+				fi->offset_relocs,
+				fi->romsize,
+				fi->ramsize,
+				fi->vma,
+				fi->hash,
+				fi->fingerprint
+			);
+		}
+	}
+	Image_Free(&img);
+
+out_unmap:
+	MappedFile_Close(m);
+out_return:
+	return msg;
+}
+
+/*
+ * Map a rom and check it looks like one. On success the caller closes
+ * m; on failure an error message is returned and nothing is left open.
+ */
+char *_open_rom(char *filename, struct MappedFile_s *m, struct RomView_s *rom)
+{
+	*m = MappedFile_OpenFlags(filename, MAPFILE_SCAN);
+	if (m->data == NULL)
+		return "couldn't open rom";
+
+	if (m->size < (1048576 + 4096)) {
+		MappedFile_Close(*m);
+		return "rom too small";
+	}
+
+	RomView_Init(rom, m->data, m->size);
+	return NULL;
+}
+
+/*
+ * Open a database made by mkdb, read-only, as db. On success the caller
+ * closes it.
+ */
+char *_open_db(char *filename)
+{
+	if (sqlite3_open_v2(filename, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+		DB_Close(db);
+		return "couldn't open database";
+	}
+	return NULL;
+}
+
+// read a fragment stored by mkdb --with-blobs, for the --db options
+char *_get_db_frag(int argc, char **argv, int *num, uint8_t **bytes,
+	size_t *size, char pcode[6])
+{
+	switch (argc) {
+	case 0 ... 3:
+		return "must specify a database";
+	case 4:
+		return "must specify a fragment number";
+	default:
+		break;
+	}
+	*num = atoi(argv[4]);
+	switch (DB_GetBlob(db, *num, (argc > 5)? argv[5]: NULL, bytes, size, pcode)) {
+	case SQLITE_OK:
+		return NULL;
+	case SQLITE_NOTFOUND:
+		return "no stored fragment by that number";
+	case SQLITE_CONSTRAINT:
+		return "more than one rom has that fragment, give a pcode";
+	default:
+		return "couldn't read fragment from database";
+	}
+}
+
+char *cmd_match(int argc, char **argv)
+{
+	__label__ out_return, out_unmap_a, out_free;
+	struct MappedFile_s ma, mb;
+	struct RomView_s roma, romb;
+	struct fraginfo_s *fa = NULL, *fb = NULL;
+	size_t na, nb;
+	struct u64map_s map = {0};
+	bool *used = NULL;
+	char *msg = NULL;
+
+	switch (argc) {
+	case 0 ... 3:
+		msg = "must specify two Pokemon Stadium roms";
+		goto out_return;
+	default:
+		break;
+	}
+
+	msg = _open_rom(argv[2], &ma, &roma);
+	if (msg) goto out_return;
+	msg = _open_rom(argv[3], &mb, &romb);
+	if (msg) goto out_unmap_a;
+
+	if (Frag_Search(&roma, &fa, &na) or Frag_Search(&romb, &fb, &nb)) {
+		msg = "Frag_Search oopsed";
+		goto out_free;
+	}
+
+	used = calloc(na? na: 1, sizeof(*used));
+	if (!used or U64Map_Init(&map, na)) {
+		msg = "out of memory";
+		goto out_free;
+	}
+	for (size_t i = 0; i < na; i++)
+		U64Map_Put(&map, fa[i].fingerprint, i);
+
+	printf("num_a,addr_a,num_b,addr_b,fingerprint\n");
+	for (size_t j = 0; j < nb; j++) {
+		size_t iter = 0, i, pick = -1;
+
+		// identical fragments can repeat; prefer the same number
+		while (U64Map_Get(&map, fb[j].fingerprint, &iter, &i)) {
+			if (used[i]) continue;
+			if (pick == (size_t)-1) pick = i;
+			if (fa[i].num == fb[j].num) {
+				pick = i;
+				break;
+			}
+		}
+
+		if (pick == (size_t)-1) {
+			printf(",,%" PRId32 ",%" PRIu64 ",%016" PRIx64 "\n",
+				fb[j].num, fb[j].addr, fb[j].fingerprint);
+			continue;
+		}
+		used[pick] = true;
+		printf("%" PRId32 ",%" PRIu64 ",%" PRId32 ",%" PRIu64 ",%016" PRIx64 "\n",
+			fa[pick].num, fa[pick].addr,
+			fb[j].num, fb[j].addr, fb[j].fingerprint);
+	}
+	for (size_t i = 0; i < na; i++) {
+		if (used[i]) continue;
+		printf("%" PRId32 ",%" PRIu64 ",,,%016" PRIx64 "\n",
+			fa[i].num, fa[i].addr, fa[i].fingerprint);
+	}
+
+out_free:
+	U64Map_Free(&map);
+	free(used);
+	free(fa);
+	free(fb);
+	MappedFile_Close(mb);
+out_unmap_a:
+	MappedFile_Close(ma);
+out_return:
+	return msg;
+}
+
+// ranges are held back one step so that touching ones print as one
+struct diffranges_s {
+	bool first;
+	bool pending;
+	size_t start, end;
+};
+
+static void _diff_flush_range(struct diffranges_s *d)
+{
+	if (!d->pending) return;
+	printf("%s%zx-%zx", d->first? "": " ", d->start, d->end);
+	d->first = false;
+	d->pending = false;
+}
+
+static void _diff_add_range(void *ctx, size_t start, size_t end)
+{
+	struct diffranges_s *d = ctx;
+
+	if (d->pending and (d->end == start)) {
+		d->end = end;
+		return;
+	}
+	_diff_flush_range(d);
+	d->pending = true;
+	d->start = start;
+	d->end = end;
+}
+
+static void _diff_pair(struct RomView_s *roma, struct fraginfo_s *a,
+	struct RomView_s *romb, struct fraginfo_s *b)
+{
+	bool moved = a->addr != b->addr;
+	bool resized = (a->romsize != b->romsize) or (a->ramsize != b->ramsize);
+	char *status = "same";
+
+	if (a->hash != b->hash)
+		status = (a->fingerprint == b->fingerprint)? "relinked": "changed";
+	if (!moved and !resized and !strcmp(status, "same")) return;
+
+	printf("%" PRId32 ",%" PRId32 ",%s,%d,%d,%" PRIu64 ",%" PRIu64 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",",
+		a->num, b->num, status, moved, resized,
+		a->addr, b->addr,
+		a->romsize, b->romsize,
+		a->ramsize, b->ramsize
+	);
+
+	if (strcmp(status, "same")) {
+		size_t lena = a->romsize, lenb = b->romsize, len;
+		if (lena > roma->size - a->addr) lena = roma->size - a->addr;
+		if (lenb > romb->size - b->addr) lenb = romb->size - b->addr;
+		len = (lena < lenb)? lena: lenb;
+
+		uint8_t *pa = RomView_Get(roma, a->addr, lena);
+		uint8_t *pb = RomView_Get(romb, b->addr, lenb);
+		struct diffranges_s d = { .first = true };
+		if (pa and pb)
+			Diff_Ranges(pa, pb, len, _diff_add_range, &d);
+		if (lena != lenb)
+			_diff_add_range(&d, len, (lena > lenb)? lena: lenb);
+		_diff_flush_range(&d);
+		if (pa) RomView_Put(roma, pa);
+		if (pb) RomView_Put(romb, pb);
+	}
+	printf("\n");
+}
+
+/*
+ * Line the fragments of two roms up by number, then by fingerprint for
+ * any left over, and report the differences. Byte ranges are offsets
+ * within the fragment, end exclusive.
+ */
+char *cmd_diff(int argc, char **argv)
+{
+	__label__ out_return, out_unmap_a, out_free;
+	struct MappedFile_s ma, mb;
+	struct RomView_s roma, romb;
+	struct fraginfo_s *fa = NULL, *fb = NULL;
+	size_t na, nb, iter, i;
+	struct u64map_s bynum = {0}, byfp = {0};
+	bool *useda = NULL, *usedb = NULL;
+	char *msg = NULL;
+
+	switch (argc) {
+	case 0 ... 3:
+		msg = "must specify two Pokemon Stadium roms";
+		goto out_return;
+	default:
+		break;
+	}
+
+	msg = _open_rom(argv[2], &ma, &roma);
+	if (msg) goto out_return;
+	msg = _open_rom(argv[3], &mb, &romb);
+	if (msg) goto out_unmap_a;
+
+	if (Frag_Search(&roma, &fa, &na) or Frag_Search(&romb, &fb, &nb)) {
+		msg = "Frag_Search oopsed";
+		goto out_free;
+	}
+
+	useda = calloc(na + 1, sizeof(*useda));
+	usedb = calloc(nb + 1, sizeof(*usedb));
+	if (!useda or !usedb or U64Map_Init(&bynum, na) or U64Map_Init(&byfp, na)) {
+		msg = "out of memory";
+		goto out_free;
+	}
+	for (i = 0; i < na; i++) {
+		U64Map_Put(&bynum, fa[i].num, i);
+		U64Map_Put(&byfp, fa[i].fingerprint, i);
+	}
+
+	printf("num_a,num_b,status,moved,resized,addr_a,addr_b,romsize_a,romsize_b,ramsize_a,ramsize_b,ranges\n");
+	for (size_t j = 0; j < nb; j++) {
+		iter = 0;
+		while (U64Map_Get(&bynum, fb[j].num, &iter, &i)) {
+			if (useda[i]) continue;
+			useda[i] = usedb[j] = true;
+			_diff_pair(&roma, &fa[i], &romb, &fb[j]);
+			break;
+		}
+	}
+	for (size_t j = 0; j < nb; j++) {
+		if (usedb[j]) continue;
+		iter = 0;
+		while (U64Map_Get(&byfp, fb[j].fingerprint, &iter, &i)) {
+			if (useda[i]) continue;
+			useda[i] = usedb[j] = true;
+			_diff_pair(&roma, &fa[i], &romb, &fb[j]);
+			break;
+		}
+	}
+	for (i = 0; i < na; i++) {
+		if (useda[i]) continue;
+		printf("%" PRId32 ",,removed,,,%" PRIu64 ",,%" PRIu32 ",,%" PRIu32 ",,\n",
+			fa[i].num, fa[i].addr, fa[i].romsize, fa[i].ramsize);
+	}
+	for (size_t j = 0; j < nb; j++) {
+		if (usedb[j]) continue;
+		printf(",%" PRId32 ",added,,,,%" PRIu64 ",,%" PRIu32 ",,%" PRIu32 ",\n",
+			fb[j].num, fb[j].addr, fb[j].romsize, fb[j].ramsize);
+	}
+
+out_free:
+	U64Map_Free(&bynum);
+	U64Map_Free(&byfp);
+	free(useda);
+	free(usedb);
+	free(fa);
+	free(fb);
+	MappedFile_Close(mb);
+out_unmap_a:
+	MappedFile_Close(ma);
+out_return:
+	return msg;
+}
+
+// rom ranges of one fragment that cmd_insert will patch, at most
+#define INSERT_MAX_REFS 4
+
+// a fragment to be written by cmd_insert
+struct insert_s {
+	struct MappedFile_s f;	// f.data is NULL if this one isn't replaced
+	uint8_t *data;		// normalized, header fixed up
+	uint32_t size;		// padded to 16 bytes
+	uint64_t addr;		// where it will be
+	uint32_t romsize;	// how big it will be
+	uint64_t refs[INSERT_MAX_REFS];	// rom offsets of its start/end pairs
+	bool ref_next[INSERT_MAX_REFS];	// the end is the next fragment's start
+	size_t num_refs;
+};
+
+/*
+ * Read a replacement fragment and check it. Its romsize is set to its
+ * padded length and ramsize is raised to at least that.
+ */
+static char *_insert_load(struct insert_s *ins, char *filename, int num)
+{
+	struct fragment_s hdr;
+	uint32_t romsize, ramsize;
+
+	ins->f = MappedFile_Open(filename, false);
+	if (!ins->f.data)
+		return "couldn't open fragment file";
+	if (ins->f.size < sizeof(struct fragment_s) or ins->f.size > 0x00FFFFFF)
+		return "fragment file has a bad size";
+
+	romsize = (ins->f.size + 15) & ~15;
+	ins->data = calloc(1, romsize);
+	if (!ins->data)
+		return "out of memory";
+	memcpy(ins->data, ins->f.data, ins->f.size);
+	ins->size = romsize;
+
+	memcpy(&hdr, ins->data, sizeof(hdr));
+	if (!isfrag(&hdr))
+		return "fragment file has no FRAGMENT header";
+	if (get_frag_num(&hdr) != num)
+		return "fragment file has a different fragment number";
+	if (ntohl(hdr.offset_relocs) >= romsize)
+		return "fragment file's relocations are out of bounds";
+
+	ramsize = ntohl(hdr.ramsize);
+	if (ramsize < romsize) ramsize = romsize;
+	hdr.romsize = htonl(romsize);
+	hdr.ramsize = htonl(ramsize);
+	memcpy(ins->data, &hdr, sizeof(hdr));
+	return NULL;
+}
+
+/*
+ * Find where the code before the fragments keeps the rom range of one:
+ * a pair of words, its start and then its end or the start of the
+ * fragment after it. code holds the rom from CHECKSUM_START on.
+ */
+static void _insert_find_refs(struct insert_s *ins, uint8_t *code, size_t len,
+	struct fraginfo_s *fi, uint64_t next)
+{
+	ins->num_refs = 0;
+	for (size_t off = 0; off + 8 <= len; off += 4) {
+		uint32_t pair[2];
+		bool is_next;
+
+		memcpy(pair, code + off, 8);
+		if (ntohl(pair[0]) != fi->addr) continue;
+		if (ntohl(pair[1]) == fi->addr + fi->romsize)
+			is_next = false;
+		else if (ntohl(pair[1]) == next)
+			is_next = true;
+		else
+			continue;
+		ins->refs[ins->num_refs] = CHECKSUM_START + off;
+		ins->ref_next[ins->num_refs] = is_next;
+		if (++ins->num_refs == INSERT_MAX_REFS) break;
+	}
+}
+
+/*
+ * Write replacement fragments into a rom in place.
+ *
+ * Each fragment's slot runs to the start of the next one (or the end of
+ * the last one). A replacement that doesn't fit is an error unless
+ * --relocate-layout is given. With it, every fragment from the first one
+ * that doesn't fit onward is packed back to back, into the space up to
+ * the end of the padding after the last fragment.
+ *
+ * The game finds fragments through a table of rom ranges in the code
+ * before them. Entries for fragments that move or grow are rewritten;
+ * a fragment that would move without one being found stops the insert
+ * before anything is written. CRC1 and CRC2 are worked out again when
+ * the first megabyte changed. The fragments that moved are listed once
+ * everything is written.
+ */
+char *cmd_insert(int argc, char **argv)
+{
+	__label__ out_return, out_unmap, out_free;
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct fraginfo_s *frags = NULL;
+	struct insert_s *ins = NULL;
+	size_t num_frags, i;
+	size_t first_moved;
+	bool relocate = false;
+	uint8_t *region = NULL;	// the packed fragments, when relocating
+	uint64_t region_start = 0, region_len = 0;
+	uint8_t *code = NULL;	// the rom before the fragments
+	size_t code_len = 0;
+	uint8_t *zero = NULL;
+	uint32_t zero_len = 0;
+	bool first_mb = false;	// something in the checksummed part changed
+	char *msg = NULL;
+	int nargs = argc;
+
+	if ((nargs > 2) and !strcmp(argv[nargs - 1], "--relocate-layout")) {
+		relocate = true;
+		nargs--;
+	}
+	switch (nargs) {
+	case 0 ... 2:
+		msg = "must specify a Pokemon Stadium rom";
+		goto out_return;
+	case 3 ... 4:
+		msg = "must specify a fragment number and a file";
+		goto out_return;
+	default:
+		if (nargs % 2 == 0) {
+			msg = "fragment numbers and files must come in pairs";
+			goto out_return;
+		}
+		break;
+	}
+
+	m = MappedFile_OpenFlags(argv[2], MAPFILE_WRITABLE | MAPFILE_SCAN);
+	if (m.data == NULL) {
+		msg = "couldn't open rom for writing";
+		goto out_return;
+	}
+	if (m.size < (1048576 + 4096)) {
+		msg = "rom too small";
+		goto out_unmap;
+	}
+	RomView_Init(&rom, m.data, m.size);
+
+	if (Frag_Search(&rom, &frags, &num_frags)) {
+		msg = "Frag_Search oopsed";
+		goto out_unmap;
+	}
+	ins = calloc(num_frags + 1, sizeof(*ins));
+	if (!ins) {
+		msg = "out of memory";
+		goto out_free;
+	}
+
+	for (int a = 3; a < nargs; a += 2) {
+		int num = atoi(argv[a]);
+		for (i = 0; i < num_frags; i++)
+			if (frags[i].num == num) break;
+		if (i == num_frags) {
+			msg = "no fragment by that number";
+			goto out_free;
+		}
+		if (ins[i].f.data) {
+			msg = "fragment given more than once";
+			goto out_free;
+		}
+		msg = _insert_load(&ins[i], argv[a + 1], num);
+		if (msg) goto out_free;
+	}
+
+	for (i = 0; i < num_frags; i++) {
+		ins[i].addr = frags[i].addr;
+		ins[i].romsize = ins[i].data? ins[i].size: frags[i].romsize;
+	}
+
+	// find the first replacement that doesn't fit its slot
+	first_moved = num_frags;
+	for (i = 0; i < num_frags; i++) {
+		uint64_t slot_end;
+		if (!ins[i].data) continue;
+		if (i + 1 < num_frags)
+			slot_end = frags[i+1].addr;
+		else
+			slot_end = (frags[i].addr + frags[i].romsize + 15) & ~15ULL;
+		if (frags[i].addr + ins[i].size <= slot_end) continue;
+		if (!relocate) {
+			fprintf(stderr, "fragment %d is %" PRIu32 " bytes, its slot is %" PRIu64 "\n",
+				frags[i].num, ins[i].size, slot_end - frags[i].addr);
+			msg = "fragment doesn't fit its slot (try --relocate-layout)";
+			goto out_free;
+		}
+		first_moved = i;
+		break;
+	}
+
+	if (first_moved < num_frags) {
+		uint64_t start = frags[first_moved].addr;
+		uint64_t end = frags[num_frags-1].addr + frags[num_frags-1].romsize;
+		uint64_t cursor = 0;
+		uint8_t fill;
+
+		// padding after the last fragment can be used as well
+		if (end > rom.size) end = rom.size;
+		while (end < rom.size) {
+			RomView_Read(&rom, &fill, end, 1);
+			if ((fill != 0x00) and (fill != 0xFF)) break;
+			end++;
+		}
+		end &= ~15ULL;
+
+		region_start = start;
+		region_len = end - start;
+		region = calloc(1, region_len);
+		if (!region) {
+			msg = "out of memory";
+			goto out_free;
+		}
+		for (i = first_moved; i < num_frags; i++) {
+			uint32_t size = ins[i].data? ins[i].size: frags[i].romsize;
+			if (cursor + size > region_len) {
+				msg = "fragments don't fit even with --relocate-layout";
+				goto out_free;
+			}
+			if (ins[i].data)
+				memcpy(region + cursor, ins[i].data, size);
+			else
+				RomView_Read(&rom, region + cursor, frags[i].addr, size);
+			ins[i].addr = start + cursor;
+			cursor = (cursor + size + 15) & ~15ULL;
+		}
+	}
+
+	// rom ranges of fragments that move or grow have to be found
+	if (num_frags and (frags[0].addr > CHECKSUM_START)) {
+		code_len = frags[0].addr - CHECKSUM_START;
+		code = RomView_Get(&rom, CHECKSUM_START, code_len);
+		if (!code) {
+			msg = "out of memory";
+			goto out_free;
+		}
+	}
+	for (i = 0; i < num_frags; i++) {
+		bool moved = ins[i].addr != frags[i].addr;
+		uint64_t next;
+
+		if (!moved and (ins[i].romsize <= frags[i].romsize)) continue;
+		next = (i + 1 < num_frags)? frags[i+1].addr:
+			frags[i].addr + frags[i].romsize;
+		_insert_find_refs(&ins[i], code, code? code_len: 0, &frags[i], next);
+		if (ins[i].num_refs or !moved) continue;
+		fprintf(stderr, "fragment %d: no rom range for it found before 0x%" PRIx64 "\n",
+			frags[i].num, code_len + CHECKSUM_START);
+		msg = "can't tell the game where moved fragments are, nothing written";
+		goto out_free;
+	}
+	for (i = 0; i < first_moved; i++)
+		if ((ins[i].romsize > frags[i].romsize) and !ins[i].num_refs)
+			fprintf(stderr, "warning: fragment %d grew, but no rom range for it was found\n",
+				frags[i].num);
+
+	for (i = 0; i < first_moved; i++)
+		if (ins[i].data and (ins[i].size < frags[i].romsize) and
+		    (frags[i].romsize - ins[i].size > zero_len))
+			zero_len = frags[i].romsize - ins[i].size;
+	zero = calloc(1, zero_len? zero_len: 1);
+	if (!zero) {
+		msg = "out of memory";
+		goto out_free;
+	}
+
+	// nothing has been written until here, so a failure leaves the rom as it was
+	for (i = 0; i < first_moved; i++) {
+		if (!ins[i].data) continue;
+		RomView_Write(&rom, frags[i].addr, ins[i].data, ins[i].size);
+		if (ins[i].size < frags[i].romsize)
+			RomView_Write(&rom, frags[i].addr + ins[i].size, zero,
+				frags[i].romsize - ins[i].size);
+		if (frags[i].addr < CHECKSUM_START + CHECKSUM_LENGTH)
+			first_mb = true;
+	}
+	if (region) {
+		RomView_Write(&rom, region_start, region, region_len);
+		if (region_start < CHECKSUM_START + CHECKSUM_LENGTH)
+			first_mb = true;
+	}
+	for (i = 0; i < num_frags; i++) {
+		for (size_t k = 0; k < ins[i].num_refs; k++) {
+			uint32_t pair[2];
+			uint64_t end = ins[i].addr + ins[i].romsize;
+			if (ins[i].ref_next[k])
+				end = (i + 1 < num_frags)? ins[i+1].addr: end;
+			pair[0] = htonl(ins[i].addr);
+			pair[1] = htonl(end);
+			RomView_Write(&rom, ins[i].refs[k], pair, sizeof(pair));
+			if (ins[i].refs[k] < CHECKSUM_START + CHECKSUM_LENGTH)
+				first_mb = true;
+		}
+	}
+	if (first_mb and (Checksum_Fix(&rom) <= 0))
+		fprintf(stderr, "warning: unknown boot code, CRC1 and CRC2 weren't updated\n");
+
+	for (i = first_moved; i < num_frags; i++)
+		if (ins[i].addr != frags[i].addr)
+			printf("fragment %d moved from 0x%" PRIx64 " to 0x%" PRIx64 "\n",
+				frags[i].num, frags[i].addr, ins[i].addr);
+
+out_free:
+	free(zero);
+	if (code) RomView_Put(&rom, code);
+	free(region);
+	for (i = 0; ins and (i < num_frags); i++) {
+		free(ins[i].data);
+		if (ins[i].f.data) MappedFile_Close(ins[i].f);
+	}
+	free(ins);
+	free(frags);
+out_unmap:
+	MappedFile_Close(m);
+out_return:
+	return msg;
+}
+
+char *cmd_verify(int argc, char **argv)
+{
+	__label__ out_return, out_unmap, out_free;
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct fraginfo_s *frags = NULL;
+	struct verify_totals_s t;
+	struct outbuf_s ob;
+	size_t num_frags;
+	char *msg = NULL;
+
+	if (argc < 3) {
+		msg = "must specify a Pokemon Stadium rom";
+		goto out_return;
+	}
+
+	msg = _open_rom(argv[2], &m, &rom);
+	if (msg) goto out_return;
+	if (Frag_Search(&rom, &frags, &num_frags)) {
+		msg = "Frag_Search oopsed";
+		goto out_unmap;
+	}
+
+	OutBuf_Init(&ob);
+	OutBuf_Puts(&ob, "num,addr,check,offset,value\n");
+	if (Verify_Frags(&ob, &rom, frags, num_frags, &t)) {
+		msg = "out of memory";
+		goto out_free;
+	}
+	if (OutBuf_Flush(&ob, stdout)) {
+		msg = "couldn't write report";
+		goto out_free;
+	}
+	fprintf(stderr, "%zu fragments, %zu relocations, %zu problems\n",
+		t.frags, t.relocs, t.problems);
+	if (t.problems)
+		msg = "verify failed";
+
+out_free:
+	OutBuf_Free(&ob);
+	free(frags);
+out_unmap:
+	MappedFile_Close(m);
+out_return:
+	return msg;
+}
+
+// fragments listed per round, so output can go out in order as it's made
+#define DISASM_BATCH 64
+
+struct disasm_s {
+	struct RomView_s *rom;
+	struct fraginfo_s *frags;
+	struct outbuf_s *out;
+};
+
+static void _disasm_worker(void *ctx, size_t index)
+{
+	struct disasm_s *d = ctx;
+	struct fraginfo_s *fi = &d->frags[index];
+	uint64_t len = fi->romsize;
+	uint8_t *p;
+
+	if (len > d->rom->size - fi->addr) len = d->rom->size - fi->addr;
+	p = RomView_Get(d->rom, fi->addr, len);
+	if (!p) {
+		d->out[index].error = true;
+		return;
+	}
+	Disasm_Frag(&d->out[index], p, len, fi);
+	RomView_Put(d->rom, p);
+}
+
+char *cmd_disasm(int argc, char **argv)
+{
+	__label__ out_return, out_unmap, out_free;
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct fraginfo_s *frags = NULL;
+	struct outbuf_s out[DISASM_BATCH];
+	size_t num_frags, i, n;
+	char *msg = NULL;
+
+	switch (argc) {
+	case 0 ... 2:
+		msg = "must specify a Pokemon Stadium rom";
+		goto out_return;
+	case 3:
+		msg = "must specify a fragment number or all";
+		goto out_return;
+	default:
+		break;
+	}
+
+	msg = _open_rom(argv[2], &m, &rom);
+	if (msg) goto out_return;
+
+	if (Frag_Search(&rom, &frags, &num_frags)) {
+		msg = "Frag_Search oopsed";
+		goto out_unmap;
+	}
+	if (strcmp(argv[3], "all")) {
+		int fragnum = atoi(argv[3]);
+		for (i = 0; i < num_frags; i++)
+			if (frags[i].num == fragnum) break;
+		if (i == num_frags) {
+			msg = "no fragment by that number";
+			goto out_free;
+		}
+		frags[0] = frags[i];
+		num_frags = 1;
+	}
+
+	for (i = 0; i < DISASM_BATCH; i++)
+		OutBuf_Init(&out[i]);
+	for (i = 0; i < num_frags; i += n) {
+		struct disasm_s d = { .rom = &rom, .frags = frags + i, .out = out };
+		n = num_frags - i;
+		if (n > DISASM_BATCH) n = DISASM_BATCH;
+		Pool_Run(n, _disasm_worker, &d);
+		for (size_t j = 0; j < n; j++)
+			if (OutBuf_Flush(&out[j], stdout) and !msg)
+				msg = "couldn't write listing";
+	}
+	for (i = 0; i < DISASM_BATCH; i++)
+		OutBuf_Free(&out[i]);
+
+out_free:
+	free(frags);
+out_unmap:
+	MappedFile_Close(m);
+out_return:
+	return msg;
+}
+
+// create a directory unless it's already there
+static int _make_dir(char *dir)
+{
+#ifdef __MINGW32__
+	if (mkdir(dir) and (errno != EEXIST)) return -1;
+#else
+	if (mkdir(dir, 0777) and (errno != EEXIST)) return -1;
+#endif
+	return 0;
+}
+
+struct export_s {
+	struct RomView_s *rom;
+	struct fraginfo_s *frags;
+	char *dir;
+	char *pcode;
+	bool elf;
+	char **errors;	// per fragment, NULL if it went fine
+	char *llvm_mc;	// assembler to check the .s files with, or NULL
+	char **objnames;	// per fragment, NULL if llvm-mc didn't get it
+	size_t *which;	// per llvm-mc job, the fragment it was for
+	int *status;	// per fragment, how llvm-mc exited
+};
+
+static void _export_worker(void *ctx, size_t index)
+{
+	struct export_s *e = ctx;
+	struct fraginfo_s *fi = &e->frags[index];
+	struct outbuf_s ob;
+	uint64_t len = fi->romsize;
+	char *name = NULL;
+	char why[128] = "out of memory";
+	uint8_t *p;
+	FILE *f;
+
+	if (len > e->rom->size - fi->addr) len = e->rom->size - fi->addr;
+	p = RomView_Get(e->rom, fi->addr, len);
+	if (!p) {
+		asprintf(&e->errors[index], "fragment %d: couldn't read it", fi->num);
+		return;
+	}
+	OutBuf_Init(&ob);
+	if (e->elf) {
+		if (Elf_Frag(&ob, p, len, fi, why, sizeof(why)))
+			asprintf(&e->errors[index], "fragment %d: %s", fi->num, why);
+	} else {
+		Disasm_FragAsm(&ob, p, len, fi);
+		if (ob.error or Asm_Verify(ob.p, ob.len, p, len, fi, why, sizeof(why)))
+			asprintf(&e->errors[index], "fragment %d: %s", fi->num, why);
+	}
+	RomView_Put(e->rom, p);
+
+	// written even if it didn't check out, to see what went wrong
+	if (asprintf(&name, "%s/%s-frag%03d.%s", e->dir, e->pcode, fi->num,
+		e->elf? "o": "s") != -1) {
+		f = fopen(name, e->elf? "wb": "w");
+		if (!f or OutBuf_Flush(&ob, f)) {
+			free(e->errors[index]);
+			e->errors[index] = NULL;
+			asprintf(&e->errors[index], "fragment %d: couldn't write %s",
+				fi->num, name);
+		}
+		if (f) fclose(f);
+		free(name);
+	}
+	OutBuf_Free(&ob);
+}
+
+static void _export_mc_done(void *ctx, size_t index, int status)
+{
+	struct export_s *e = ctx;
+	e->status[e->which[index]] = status;
+}
+
+// compare what llvm-mc made of a fragment's .s with the fragment
+static void _export_mc_worker(void *ctx, size_t index)
+{
+	__label__ out_remove;
+	struct export_s *e = ctx;
+	struct fraginfo_s *fi = &e->frags[index];
+	struct MappedFile_s obj;
+	uint64_t len = fi->romsize;
+	char why[128] = "out of memory";
+	uint8_t *p;
+
+	if (!e->objnames[index]) return;
+	if (e->status[index] != 0) {
+		asprintf(&e->errors[index], "fragment %d: %s failed (%d)",
+			fi->num, e->llvm_mc, e->status[index]);
+		goto out_remove;
+	}
+	obj = MappedFile_Open(e->objnames[index], false);
+	if (!obj.data) {
+		asprintf(&e->errors[index], "fragment %d: couldn't open %s",
+			fi->num, e->objnames[index]);
+		goto out_remove;
+	}
+	if (len > e->rom->size - fi->addr) len = e->rom->size - fi->addr;
+	p = RomView_Get(e->rom, fi->addr, len);
+	if (!p or Asm_VerifyObject(obj.data, obj.size, p, len, why, sizeof(why)))
+		asprintf(&e->errors[index], "fragment %d: %s: %s",
+			fi->num, e->llvm_mc, why);
+	if (p) RomView_Put(e->rom, p);
+	MappedFile_Close(obj);
+
+out_remove:
+	remove(e->objnames[index]);
+}
+
+/*
+ * Assemble each .s that checked out with llvm-mc too, as many at once as
+ * there are threads, and compare the objects with the fragments.
+ * Returns 0, or -1 if out of memory or llvm-mc couldn't be waited on.
+ */
+static int _export_mc(struct export_s *e, size_t num_frags)
+{
+	__label__ out_free;
+	char ***argvs;
+	char **names;
+	size_t i, num_jobs = 0;
+	int rc = -1;
+
+	argvs = calloc(num_frags + 1, sizeof(*argvs));
+	names = calloc(num_frags + 1, sizeof(*names));
+	e->objnames = calloc(num_frags + 1, sizeof(*e->objnames));
+	e->which = calloc(num_frags + 1, sizeof(*e->which));
+	e->status = calloc(num_frags + 1, sizeof(*e->status));
+	if (!argvs or !names or !e->objnames or !e->which or !e->status)
+		goto out_free;
+
+	for (i = 0; i < num_frags; i++) {
+		int num = e->frags[i].num;
+		if (e->errors[i]) continue;
+		if (asprintf(&names[num_jobs], "%s/%s-frag%03d.s", e->dir,
+			e->pcode, num) == -1) {
+			names[num_jobs] = NULL;
+			goto out_free;
+		}
+		if (asprintf(&e->objnames[i], "%s/%s-frag%03d.mc.o", e->dir,
+			e->pcode, num) == -1) {
+			e->objnames[i] = NULL;
+			goto out_free;
+		}
+		char *args[] = {
+			e->llvm_mc, "-triple=mips", "-filetype=obj",
+			"-o", e->objnames[i], names[num_jobs], NULL,
+		};
+		argvs[num_jobs] = malloc(sizeof(args));
+		if (!argvs[num_jobs]) goto out_free;
+		memcpy(argvs[num_jobs], args, sizeof(args));
+		e->which[num_jobs++] = i;
+	}
+
+	if (ProcPool_Run(argvs, num_jobs, Pool_Threads(), _export_mc_done, e))
+		goto out_free;
+	Pool_Run(num_frags, _export_mc_worker, e);
+	rc = 0;
+
+out_free:
+	for (i = 0; i <= num_jobs; i++) {
+		if (names) free(names[i]);
+		if (argvs) free(argvs[i]);
+	}
+	for (i = 0; e->objnames and (i < num_frags); i++) {
+		if (rc and e->objnames[i]) remove(e->objnames[i]);
+		free(e->objnames[i]);
+	}
+	free(e->objnames);
+	free(e->which);
+	free(e->status);
+	free(names);
+	free(argvs);
+	return rc;
+}
+
+char *_cmd_export_aux(int argc, char **argv, bool elf)
+{
+	__label__ out_return, out_unmap, out_free;
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct fraginfo_s *frags = NULL;
+	struct export_s e = { .elf = elf };
+	size_t num_frags, i, failed = 0;
+	char *msg = NULL;
+	char pcode[6];
+
+	if (argc < 3) {
+		msg = "must specify a Pokemon Stadium rom";
+		goto out_return;
+	}
+	for (int arg = 3; arg < argc; arg++) {
+		if (!elf and !strcmp(argv[arg], "--llvm-mc")) {
+			e.llvm_mc = getenv("PSFRAG_LLVM_MC");
+			if (!e.llvm_mc or !*e.llvm_mc) e.llvm_mc = LLVM_MC;
+		} else if ((argv[arg][0] == '-') or e.dir) {
+			msg = "unknown option";
+			goto out_return;
+		} else {
+			e.dir = argv[arg];
+		}
+	}
+	if (!e.dir) e.dir = ".";
+	if (_make_dir(e.dir)) {
+		msg = "couldn't create output directory";
+		goto out_return;
+	}
+
+	msg = _open_rom(argv[2], &m, &rom);
+	if (msg) goto out_return;
+	get_pcode(pcode, rom.header);
+
+	if (Frag_Search(&rom, &frags, &num_frags)) {
+		msg = "Frag_Search oopsed";
+		goto out_unmap;
+	}
+	// fragments without a number have nowhere to go
+	size_t n = 0;
+	for (i = 0; i < num_frags; i++)
+		if (frags[i].num >= 0) frags[n++] = frags[i];
+	num_frags = n;
+
+	e.rom = &rom;
+	e.frags = frags;
+	e.pcode = pcode;
+	e.errors = calloc(num_frags + 1, sizeof(*e.errors));
+	if (!e.errors) {
+		msg = "out of memory";
+		goto out_free;
+	}
+	Pool_Run(num_frags, _export_worker, &e);
+	if (e.llvm_mc and _export_mc(&e, num_frags))
+		msg = "couldn't run llvm-mc";
+
+	for (i = 0; i < num_frags; i++) {
+		if (!e.errors[i]) continue;
+		fprintf(stderr, "%s\n", e.errors[i]);
+		free(e.errors[i]);
+		failed++;
+	}
+	free(e.errors);
+	fprintf(stderr, "%zu fragments written to %s, %zu %s\n",
+		num_frags, e.dir, num_frags - failed,
+		elf? "without errors": "reassembled");
+	if (!msg and failed) msg = elf? "some fragments couldn't be written":
+		"some fragments didn't reassemble";
+
+out_free:
+	free(frags);
+out_unmap:
+	MappedFile_Close(m);
+out_return:
+	return msg;
+}
+
+char *cmd_export_asm(int argc, char **argv)
+{
+	return _cmd_export_aux(argc, argv, false);
+}
+
+char *cmd_export_elf(int argc, char **argv)
+{
+	return _cmd_export_aux(argc, argv, true);
+}
+
+enum {
+	FCOL_PCODE, FCOL_ADDR, FCOL_NUM, FCOL_ENTRYPOINT, FCOL_OFFSET_CODE,
+	FCOL_OFFSET_RELOCS, FCOL_ROMSIZE, FCOL_RAMSIZE, FCOL_VMA, FCOL_HASH,
+	FCOL_FINGERPRINT, FCOL_MAX
+};
+
+enum {
+	RCOL_PCODE, RCOL_FRAGNUM, RCOL_IDX, RCOL_RELOC, RCOL_FAR, RCOL_TYPE,
+	RCOL_ADDR, RCOL_TARGET_ADDR, RCOL_TARGET_FRAG, RCOL_MAX
+};
+
+// the columns of frags and relocs, filled from a rom or a database
+struct columns_s {
+	struct column_s frags[FCOL_MAX];
+	struct column_s relocs[RCOL_MAX];
+};
+
+static void _columns_init(struct columns_s *c)
+{
+	Column_Init(&c->frags[FCOL_PCODE], "pcode", COLUMN_CHARS, 5);
+	Column_Init(&c->frags[FCOL_ADDR], "addr", COLUMN_UINT, 8);
+	Column_Init(&c->frags[FCOL_NUM], "num", COLUMN_INT, 4);
+	Column_Init(&c->frags[FCOL_ENTRYPOINT], "entrypoint", COLUMN_UINT, 4);
+	Column_Init(&c->frags[FCOL_OFFSET_CODE], "offset_code", COLUMN_UINT, 4);
+	Column_Init(&c->frags[FCOL_OFFSET_RELOCS], "offset_relocs", COLUMN_UINT, 4);
+	Column_Init(&c->frags[FCOL_ROMSIZE], "romsize", COLUMN_UINT, 4);
+	Column_Init(&c->frags[FCOL_RAMSIZE], "ramsize", COLUMN_UINT, 4);
+	Column_Init(&c->frags[FCOL_VMA], "vma", COLUMN_UINT, 4);
+	Column_Init(&c->frags[FCOL_HASH], "hash", COLUMN_UINT, 8);
+	Column_Init(&c->frags[FCOL_FINGERPRINT], "fingerprint", COLUMN_UINT, 8);
+
+	// target_addr is all ones, and target_frag -2, if it can't be decoded
+	Column_Init(&c->relocs[RCOL_PCODE], "pcode", COLUMN_CHARS, 5);
+	Column_Init(&c->relocs[RCOL_FRAGNUM], "fragnum", COLUMN_INT, 4);
+	Column_Init(&c->relocs[RCOL_IDX], "idx", COLUMN_UINT, 4);
+	Column_Init(&c->relocs[RCOL_RELOC], "reloc", COLUMN_UINT, 4);
+	Column_Init(&c->relocs[RCOL_FAR], "far", COLUMN_UINT, 1);
+	Column_Init(&c->relocs[RCOL_TYPE], "type", COLUMN_UINT, 1);
+	Column_Init(&c->relocs[RCOL_ADDR], "addr", COLUMN_UINT, 4);
+	Column_Init(&c->relocs[RCOL_TARGET_ADDR], "target_addr", COLUMN_UINT, 4);
+	Column_Init(&c->relocs[RCOL_TARGET_FRAG], "target_frag", COLUMN_INT, 4);
+}
+
+static void _columns_free(struct columns_s *c)
+{
+	for (int i = 0; i < FCOL_MAX; i++) Column_Free(&c->frags[i]);
+	for (int i = 0; i < RCOL_MAX; i++) Column_Free(&c->relocs[i]);
+}
+
+static void _columns_add_frag(struct columns_s *c, char *pcode,
+	struct fraginfo_s *fi)
+{
+	Column_PutChars(&c->frags[FCOL_PCODE], pcode);
+	Column_Put(&c->frags[FCOL_ADDR], fi->addr);
+	Column_Put(&c->frags[FCOL_NUM], fi->num);
+	Column_Put(&c->frags[FCOL_ENTRYPOINT], fi->entrypoint);
+	Column_Put(&c->frags[FCOL_OFFSET_CODE], fi->offset_code);
+	Column_Put(&c->frags[FCOL_OFFSET_RELOCS], fi->offset_relocs);
+	Column_Put(&c->frags[FCOL_ROMSIZE], fi->romsize);
+	Column_Put(&c->frags[FCOL_RAMSIZE], fi->ramsize);
+	Column_Put(&c->frags[FCOL_VMA], fi->vma);
+	Column_Put(&c->frags[FCOL_HASH], fi->hash);
+	Column_Put(&c->frags[FCOL_FINGERPRINT], fi->fingerprint);
+}
+
+static void _columns_add_relocs(struct columns_s *c, char *pcode, int num,
+	uint8_t *bytes, size_t size)
+{
+	uint8_t *table;
+	uint32_t num_relocs;
+
+	table = Reloc_Table(bytes, size, &num_relocs);
+	for (uint32_t i = 0; i < num_relocs; i++) {
+		struct reloc_s r;
+		uint32_t reloc = Reloc_Get(table, i);
+		Reloc_Decode(&r, reloc, bytes, size);
+		Column_PutChars(&c->relocs[RCOL_PCODE], pcode);
+		Column_Put(&c->relocs[RCOL_FRAGNUM], num);
+		Column_Put(&c->relocs[RCOL_IDX], i);
+		Column_Put(&c->relocs[RCOL_RELOC], reloc);
+		Column_Put(&c->relocs[RCOL_FAR], r.foreign);
+		Column_Put(&c->relocs[RCOL_TYPE], r.type >> 24);
+		Column_Put(&c->relocs[RCOL_ADDR], r.addr);
+		Column_Put(&c->relocs[RCOL_TARGET_ADDR], r.loc);
+		Column_Put(&c->relocs[RCOL_TARGET_FRAG], r.target_frag);
+	}
+}
+
+static char *_columns_from_rom(struct columns_s *c, char *filename)
+{
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct fraginfo_s *frags;
+	size_t num_frags;
+	char pcode[6] = {0};
+	char *msg;
+
+	msg = _open_rom(filename, &m, &rom);
+	if (msg) return msg;
+	get_pcode(pcode, rom.header);
+	if (Frag_Search(&rom, &frags, &num_frags)) {
+		MappedFile_Close(m);
+		return "Frag_Search oopsed";
+	}
+	for (size_t i = 0; i < num_frags; i++) {
+		uint64_t len = frags[i].romsize;
+		uint8_t *p;
+
+		_columns_add_frag(c, pcode, &frags[i]);
+		if (len > rom.size - frags[i].addr) len = rom.size - frags[i].addr;
+		p = RomView_Get(&rom, frags[i].addr, len);
+		if (!p) {
+			msg = "couldn't read fragment";
+			break;
+		}
+		_columns_add_relocs(c, pcode, frags[i].num, p, len);
+		RomView_Put(&rom, p);
+	}
+	free(frags);
+	MappedFile_Close(m);
+	return msg;
+}
+
+// relocations come from stored payloads, so need mkdb --with-blobs
+static char *_columns_from_db(struct columns_s *c, char *filename)
+{
+	__label__ out_finalize;
+	sqlite3_stmt *stmt;
+	char *msg;
+	int rc;
+
+	msg = _open_db(filename);
+	if (msg) return msg;
+	rc = sqlite3_prepare_v2(db,
+		"select f.pcode, f.addr, f.num, f.entrypoint, f.offset_code, f.offset_relocs, f.romsize, f.ramsize, f.vma, f.hash, f.fingerprint, b.data from frags f left join blobs b on b.hash=f.hash order by f.pcode, f.addr;",
+		-1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		DB_Close(db);
+		return "not a database made by mkdb";
+	}
+	size_t no_blob = 0;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		struct fraginfo_s fi = {
+			.addr = sqlite3_column_int64(stmt, 1),
+			.num = sqlite3_column_int64(stmt, 2),
+			.entrypoint = sqlite3_column_int64(stmt, 3),
+			.offset_code = sqlite3_column_int64(stmt, 4),
+			.offset_relocs = sqlite3_column_int64(stmt, 5),
+			.romsize = sqlite3_column_int64(stmt, 6),
+			.ramsize = sqlite3_column_int64(stmt, 7),
+			.vma = sqlite3_column_int64(stmt, 8),
+			.hash = sqlite3_column_int64(stmt, 9),
+			.fingerprint = sqlite3_column_int64(stmt, 10),
+		};
+		char pcode[6] = {0};
+		snprintf(pcode, sizeof(pcode), "%s", sqlite3_column_text(stmt, 0));
+		_columns_add_frag(c, pcode, &fi);
+		if (sqlite3_column_type(stmt, 11) != SQLITE_BLOB) {
+			no_blob++;
+			continue;
+		}
+		_columns_add_relocs(c, pcode, fi.num,
+			(uint8_t *)sqlite3_column_blob(stmt, 11),
+			sqlite3_column_bytes(stmt, 11));
+	}
+	if (rc != SQLITE_DONE) {
+		msg = "couldn't read database";
+		goto out_finalize;
+	}
+	if (no_blob)
+		fprintf(stderr, "%zu fragments have no payload stored, "
+			"so their relocations are left out\n", no_blob);
+
+out_finalize:
+	sqlite3_finalize(stmt);
+	DB_Close(db);
+	return msg;
+}
+
+char *cmd_export_columns(int argc, char **argv)
+{
+	__label__ out_return, out_free;
+	struct columns_s c;
+	char magic[16] = {0};
+	char *msg = NULL;
+	FILE *f;
+
+	switch (argc) {
+	case 0 ... 2:
+		msg = "must specify a rom or database";
+		goto out_return;
+	case 3:
+		msg = "must specify a directory";
+		goto out_return;
+	default:
+		break;
+	}
+
+	// databases are told apart from roms by their header
+	f = fopen(argv[2], "rb");
+	if (!f) {
+		msg = "couldn't open input";
+		goto out_return;
+	}
+	// too short to be either
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic)) {
+		fclose(f);
+		msg = "couldn't read input";
+		goto out_return;
+	}
+	fclose(f);
+
+	_columns_init(&c);
+	if (!memcmp(magic, "SQLite format 3", 16))
+		msg = _columns_from_db(&c, argv[2]);
+	else
+		msg = _columns_from_rom(&c, argv[2]);
+	if (msg) goto out_free;
+
+	if (_make_dir(argv[3])) {
+		msg = "couldn't create directory";
+		goto out_free;
+	}
+	for (int i = 0; i < FCOL_MAX; i++)
+		if (Column_Write(&c.frags[i], argv[3], "frags"))
+			msg = "couldn't write column";
+	for (int i = 0; i < RCOL_MAX; i++)
+		if (Column_Write(&c.relocs[i], argv[3], "relocs"))
+			msg = "couldn't write column";
+
+out_free:
+	_columns_free(&c);
+out_return:
+	return msg;
+}
+
+// bytes of trace read at a time, and of output held before writing
+#define SYMBOLIZE_BLOCK (1048576)
+
+static int8_t _hexval[256];
+
+/*
+ * The first run of 8 hex digits in a line, or of 16 if it's a sign
+ * extended 32 bit address as 64 bit emulators print them.
+ */
+static bool _find_addr(char *p, char *end, uint32_t *addr)
+{
+	while (p < end) {
+		char *run = p;
+		uint64_t v = 0;
+		while ((p < end) and (_hexval[(uint8_t)*p] >= 0))
+			v = (v << 4) | _hexval[(uint8_t)*p++];
+		if ((p - run == 8) or ((p - run == 16)
+			and (((v >> 32) == 0xFFFFFFFF) or ((v >> 32) == 0)))) {
+			*addr = v;
+			return true;
+		}
+		if (p == run) p++;
+	}
+	return false;
+}
+
+static void _symbolize_line(struct symindex_s *si, struct outbuf_s *ob,
+	char *line, char *end)
+{
+	struct fraginfo_s *fi;
+	struct sym_s *sym;
+	uint32_t addr, ambiguous;
+
+	OutBuf_Write(ob, line, end - line);
+	if (!_find_addr(line, end, &addr)) {
+		OutBuf_Putc(ob, '\n');
+		return;
+	}
+	fi = SymIndex_Lookup(si, addr, &ambiguous);
+	OutBuf_Putc(ob, '\t');
+	if (fi) {
+		OutBuf_Puts(ob, "frag");
+		if (fi->num < 100) OutBuf_Putc(ob, '0');
+		if (fi->num < 10) OutBuf_Putc(ob, '0');
+		OutBuf_Dec(ob, fi->num);
+		OutBuf_Puts(ob, "+0x");
+		OutBuf_Hex(ob, addr - fi->vma, 1);
+		if (ambiguous > 1) OutBuf_Putc(ob, '?');
+	} else {
+		OutBuf_Putc(ob, '-');
+	}
+	sym = SymIndex_Symbol(si, addr, fi);
+	if (sym) {
+		OutBuf_Putc(ob, ' ');
+		OutBuf_Puts(ob, sym->name);
+		OutBuf_Puts(ob, "+0x");
+		OutBuf_Hex(ob, addr - sym->addr, 1);
+	}
+	OutBuf_Putc(ob, '\n');
+}
+
+char *cmd_symbolize(int argc, char **argv)
+{
+	__label__ out_return, out_unmap, out_free;
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct fraginfo_s *frags = NULL;
+	struct symindex_s si = {0};
+	struct outbuf_s ob;
+	size_t num_frags;
+	int *loaded = NULL;
+	size_t num_loaded = 0;
+	char *trace = NULL, *symfile = NULL, *buf = NULL;
+	char *msg = NULL;
+	int fd = STDIN_FILENO;
+
+	// freed on every way out, option errors included
+	OutBuf_Init(&ob);
+	if (argc < 3) {
+		msg = "must specify a Pokemon Stadium rom";
+		goto out_return;
+	}
+	for (int arg = 3; arg < argc; arg++) {
+		if (!strcmp(argv[arg], "--symbols") and (arg + 1 < argc)) {
+			symfile = argv[++arg];
+		} else if (!strcmp(argv[arg], "--loaded") and (arg + 1 < argc)) {
+			char *p = argv[++arg];
+			while (*p) {
+				int *l = realloc(loaded, (num_loaded + 1) * sizeof(*loaded));
+				if (!l) {
+					msg = "out of memory";
+					goto out_return;
+				}
+				loaded = l;
+				loaded[num_loaded++] = strtol(p, &p, 0);
+				if (*p == ',') p++;
+				else if (*p) {
+					msg = "--loaded takes fragment numbers separated by commas";
+					goto out_return;
+				}
+			}
+		} else if (!trace) {
+			trace = argv[arg];
+		} else {
+			msg = "unknown option";
+			goto out_return;
+		}
+	}
+
+	msg = _open_rom(argv[2], &m, &rom);
+	if (msg) goto out_return;
+	if (Frag_Search(&rom, &frags, &num_frags)) {
+		msg = "Frag_Search oopsed";
+		goto out_unmap;
+	}
+	if (SymIndex_Build(&si, frags, num_frags,
+		Frag_Intervals(&rom, num_frags), loaded, num_loaded)) {
+		msg = "out of memory";
+		goto out_free;
+	}
+	if (symfile and SymIndex_LoadSymbols(&si, symfile)) {
+		msg = "couldn't read symbol file";
+		goto out_free;
+	}
+	if (trace and strcmp(trace, "-")) {
+		fd = open(trace, O_RDONLY | O_BINARY);
+		if (fd < 0) {
+			msg = "couldn't open trace";
+			goto out_free;
+		}
+	}
+
+	memset(_hexval, -1, sizeof(_hexval));
+	for (int i = 0; i < 10; i++) _hexval['0' + i] = i;
+	for (int i = 0; i < 6; i++) _hexval['a' + i] = _hexval['A' + i] = 10 + i;
+
+	// whole lines are handled, and a partial one is kept for the next read
+	buf = malloc(SYMBOLIZE_BLOCK + 1);
+	if (!buf) {
+		msg = "out of memory";
+		goto out_free;
+	}
+	size_t len = 0;
+	bool passing = false;	// in a line longer than the buffer
+	for (;;) {
+		ssize_t got = read(fd, buf + len, SYMBOLIZE_BLOCK - len);
+		if (got < 0) {
+			if (errno == EINTR) continue;
+			msg = "couldn't read trace";
+			break;
+		}
+		len += got;
+		char *p = buf, *end = buf + len;
+		// a line longer than the buffer is passed through as is
+		if (passing) {
+			char *nl = memchr(p, '\n', end - p);
+			if (nl) {
+				OutBuf_Write(&ob, p, nl + 1 - p);
+				p = nl + 1;
+				passing = false;
+			} else {
+				OutBuf_Write(&ob, p, end - p);
+				p = end;
+			}
+		}
+		for (;;) {
+			char *nl = memchr(p, '\n', end - p);
+			if (!nl) break;
+			_symbolize_line(&si, &ob, p, nl);
+			p = nl + 1;
+		}
+		if ((p == buf) and (len == SYMBOLIZE_BLOCK)) {
+			OutBuf_Write(&ob, buf, len);
+			p = end;
+			passing = true;
+		}
+		len = end - p;
+		memmove(buf, p, len);
+		if ((ob.len >= SYMBOLIZE_BLOCK) or (got == 0)) {
+			if (got == 0 and len) {
+				_symbolize_line(&si, &ob, buf, buf + len);
+				len = 0;
+			} else if (got == 0 and passing) {
+				OutBuf_Putc(&ob, '\n');
+			}
+			if (OutBuf_Flush(&ob, stdout)) {
+				msg = "couldn't write output";
+				break;
+			}
+		}
+		if (got == 0) break;
+	}
+	fflush(stdout);
+	if (fd != STDIN_FILENO) close(fd);
+
+out_free:
+	free(buf);
+	SymIndex_Free(&si);
+	free(frags);
+out_unmap:
+	MappedFile_Close(m);
+out_return:
+	OutBuf_Free(&ob);
+	free(loaded);
+	return msg;
+}
+
+char *cmd_identify_ram(int argc, char **argv)
+{
+	__label__ out_return, out_unmap, out_unmap_ram, out_free;
+	struct MappedFile_s m, mr;
+	struct RomView_s rom;
+	struct fraginfo_s *frags = NULL;
+	struct ramhit_s *hits = NULL;
+	size_t num_frags, num_hits;
+	uint8_t *ram = NULL;
+	unsigned threshold = 90;
+	char *msg = NULL;
+
+	switch (argc) {
+	case 0 ... 2:
+		msg = "must specify a Pokemon Stadium rom";
+		goto out_return;
+	case 3:
+		msg = "must specify a ram dump";
+		goto out_return;
+	default:
+		break;
+	}
+	for (int arg = 4; arg < argc; arg++) {
+		if (!strcmp(argv[arg], "--threshold") and (arg + 1 < argc)) {
+			threshold = atoi(argv[++arg]);
+		} else {
+			msg = "unknown option";
+			goto out_return;
+		}
+	}
+
+	msg = _open_rom(argv[2], &m, &rom);
+	if (msg) goto out_return;
+	mr = MappedFile_OpenFlags(argv[3], MAPFILE_SCAN);
+	if (mr.data == NULL) {
+		msg = "couldn't open ram dump";
+		goto out_unmap;
+	}
+	if (Frag_Search(&rom, &frags, &num_frags)) {
+		msg = "Frag_Search oopsed";
+		goto out_unmap_ram;
+	}
+
+	// the scan wants big-endian words, like the rom view gives
+	enum rom_order_e order = Ram_DetectOrder(mr.data, mr.size);
+	ram = malloc(mr.size? mr.size: 1);
+	if (!ram) {
+		msg = "out of memory";
+		goto out_free;
+	}
+	RomView_Swap(ram, mr.data, mr.size & ~3, order);
+	if (Ram_Identify(ram, mr.size & ~3, &rom, frags, num_frags,
+		&hits, &num_hits)) {
+		msg = "out of memory";
+		goto out_free;
+	}
+
+	fprintf(stderr, "ram dump is %s\n", RomView_OrderName(order));
+	printf("num,offset,address,matched,total\n");
+	for (size_t i = 0; i < num_hits; i++) {
+		struct ramhit_s *h = &hits[i];
+		if ((uint64_t)h->matched * 100 < (uint64_t)h->total * threshold)
+			continue;
+		printf("%" PRId32 ",%" PRIu64 ",%08" PRIx64 ",%" PRIu32 ",%" PRIu32 "\n",
+			frags[h->frag].num, h->offset,
+			(0x80000000 + h->offset) & 0xFFFFFFFF,
+			h->matched, h->total);
+	}
+
+out_free:
+	free(hits);
+	free(ram);
+	free(frags);
+out_unmap_ram:
+	MappedFile_Close(mr);
+out_unmap:
+	MappedFile_Close(m);
+out_return:
+	return msg;
+}
+
+// rows are written out once this much has been buffered
+#define QUERY_BLOCK (1048576)
+
+// which of the tables psfrag fills in a statement reads
+struct query_tables_s {
+	bool frags;
+	bool relocs;
+};
+
+static int _query_auth(void *ctx, int action, const char *table,
+	const char *column, const char *schema, const char *trigger)
+{
+	struct query_tables_s *t = ctx;
+
+	// a count(*) reads the table without naming a schema
+	if ((action != SQLITE_READ) or !table or (schema and strcmp(schema, "main")))
+		return SQLITE_OK;
+	if (!strcmp(table, "frags")) t->frags = true;
+	if (!strcmp(table, "relocs")) t->relocs = true;
+	return SQLITE_OK;
+}
+
+static void _query_text(struct outbuf_s *ob, const char *p, int len, bool json)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	if (!json and !strpbrk(p, ",\"\r\n")) {
+		OutBuf_Write(ob, p, len);
+		return;
+	}
+	OutBuf_Putc(ob, '"');
+	for (int i = 0; i < len; i++) {
+		unsigned char c = p[i];
+		if (c == '"') {
+			OutBuf_Puts(ob, json? "\\\"": "\"\"");
+		} else if (json and (c == '\\')) {
+			OutBuf_Puts(ob, "\\\\");
+		} else if (json and (c < 0x20)) {
+			OutBuf_Puts(ob, "\\u00");
+			OutBuf_Putc(ob, hex[c >> 4]);
+			OutBuf_Putc(ob, hex[c & 15]);
+		} else {
+			OutBuf_Putc(ob, c);
+		}
+	}
+	OutBuf_Putc(ob, '"');
+}
+
+static void _query_value(struct outbuf_s *ob, sqlite3_stmt *stmt, int col,
+	bool json)
+{
+	switch (sqlite3_column_type(stmt, col)) {
+	case SQLITE_INTEGER:
+		OutBuf_Dec(ob, sqlite3_column_int64(stmt, col));
+		break;
+	case SQLITE_FLOAT: {
+		double d = sqlite3_column_double(stmt, col);
+		// JSON has no nan or inf
+		if (json and !isfinite(d))
+			OutBuf_Puts(ob, "null");
+		else
+			OutBuf_Printf(ob, "%.17g", d);
+		break;
+	}
+	case SQLITE_TEXT:
+		_query_text(ob, (const char *)sqlite3_column_text(stmt, col),
+			sqlite3_column_bytes(stmt, col), json);
+		break;
+	case SQLITE_BLOB: {
+		// as hex
+		const uint8_t *p = sqlite3_column_blob(stmt, col);
+		int len = sqlite3_column_bytes(stmt, col);
+		if (json) OutBuf_Putc(ob, '"');
+		for (int i = 0; i < len; i++)
+			OutBuf_Hex(ob, p[i], 2);
+		if (json) OutBuf_Putc(ob, '"');
+		break;
+	}
+	default:
+		if (json) OutBuf_Puts(ob, "null");
+		break;
+	}
+}
+
+char *cmd_query(int argc, char **argv)
+{
+	__label__ out_return, out_dbclose, out_unmap, out_free;
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct fraginfo_s *frags = NULL;
+	size_t num_frags = 0;
+	bool have_frags = false, have_relocs = false, json = false;
+	struct query_tables_s used = {0};
+	struct outbuf_s ob;
+	sqlite3_stmt *stmt = NULL;
+	const char *sql, *tail;
+	char pcode[6] = {0};
+	char *msg = NULL;
+	int rc;
+
+	switch (argc) {
+	case 0 ... 2:
+		msg = "must specify a Pokemon Stadium rom";
+		goto out_return;
+	case 3:
+		msg = "must specify some SQL";
+		goto out_return;
+	default:
+		break;
+	}
+	for (int arg = 4; arg < argc; arg++) {
+		if (!strcmp(argv[arg], "--json")) {
+			json = true;
+		} else {
+			msg = "unknown option";
+			goto out_return;
+		}
+	}
+
+	rc = DB_Init(&db, ":memory:");
+	if (rc != SQLITE_OK) {
+		msg = "DB_Init oopsed";
+		goto out_return;
+	}
+	msg = _open_rom(argv[2], &m, &rom);
+	if (msg) goto out_dbclose;
+	get_pcode(pcode, rom.header);
+
+	/*
+	 * Both tables exist but start out empty. The authorizer sees which
+	 * ones a statement reads when it's prepared, and only those are
+	 * filled before it runs.
+	 */
+	rc = sqlite3_exec(db,
+		"create table relocs(reloc_id integer primary key, pcode, fragnum, far, type, addr, target_addr, target_frag);",
+		NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		msg = "couldn't create relocs table";
+		goto out_unmap;
+	}
+	sqlite3_set_authorizer(db, _query_auth, &used);
+
+	OutBuf_Init(&ob);
+	if (json) OutBuf_Puts(&ob, "[");
+	bool first_row = true;
+	for (sql = argv[3]; *sql; sql = tail) {
+		rc = sqlite3_prepare_v2(db, sql, -1, &stmt, &tail);
+		if (rc != SQLITE_OK) {
+			fprintf(stderr, "%s\n", sqlite3_errmsg(db));
+			msg = "couldn't prepare query";
+			goto out_free;
+		}
+		if (!stmt) continue;	// just whitespace or a comment
+
+		sqlite3_set_authorizer(db, NULL, NULL);
+		if ((used.frags or used.relocs) and !frags) {
+			if (Frag_Search(&rom, &frags, &num_frags)) {
+				msg = "Frag_Search oopsed";
+				goto out_free;
+			}
+		}
+		if (used.frags and !have_frags) {
+			have_frags = true;
+			DB_Begin(db);
+			rc = DB_AddFrags(db, pcode, frags, num_frags);
+			DB_End(db);
+			if (rc != SQLITE_OK) {
+				msg = "couldn't fill frags table";
+				goto out_free;
+			}
+		}
+		if (used.relocs and !have_relocs) {
+			have_relocs = true;
+			if (DB_AddRelocs(db, pcode, &rom, frags, num_frags) != SQLITE_OK) {
+				msg = "couldn't fill relocs table";
+				goto out_free;
+			}
+		}
+		sqlite3_set_authorizer(db, _query_auth, &used);
+
+		int cols = sqlite3_column_count(stmt);
+		if (!json and cols) {
+			for (int i = 0; i < cols; i++) {
+				const char *name = sqlite3_column_name(stmt, i);
+				if (i) OutBuf_Putc(&ob, ',');
+				_query_text(&ob, name, strlen(name), false);
+			}
+			OutBuf_Putc(&ob, '\n');
+		}
+		while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+			if (json) {
+				OutBuf_Puts(&ob, first_row? "\n{": ",\n{");
+				first_row = false;
+			}
+			for (int i = 0; i < cols; i++) {
+				if (i) OutBuf_Putc(&ob, ',');
+				if (json) {
+					const char *name = sqlite3_column_name(stmt, i);
+					_query_text(&ob, name, strlen(name), true);
+					OutBuf_Putc(&ob, ':');
+				}
+				_query_value(&ob, stmt, i, json);
+			}
+			OutBuf_Puts(&ob, json? "}": "\n");
+			if ((ob.len >= QUERY_BLOCK) and OutBuf_Flush(&ob, stdout)) {
+				msg = "couldn't write output";
+				goto out_free;
+			}
+		}
+		if (rc != SQLITE_DONE) {
+			fprintf(stderr, "%s\n", sqlite3_errmsg(db));
+			msg = "query failed";
+			goto out_free;
+		}
+		sqlite3_finalize(stmt);
+		stmt = NULL;
+	}
+	if (json) OutBuf_Puts(&ob, "\n]\n");
+	if (OutBuf_Flush(&ob, stdout))
+		msg = "couldn't write output";
+
+out_free:
+	sqlite3_finalize(stmt);
+	OutBuf_Free(&ob);
+	free(frags);
+out_unmap:
+	MappedFile_Close(m);
+out_dbclose:
+	DB_Close(db);
+out_return:
+	return msg;
+}
+
+char *cmd_index(int argc, char **argv)
 {
-	__label__ out_return;
+	__label__ out_return, out_unmap;
 	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct fraginfo_s *frags = NULL;
+	size_t num_frags;
+	char *out = NULL;
 	char *msg = NULL;
-	int rc;
 
 	if (argc < 3) {
-		msg = "must specify a pokemon stadium rom";
+		msg = "must specify a Pokemon Stadium rom";
 		goto out_return;
 	}
-
-	rc = DB_Init(&db, ":memory:");
-	if (rc != SQLITE_OK) {
-		msg = "DB_Init oopsed";
+	if (argc > 3)
+		out = strdup(argv[3]);
+	else if (asprintf(&out, "%s.psfidx", argv[2]) == -1)
+		out = NULL;
+	if (!out) {
+		msg = "out of memory";
 		goto out_return;
 	}
 
-	m = MappedFile_Open(argv[2], false);
-	if (m.data == NULL) {
-		msg = "couldn't open rom";
-		goto out_dbclose;
+	msg = _open_rom(argv[2], &m, &rom);
+	if (msg) goto out_return;
+	if (Frag_Search(&rom, &frags, &num_frags)) {
+		msg = "Frag_Search oopsed";
+		goto out_unmap;
 	}
+	if (FragIndex_Write(out, &rom, frags, num_frags))
+		msg = "couldn't write index";
+	free(frags);
 
-	if (m.size < (1048576 + 4096)) {
-		msg = "rom too small";
-		goto out_unmap;
+out_unmap:
+	MappedFile_Close(m);
+out_return:
+	free(out);
+	return msg;
+}
+
+char *cmd_profile(int argc, char **argv)
+{
+	__label__ out_return, out_unmap;
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct fraginfo_s *frags = NULL;
+	size_t num_frags;
+	char *msg = NULL;
+
+	if (argc < 3) {
+		msg = "must specify a Pokemon Stadium rom";
+		goto out_return;
 	}
 
-	rc = DB_FragSearch(db, m.data, m.size);
-	if (rc != SQLITE_OK) {
-		msg = "DB_FragSearch oopsed";
+	msg = _open_rom(argv[2], &m, &rom);
+	if (msg) goto out_return;
+	// a profile is what the rom really has
+	Frag_IgnoreIndex("a profile");
+	if (Frag_SearchRange(&rom, 0, rom.size, &frags, &num_frags)) {
+		msg = "Frag_Search oopsed";
 		goto out_unmap;
 	}
-
-	dump_frags();
+	Profile_Write(stdout, &rom, frags, num_frags);
+	free(frags);
 
 out_unmap:
 	MappedFile_Close(m);
-out_dbclose:
-	DB_Close(db);
 out_return:
-	if (msg) {
-		return msg;
-	} else {
-		return NULL;
-	}
+	return msg;
 }
 
 char *cmd_mkdb(int argc, char **argv)
 {
 	__label__ out_return, out_dbclose, out_unmap;
 	struct MappedFile_s m;
+	struct RomView_s rom;
 	char *msg = NULL;
 	int rc;
 
@@ -235,6 +2396,15 @@ char *cmd_mkdb(int argc, char **argv)
 	default:
 		break;
 	}
+	bool with_blobs = false;
+	for (int arg = 4; arg < argc; arg++) {
+		if (!strcmp(argv[arg], "--with-blobs")) {
+			with_blobs = true;
+		} else {
+			msg = "unknown option";
+			goto out_return;
+		}
+	}
 
 	rc = DB_Init(&db, argv[3]);
 	if (rc != SQLITE_OK) {
@@ -242,7 +2412,7 @@ char *cmd_mkdb(int argc, char **argv)
 		goto out_return;
 	}
 
-	m = MappedFile_Open(argv[2], false);
+	m = MappedFile_OpenFlags(argv[2], MAPFILE_SCAN);
 	if (m.data == NULL) {
 		msg = "couldn't open rom";
 		goto out_dbclose;
@@ -253,12 +2423,33 @@ char *cmd_mkdb(int argc, char **argv)
 		goto out_unmap;
 	}
 
-	rc = DB_FragSearch(db, m.data, m.size);
+	RomView_Init(&rom, m.data, m.size);
+
+	struct stat sb;
+	int64_t mtime = -1;
+	// patch loops can rewrite a rom several times a second
+	if ((stat(argv[2], &sb) == 0) and S_ISREG(sb.st_mode)) {
+#ifdef __MINGW32__
+		mtime = sb.st_mtime * 1000000000LL;
+#else
+		mtime = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+#endif
+	}
+
+	rc = DB_UpdateRom(db, &rom, mtime);
 	if (rc != SQLITE_OK) {
-		msg = "DB_FragSearch oopsed";
+		msg = "DB_UpdateRom oopsed";
 		goto out_unmap;
 	}
 
+	if (with_blobs) {
+		rc = DB_AddBlobs(db, &rom);
+		if (rc != SQLITE_OK) {
+			msg = "DB_AddBlobs oopsed";
+			goto out_unmap;
+		}
+	}
+
 	goto out_unmap;
 
 out_unmap:
@@ -274,14 +2465,72 @@ out_return:
 
 }
 
+char *cmd_mergedb(int argc, char **argv)
+{
+	__label__ out_return, out_dbclose;
+	char *msg = NULL;
+	int rc, added, clashed;
+
+	switch (argc) {
+	case 0 ... 2:
+		msg = "must specify an output database";
+		goto out_return;
+	case 3:
+		msg = "must specify databases to merge";
+		goto out_return;
+	default:
+		break;
+	}
+
+	rc = DB_Init(&db, argv[2]);
+	if (rc != SQLITE_OK) {
+		msg = "DB_Init oopsed";
+		goto out_return;
+	}
+
+	// indexes are built once at the end, not updated row by row
+	sqlite3_exec(db, "PRAGMA synchronous=OFF;", NULL, NULL, NULL);
+	if (DB_DropIndexes(db) != SQLITE_OK) {
+		msg = "couldn't drop indexes";
+		goto out_dbclose;
+	}
+	for (int arg = 3; arg < argc; arg++) {
+		// ATTACH would make an empty one
+		if (access(argv[arg], R_OK)) {
+			fprintf(stderr, "%s: %s\n", argv[arg], strerror(errno));
+			msg = "couldn't open database";
+			break;
+		}
+		rc = DB_Merge(db, argv[arg], &added, &clashed);
+		if (rc != SQLITE_OK) {
+			msg = "couldn't merge database";
+			break;
+		}
+		fprintf(stderr, "%s: %d rom%s added", argv[arg], added,
+			(added == 1)? "": "s");
+		if (clashed)
+			fprintf(stderr, ", %d left out for a different rom with"
+				" the same pcode", clashed);
+		fprintf(stderr, "\n");
+	}
+	if (DB_CreateIndexes(db) != SQLITE_OK and !msg)
+		msg = "couldn't create indexes";
+
+out_dbclose:
+	DB_Close(db);
+out_return:
+	return msg;
+}
+
 char *cmd_decompile(int argc, char **argv)
 {
-	__label__ out_return, out_dbclose, out_unmap;
+	__label__ out_return, out_unmap;
 	struct MappedFile_s m, outfile;
+	struct RomView_s rom;
+	struct fraginfo_s fi;
 	int fragnum, fragaddr, fragsize, vma;
 	char *msg = NULL, *outname = NULL, *command = NULL;
 	char pcode[6];
-	int rc;
 
 	switch (argc) {
 	case 0 ... 2:
@@ -296,16 +2545,10 @@ char *cmd_decompile(int argc, char **argv)
 		break;
 	}
 
-	rc = DB_Init(&db, ":memory:");
-	if (rc != SQLITE_OK) {
-		msg = "DB_Init oopsed";
-		goto out_return;
-	}
-
-	m = MappedFile_Open(argv[2], false);
+	m = MappedFile_OpenFlags(argv[2], MAPFILE_SCAN);
 	if (m.data == NULL) {
 		msg = "couldn't open rom";
-		goto out_dbclose;
+		goto out_return;
 	}
 
 	if (m.size < (1048576 + 4096)) {
@@ -313,37 +2556,48 @@ char *cmd_decompile(int argc, char **argv)
 		goto out_unmap;
 	}
 
-	rc = DB_FragSearch(db, m.data, m.size);
-	if (rc != SQLITE_OK) {
-		msg = "DB_FragSearch oopsed";
-		goto out_unmap;
-	}
+	RomView_Init(&rom, m.data, m.size);
 
 	fragnum = atoi(argv[3]);
-	fragaddr = DB_GetAddrForNum(db, fragnum);
-	fragsize = DB_GetRomSizeForNum(db, fragnum);
-	if (fragaddr == -1) {
+	switch (Frag_Find(&rom, fragnum, &fi)) {
+	case 0:
+		break;
+	case 1:
 		msg = "no fragment by that number";
 		goto out_unmap;
+	default:
+		msg = "Frag_Find oopsed";
+		goto out_unmap;
 	}
+	if (fi.romsize > rom.size - fi.addr) fi.romsize = rom.size - fi.addr;
+	fragaddr = fi.addr;
+	fragsize = fi.romsize;
 
-	get_pcode(pcode, m.data);
-	rc = asprintf(&outname, "%s-frag%03d.bin", pcode, fragnum);
+	get_pcode(pcode, rom.header);
+	if (asprintf(&outname, "%s-frag%03d.bin", pcode, fragnum) == -1) {
+		msg = "asprintf failed";
+		goto out_unmap;
+	}
 	outfile = MappedFile_Create(outname, fragsize);
 	if (!outfile.data) {
 		msg = "couldn't open outfile";
+		free(outname);
 		goto out_unmap;
 	}
 
-	memcpy(outfile.data, m.data + fragaddr, fragsize);
+	RomView_Read(&rom, outfile.data, fragaddr, fragsize);
 	vma = get_vma(outfile.data);
 	MappedFile_Close(outfile);
 
-	asprintf(&command, "retdec-decompiler.py -k -a mips -e big -m raw --cleanup --backend-find-patterns all --backend-var-renamer simple --backend-no-debug-comments --raw-entry-point 0x%x --raw-section-vma 0x%x \"%s\"\n",
+	if (asprintf(&command, "retdec-decompiler.py -k -a mips -e big -m raw --cleanup --backend-find-patterns all --backend-var-renamer simple --backend-no-debug-comments --raw-entry-point 0x%x --raw-section-vma 0x%x \"%s\"\n",
 		vma,
 		vma,
 		outname
-	);
+	) == -1) {
+		msg = "asprintf failed";
+		free(outname);
+		goto out_unmap;
+	}
 
 	system(command);
 	free(command);
@@ -353,8 +2607,6 @@ char *cmd_decompile(int argc, char **argv)
 
 out_unmap:
 	MappedFile_Close(m);
-out_dbclose:
-	DB_Close(db);
 out_return:
 	if (msg) {
 		return msg;
@@ -364,14 +2616,259 @@ out_return:
 
 }
 
+#ifndef __MINGW32__
+// one fragment that isn't in the cache yet
+struct decompile_job_s {
+	struct fraginfo_s *fi;
+	char *binname;
+	char *outname;
+	char *cachename;
+	char vma[16];
+	char *argv[24];
+};
+
+// what the decompiler is told besides where each fragment is
+static char *_decompile_opts[] = {
+	"-k", "-a", "mips", "-e", "big", "-m", "raw",
+	"--cleanup", "--backend-find-patterns", "all",
+	"--backend-var-renamer", "simple",
+	"--backend-no-debug-comments",
+};
+#define NUM_DECOMPILE_OPTS (sizeof(_decompile_opts) / sizeof(_decompile_opts[0]))
+// more decompilers than this at once is surely a typo
+#define MAX_DECOMPILE_JOBS 1024
+
+struct decompile_s {
+	struct decompile_job_s *jobs;
+	size_t num_jobs;
+	size_t finished;
+	size_t failed;
+	struct timespec start;
+};
+
+static int _copy_file(char *from, char *to)
+{
+	__label__ out_close;
+	FILE *in, *out;
+	char buf[65536];
+	size_t n;
+	int rc = 0;
+
+	in = fopen(from, "rb");
+	if (!in) return -1;
+	out = fopen(to, "wb");
+	if (!out) {
+		rc = -1;
+		goto out_close;
+	}
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+		if (fwrite(buf, 1, n, out) != n) rc = -1;
+	if (ferror(in)) rc = -1;
+	if (fclose(out)) rc = -1;
+out_close:
+	fclose(in);
+	return rc;
+}
+
+static double _elapsed(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec)
+		+ (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void _decompile_done(void *ctx, size_t index, int status)
+{
+	struct decompile_s *d = ctx;
+	struct decompile_job_s *job = &d->jobs[index];
+	struct stat st;
+	char *tmpname = NULL;
+
+	d->finished++;
+	if ((status != 0) or stat(job->outname, &st)) {
+		d->failed++;
+		fprintf(stderr, "\nfragment %d: decompiler failed (%d)\n",
+			job->fi->num, status);
+	} else if (asprintf(&tmpname, "%s.tmp", job->cachename) != -1) {
+		// readers of the cache never see half a file
+		if (!_copy_file(job->outname, tmpname))
+			rename(tmpname, job->cachename);
+		else
+			remove(tmpname);
+		free(tmpname);
+	}
+
+	double elapsed = _elapsed(&d->start);
+	double eta = elapsed / d->finished * (d->num_jobs - d->finished);
+	fprintf(stderr, "\r%zu/%zu decompiled, %zu failed, %.0fs elapsed, eta %.0fs   ",
+		d->finished, d->num_jobs, d->failed, elapsed, eta);
+}
+
+char *cmd_decompile_all(int argc, char **argv)
+{
+	__label__ out_return, out_unmap, out_free;
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	struct fraginfo_s *frags = NULL;
+	struct decompile_s d = {0};
+	char ***argvs = NULL;
+	size_t num_frags, i, cached = 0;
+	unsigned jobs = Pool_Threads();
+	char *decompiler, *cachedir, *cachesub = NULL;
+	struct xxh64_s key;
+	char *msg = NULL;
+	char pcode[6];
+
+	if (argc < 3) {
+		msg = "must specify a Pokemon Stadium rom";
+		goto out_return;
+	}
+	for (int arg = 3; arg < argc; arg++) {
+		if (!strcmp(argv[arg], "--jobs") and (arg + 1 < argc)) {
+			char *end;
+			long n = strtol(argv[++arg], &end, 10);
+			if ((end == argv[arg]) or *end or (n < 1)
+			    or (n > MAX_DECOMPILE_JOBS)) {
+				msg = "--jobs must be a number from 1 to 1024";
+				goto out_return;
+			}
+			jobs = n;
+		} else {
+			msg = "unknown option";
+			goto out_return;
+		}
+	}
+	decompiler = getenv("PSFRAG_DECOMPILER");
+	if (!decompiler or !*decompiler) decompiler = DECOMPILER;
+	cachedir = getenv("PSFRAG_CACHE");
+	if (!cachedir or !*cachedir) cachedir = DECOMPILE_CACHE;
+
+	// each decompiler command line gets a cache of its own
+	XXH64_Reset(&key, 0);
+	XXH64_Update(&key, decompiler, strlen(decompiler) + 1);
+	for (i = 0; i < NUM_DECOMPILE_OPTS; i++)
+		XXH64_Update(&key, _decompile_opts[i],
+			strlen(_decompile_opts[i]) + 1);
+	if (asprintf(&cachesub, "%s/%016" PRIx64, cachedir,
+		XXH64_Digest(&key)) == -1) {
+		cachesub = NULL;
+		msg = "out of memory";
+		goto out_return;
+	}
+	if (_make_dir(cachedir) or _make_dir(cachesub)) {
+		msg = "couldn't create cache directory";
+		goto out_return;
+	}
+
+	msg = _open_rom(argv[2], &m, &rom);
+	if (msg) goto out_return;
+	get_pcode(pcode, rom.header);
+
+	if (Frag_Search(&rom, &frags, &num_frags)) {
+		msg = "Frag_Search oopsed";
+		goto out_unmap;
+	}
+	d.jobs = calloc(num_frags + 1, sizeof(*d.jobs));
+	argvs = calloc(num_frags + 1, sizeof(*argvs));
+	if (!d.jobs or !argvs) {
+		msg = "out of memory";
+		goto out_free;
+	}
+
+	for (i = 0; i < num_frags; i++) {
+		struct fraginfo_s *fi = &frags[i];
+		struct decompile_job_s *job = &d.jobs[d.num_jobs];
+		if (fi->num < 0) continue;
+		if ((asprintf(&job->binname, "%s-frag%03d.bin", pcode, fi->num) == -1)
+			or (asprintf(&job->outname, "%s-frag%03d.c", pcode, fi->num) == -1)
+			or (asprintf(&job->cachename, "%s/%016" PRIx64 ".c",
+				cachesub, fi->hash) == -1)) {
+			msg = "out of memory";
+			goto out_free;
+		}
+		if (!_copy_file(job->cachename, job->outname)) {
+			cached++;
+			free(job->binname);
+			free(job->outname);
+			free(job->cachename);
+			memset(job, 0, sizeof(*job));
+			continue;
+		}
+
+		uint64_t len = fi->romsize;
+		if (len > rom.size - fi->addr) len = rom.size - fi->addr;
+		struct MappedFile_s outfile = MappedFile_Create(job->binname, len);
+		if (!outfile.data) {
+			msg = "couldn't open outfile";
+			goto out_free;
+		}
+		RomView_Read(&rom, outfile.data, fi->addr, len);
+		MappedFile_Close(outfile);
+
+		job->fi = fi;
+		snprintf(job->vma, sizeof(job->vma), "0x%x", fi->vma);
+		char *args[] = {
+			"--raw-entry-point", job->vma,
+			"--raw-section-vma", job->vma,
+			"-o", job->outname, job->binname, NULL,
+		};
+		job->argv[0] = decompiler;
+		memcpy(job->argv + 1, _decompile_opts, sizeof(_decompile_opts));
+		memcpy(job->argv + 1 + NUM_DECOMPILE_OPTS, args, sizeof(args));
+		argvs[d.num_jobs++] = job->argv;
+	}
+
+	fprintf(stderr, "%zu fragments, %zu cached, %zu to decompile with %u jobs\n",
+		num_frags, cached, d.num_jobs, jobs);
+	clock_gettime(CLOCK_MONOTONIC, &d.start);
+	if (ProcPool_Run(argvs, d.num_jobs, jobs, _decompile_done, &d))
+		msg = "waiting for the decompiler failed";
+	if (d.num_jobs) fprintf(stderr, "\n");
+	if (!msg and d.failed) msg = "some fragments failed to decompile";
+
+out_free:
+	// one past the last job may be half set up
+	for (i = 0; d.jobs and (i <= d.num_jobs); i++) {
+		free(d.jobs[i].binname);
+		free(d.jobs[i].outname);
+		free(d.jobs[i].cachename);
+	}
+	free(argvs);
+	free(d.jobs);
+	free(frags);
+out_unmap:
+	MappedFile_Close(m);
+out_return:
+	free(cachesub);
+	return msg;
+}
+#endif
+
 char *cmd_depends(int argc, char **argv)
 {
-	__label__ out_return, out_dbclose, out_unmap, out_droptable;
+	__label__ out_return, out_dbclose, out_unmap, out_put, out_droptable;
 	struct MappedFile_s m;
+	struct RomView_s rom;
 	char *msg = NULL;
 	int rc;
 	int fragnum;
 	char pcode[6];
+	uint8_t *fragbytes = NULL;
+	size_t fragsize;
+	bool from_db = (argc > 2) and !strcmp(argv[2], "--db");
+
+	if (from_db) {
+		if (argc < 4) {
+			msg = "must specify a database";
+			goto out_return;
+		}
+		msg = _open_db(argv[3]);
+		if (msg) goto out_return;
+		msg = _get_db_frag(argc, argv, &fragnum, &fragbytes, &fragsize, pcode);
+		if (msg) goto out_dbclose;
+		goto have_frag;
+	}
 
 	switch (argc) {
 	case 0 ... 2:
@@ -392,7 +2889,7 @@ char *cmd_depends(int argc, char **argv)
 		goto out_return;
 	}
 
-	m = MappedFile_Open(argv[2], false);
+	m = MappedFile_OpenFlags(argv[2], MAPFILE_SCAN);
 	if (m.data == NULL) {
 		msg = "couldn't open rom";
 		goto out_dbclose;
@@ -403,24 +2900,44 @@ char *cmd_depends(int argc, char **argv)
 		goto out_unmap;
 	}
 
-	get_pcode(pcode, m.data);
+	RomView_Init(&rom, m.data, m.size);
 
-	rc = DB_FragSearch(db, m.data, m.size);
-	if (rc != SQLITE_OK) {
-		msg = "DB_FragSearch oopsed";
-		goto out_unmap;
-	}
+	get_pcode(pcode, rom.header);
 
 	fragnum = atoi(argv[3]);
-	int fragaddr = DB_GetAddrForNum(db, fragnum);
-	if (fragaddr == -1) {
+	struct fraginfo_s fi;
+	switch (Frag_Find(&rom, fragnum, &fi)) {
+	case 0:
+		break;
+	case 1:
 		msg = "no fragment by that number";
 		goto out_unmap;
+	default:
+		msg = "Frag_Find oopsed";
+		goto out_unmap;
+	}
+	fragsize = fi.romsize;
+	if (fragsize > m.size - fi.addr) fragsize = m.size - fi.addr;
+	fragbytes = RomView_Get(&rom, fi.addr, fragsize);
+	if (!fragbytes) {
+		msg = "couldn't read fragment";
+		goto out_unmap;
+	}
+
+	// an index with a dependency graph has the answer already
+	const int32_t *deps;
+	size_t num_deps;
+	if (!Frag_Depends(&rom, fragnum, &deps, &num_deps)) {
+		uint32_t num_relocs;
+		Reloc_Table(fragbytes, fragsize, &num_relocs);
+		printf("%d relocations.\n", num_relocs);
+		for (size_t i = 0; i < num_deps; i++)
+			printf("%s%d", i? ", ": "Depends on ", deps[i]);
+		printf(num_deps? ".\n": "No dependencies.\n");
+		goto out_put;
 	}
-	//parse_relocs(m.data + fragaddr);
-	uint32_t *fragbytes = m.data + fragaddr;
 
-	// start
+have_frag:
 
 	rc = sqlite3_exec(
 		db,
@@ -429,7 +2946,7 @@ char *cmd_depends(int argc, char **argv)
 	);
 	if (rc != SQLITE_OK) {
 		msg = "create temp table failed";
-		goto out_unmap;
+		goto out_droptable;
 	};
 
 	sqlite3_stmt *stmt = NULL;
@@ -450,63 +2967,19 @@ char *cmd_depends(int argc, char **argv)
 		msg = "begin transaction";
 		goto out_droptable;
 	}
-	struct fragment_s frag;
-	memcpy(&frag, fragbytes, sizeof(struct fragment_s));
-	uint32_t *words = (uint32_t *)fragbytes;
-	uint32_t *reloc_words = words;
-	reloc_words += htonl(frag.offset_relocs) / sizeof(uint32_t);
-	uint32_t num_relocs = htonl(reloc_words[0]);
-	reloc_words++;
+	uint8_t *reloc_table;
+	uint32_t num_relocs;
+	reloc_table = Reloc_Table(fragbytes, fragsize, &num_relocs);
 	printf("%d relocations.\n", num_relocs);
 	for(int i = 0; i<num_relocs; i++) {
-		uint32_t reloc = htonl(reloc_words[i]);
-		bool foreign = reloc & 0x80000000;
-		uint32_t type = reloc & 0x7F000000;
-		uint32_t addr = reloc & 0x00FFFFFF;
-		uint32_t target = htonl(words[addr>>2]);
-		uint32_t loc = -1;
-		uint32_t n;
-		int loc_fragnum = -2;
-
-		char *zType = NULL;
-
-		switch (type) {
-		case 0x02000000:
-			zType = "ptr";
-			loc = target;
-			break;
-		case 0x04000000:
-			zType = "j";
-			loc = (target & 0x03FFFFFF) << 2;
-			loc |= 0x80000000;
-			break;
-		case 0x05000000:
-			zType = "lui";
-			loc = (target & 0x0000FFFF) << 16;
-			loc |= 0x80000000;
-			break;
-		case 0x06000000:
-			zType = "addiu";
-			loc = (target & 0x0000FFFF);
-			if (!foreign)
-				loc += get_vma(&frag);
-			break;
-		default:
-			zType = "unknown";
-			loc = -1;
-			break;
-		}
+		struct reloc_s r;
+		Reloc_Decode(&r, Reloc_Get(reloc_table, i), fragbytes, fragsize);
+		bool foreign = r.foreign;
+		char *zType = r.type_name;
+		uint32_t addr = r.addr;
+		uint32_t loc = r.loc;
+		int loc_fragnum = r.target_frag;
 
-		n = (loc & 0x0FF00000)>>20;
-		loc_fragnum = n - 16;
-// 		printf("%5d %08x %8x %08x\t%s\t%d\n",
-// 			i,
-// 			reloc,
-// 			addr,
-// 			loc,
-// 			zType,
-// 			loc_fragnum
-// 		);
 		if (loc_fragnum < 0) continue;
 // "insert into temp.relocs(pcode, fragnum, far, type, addr, target_addr, target_frag) values (?, ?, ?, ?, ?, ?, ?);"
 		rc = sqlite3_bind_text(stmt, 1, pcode, -1, SQLITE_TRANSIENT);
@@ -583,9 +3056,12 @@ out_droptable:
 		"drop table temp.relocs;",
 		NULL, NULL, NULL
 	);
+out_put:
+	if (!from_db) RomView_Put(&rom, fragbytes);
 out_unmap:
-	MappedFile_Close(m);
+	if (!from_db) MappedFile_Close(m);
 out_dbclose:
+	if (from_db) free(fragbytes);
 	DB_Close(db);
 out_return:
 	if (msg) {
@@ -596,12 +3072,52 @@ out_return:
 
 }
 
+char *_cmd_extract_db(int argc, char **argv)
+{
+	__label__ out_return, out_dbclose;
+	struct MappedFile_s outfile;
+	char *msg = NULL, *outname = NULL;
+	char pcode[6];
+	uint8_t *bytes = NULL;
+	size_t size;
+	int num;
+
+	if (argc < 4) {
+		msg = "must specify a database";
+		goto out_return;
+	}
+	msg = _open_db(argv[3]);
+	if (msg) goto out_return;
+	msg = _get_db_frag(argc, argv, &num, &bytes, &size, pcode);
+	if (msg) goto out_dbclose;
+
+	if (asprintf(&outname, "%s-frag%03d.bin", pcode, num) == -1) {
+		msg = "asprintf failed";
+		goto out_dbclose;
+	}
+	outfile = MappedFile_Create(outname, size);
+	free(outname);
+	if (!outfile.data) {
+		msg = "couldn't open outfile";
+		goto out_dbclose;
+	}
+	memcpy(outfile.data, bytes, size);
+	MappedFile_Close(outfile);
+
+out_dbclose:
+	free(bytes);
+	DB_Close(db);
+out_return:
+	return msg;
+}
+
 char *_cmd_extract_aux(int argc, char **argv, bool all)
 {
 	__label__ out_return, out_dbclose, out_unmap, out_finalize;
 	char *msg = NULL;
 	int rc;
 	struct MappedFile_s m, outfile;
+	struct RomView_s rom;
 	int num, addr, size;
 	char *outname = NULL;
 	char pcode[6];
@@ -627,7 +3143,7 @@ char *_cmd_extract_aux(int argc, char **argv, bool all)
 		goto out_return;
 	}
 
-	m = MappedFile_Open(argv[2], false);
+	m = MappedFile_OpenFlags(argv[2], MAPFILE_SCAN);
 	if (m.data == NULL) {
 		msg = "couldn't open rom";
 		goto out_dbclose;
@@ -638,44 +3154,54 @@ char *_cmd_extract_aux(int argc, char **argv, bool all)
 		goto out_unmap;
 	}
 
-	get_pcode(pcode, m.data);
-	rc = DB_FragSearch(db, m.data, m.size);
-	if (rc != SQLITE_OK) {
-		msg = "DB_FragSearch oopsed";
-		goto out_unmap;
-	}
+	RomView_Init(&rom, m.data, m.size);
 
+	get_pcode(pcode, rom.header);
 	sqlite3_stmt *stmt = NULL;
-	if (all) {
-		rc = sqlite3_prepare_v2(
-			db,
-			"select num,addr,romsize from frags order by num;",
-			-1, &stmt, NULL
-		);
-		if (rc != SQLITE_OK) {
-			msg = "error in prepare (all)";
-			goto out_finalize;
-		}
-	} else {
+
+	// one fragment is looked for on its own
+	if (!all) {
+		struct fraginfo_s fi;
 		num = atoi(argv[3]);
-		rc = sqlite3_prepare_v2(
-			db,
-			"select num,addr,romsize from frags where num=?;",
-			-1, &stmt, NULL
-		);
-		if (rc != SQLITE_OK) {
-			msg = "error in prepare (one)";
-			goto out_finalize;
+		switch (Frag_Find(&rom, num, &fi)) {
+		case 0:
+			break;
+		case 1:
+			msg = "no fragment by that number";
+			goto out_unmap;
+		default:
+			msg = "Frag_Find oopsed";
+			goto out_unmap;
 		}
-		rc = sqlite3_bind_int(stmt, 1, num);
-		if (rc != SQLITE_OK) {
-			msg = "error in bind";
-			goto out_finalize;
+		if (asprintf(&outname, "%s-frag%03d.bin", pcode, num) == -1) {
+			msg = "asprintf failed";
+			goto out_unmap;
+		}
+		if (fi.romsize > rom.size - fi.addr) fi.romsize = rom.size - fi.addr;
+		outfile = MappedFile_Create(outname, fi.romsize);
+		free(outname);
+		if (!outfile.data) {
+			msg = "couldn't open outfile";
+			goto out_unmap;
 		}
+		RomView_Read(&rom, outfile.data, fi.addr, fi.romsize);
+		MappedFile_Close(outfile);
+		goto out_unmap;
 	}
 
-	if (!all and (DB_GetAddrForNum(db, num) == -1)) {
-		msg = "no fragment by that number";
+	rc = DB_FragSearch(db, &rom);
+	if (rc != SQLITE_OK) {
+		msg = "DB_FragSearch oopsed";
+		goto out_unmap;
+	}
+
+	rc = sqlite3_prepare_v2(
+		db,
+		"select num,addr,romsize from frags order by num;",
+		-1, &stmt, NULL
+	);
+	if (rc != SQLITE_OK) {
+		msg = "error in prepare (all)";
 		goto out_finalize;
 	}
 
@@ -709,7 +3235,7 @@ char *_cmd_extract_aux(int argc, char **argv, bool all)
 			msg = "couldn't open outfile";
 			goto out_finalize;
 		}
-		memcpy(outfile.data, m.data + addr, size);
+		RomView_Read(&rom, outfile.data, addr, size);
 		free(outname);
 		MappedFile_Close(outfile);
 		break;
@@ -733,6 +3259,8 @@ out_return:
 
 char *cmd_extract(int argc, char **argv)
 {
+	if ((argc > 2) and !strcmp(argv[2], "--db"))
+		return _cmd_extract_db(argc, argv);
 	return _cmd_extract_aux(argc, argv, false);
 }
 
@@ -763,6 +3291,24 @@ int main(int argc, char **argv)
 	__label__ out_return;
 	char *msg = NULL;
 	char *cmd_string = NULL;
+	struct fragindex_s fx;
+
+	// --index works with every command, so it's taken out here
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--index")) continue;
+		if (i + 1 >= argc) {
+			msg = "--index needs a file";
+			goto out_return;
+		}
+		if (FragIndex_Open(&fx, argv[i + 1])) {
+			msg = "couldn't read index";
+			goto out_return;
+		}
+		Frag_UseIndex(&fx);
+		memmove(&argv[i], &argv[i + 2], (argc - i - 1) * sizeof(*argv));
+		argc -= 2;
+		break;
+	}
 
 	if (argc < 2) {
 		print_usage();
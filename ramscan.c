@@ -0,0 +1,234 @@
+#ifdef __MINGW32__
+#include <winsock.h>
+#else
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#endif
+#include <iso646.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "ramscan.h"
+#include "reloc.h"
+
+// odd, so every power of it is too
+#define ROLL_BASE 0x9E3779B97F4A7C15ULL
+
+// a window of a fragment's code with no relocated words in it
+struct anchor_s {
+	size_t frag;
+	uint32_t off;
+};
+
+// what a fragment looks like when loaded: its code, minus relocations
+struct pattern_s {
+	uint32_t *words;	// host order
+	uint8_t *wild;		// per word, relocated
+	uint32_t num_words;	// up to the end of the code
+};
+
+static uint32_t load_be32(uint8_t *p)
+{
+	uint32_t w;
+	memcpy(&w, p, 4);
+	return ntohl(w);
+}
+
+/*
+ * RDRAM dumps are usually in the byte order of whatever wrote them. The
+ * order that has the most jr $ra in it is the right one.
+ */
+enum rom_order_e Ram_DetectOrder(uint8_t *ram, uint64_t size)
+{
+	static const uint8_t jr_ra[3][4] = {
+		[ROM_ORDER_Z64] = { 0x03, 0xE0, 0x00, 0x08 },
+		[ROM_ORDER_V64] = { 0xE0, 0x03, 0x08, 0x00 },
+		[ROM_ORDER_N64] = { 0x08, 0x00, 0xE0, 0x03 },
+	};
+	uint64_t count[3] = {0};
+	enum rom_order_e best = ROM_ORDER_Z64;
+
+	for (uint64_t i = 0; i + 4 <= size; i += 4)
+		for (int o = 0; o < 3; o++)
+			if (!memcmp(ram + i, jr_ra[o], 4)) count[o]++;
+	for (int o = 1; o < 3; o++)
+		if (count[o] > count[best]) best = o;
+	return best;
+}
+
+static uint64_t roll_hash(uint32_t *words)
+{
+	uint64_t h = 0;
+	for (int i = 0; i < RAMSCAN_WINDOW; i++)
+		h = h * ROLL_BASE + words[i];
+	return h;
+}
+
+// worth anchoring on: nothing relocated, and not mostly nops
+static bool good_window(struct pattern_s *p, uint32_t start)
+{
+	int zeros = 0;
+
+	if (start + RAMSCAN_WINDOW > p->num_words) return false;
+	for (int i = 0; i < RAMSCAN_WINDOW; i++) {
+		if (p->wild[start + i]) return false;
+		if (!p->words[start + i]) zeros++;
+	}
+	return zeros <= 2;
+}
+
+static int build_pattern(struct pattern_s *p, struct RomView_s *rom,
+	struct fraginfo_s *fi)
+{
+	uint64_t len = fi->romsize;
+	uint8_t *frag, *table;
+	uint32_t num;
+
+	if (len > rom->size - fi->addr) len = rom->size - fi->addr;
+	p->num_words = get_text_end(fi);
+	if (p->num_words > len) p->num_words = len;
+	p->num_words /= 4;
+	p->words = calloc(p->num_words + 1, sizeof(*p->words));
+	p->wild = calloc(p->num_words + 1, 1);
+	frag = RomView_Get(rom, fi->addr, len);
+	if (!p->words or !p->wild or !frag) {
+		if (frag) RomView_Put(rom, frag);
+		return -1;
+	}
+	for (uint32_t i = 0; i < p->num_words; i++)
+		p->words[i] = load_be32(frag + 4 * i);
+	table = Reloc_Table(frag, len, &num);
+	for (uint32_t i = 0; i < num; i++) {
+		uint32_t addr = Reloc_Get(table, i) & RELOC_ADDR_MASK;
+		if (addr / 4 < p->num_words) p->wild[addr / 4] = 1;
+	}
+	// the loader may use the header for its own bookkeeping
+	for (uint32_t i = 0; (i < 8) and (i < p->num_words); i++)
+		p->wild[i] = 1;
+	RomView_Put(rom, frag);
+	return 0;
+}
+
+static int cmp_hit(const void *a, const void *b)
+{
+	const struct ramhit_s *x = a, *y = b;
+	if (x->offset != y->offset) return (x->offset > y->offset)? 1: -1;
+	return (x->frag > y->frag) - (x->frag < y->frag);
+}
+
+/*
+ * Find where the fragments are in a big-endian ram dump. A few windows of
+ * each fragment's code go into one hash map, then a rolling hash goes
+ * over the dump once, word by word. A window that hits is checked by
+ * comparing the whole of the code, with relocated words left out since
+ * the loader has patched them. Returns 0, or -1 if out of memory.
+ */
+int Ram_Identify(uint8_t *ram, uint64_t size, struct RomView_s *rom,
+	struct fraginfo_s *frags, size_t num_frags,
+	struct ramhit_s **hits, size_t *num_hits)
+{
+	__label__ out_free;
+	struct pattern_s *pats;
+	struct anchor_s *anchors;
+	size_t num_anchors = 0, cap_hits = 0;
+	struct u64map_s map = {0};
+	uint64_t top = 1;	// ROLL_BASE ^ (RAMSCAN_WINDOW - 1)
+	uint32_t win[RAMSCAN_WINDOW];
+	int rc = -1;
+
+	*hits = NULL;
+	*num_hits = 0;
+	pats = calloc(num_frags + 1, sizeof(*pats));
+	anchors = calloc(num_frags * RAMSCAN_ANCHORS + 1, sizeof(*anchors));
+	if (!pats or !anchors) goto out_free;
+
+	for (size_t f = 0; f < num_frags; f++) {
+		struct pattern_s *p = &pats[f];
+		if (build_pattern(p, rom, &frags[f])) goto out_free;
+		// spread the anchors out, in case part of the code is patched
+		uint32_t prev = 0;
+		for (int a = 0; a < RAMSCAN_ANCHORS; a++) {
+			uint32_t start = p->num_words * a / RAMSCAN_ANCHORS;
+			if (start < prev) start = prev;
+			while ((start < p->num_words) and !good_window(p, start))
+				start++;
+			if (start >= p->num_words) break;
+			anchors[num_anchors].frag = f;
+			anchors[num_anchors++].off = start;
+			prev = start + RAMSCAN_WINDOW;
+		}
+	}
+	if (U64Map_Init(&map, num_anchors)) goto out_free;
+	for (size_t a = 0; a < num_anchors; a++)
+		U64Map_Put(&map, roll_hash(pats[anchors[a].frag].words
+			+ anchors[a].off), a);
+	for (int i = 1; i < RAMSCAN_WINDOW; i++)
+		top *= ROLL_BASE;
+
+	uint64_t nwords = size / 4;
+	uint64_t h = 0;
+	for (uint64_t w = 0; w < nwords; w++) {
+		uint32_t in = load_be32(ram + 4 * w);
+		if (w >= RAMSCAN_WINDOW)
+			h -= win[w % RAMSCAN_WINDOW] * top;
+		h = h * ROLL_BASE + in;
+		win[w % RAMSCAN_WINDOW] = in;
+		if (w + 1 < RAMSCAN_WINDOW) continue;
+
+		size_t iter = 0, a;
+		uint64_t start = w + 1 - RAMSCAN_WINDOW;
+		while (U64Map_Get(&map, h, &iter, &a)) {
+			struct pattern_s *p = &pats[anchors[a].frag];
+			if (start < anchors[a].off) continue;
+			uint64_t base = start - anchors[a].off;
+			if (base + p->num_words > nwords) continue;
+
+			struct ramhit_s hit = {
+				.frag = anchors[a].frag,
+				.offset = 4 * base,
+			};
+			for (uint32_t i = 0; i < p->num_words; i++) {
+				if (p->wild[i]) continue;
+				hit.total++;
+				if (load_be32(ram + 4 * (base + i)) == p->words[i])
+					hit.matched++;
+			}
+			if (*num_hits == cap_hits) {
+				struct ramhit_s *n;
+				cap_hits = cap_hits? 2 * cap_hits: 64;
+				n = realloc(*hits, cap_hits * sizeof(*n));
+				if (!n) goto out_free;
+				*hits = n;
+			}
+			(*hits)[(*num_hits)++] = hit;
+		}
+	}
+	qsort(*hits, *num_hits, sizeof(**hits), cmp_hit);
+
+	// the same placement is found by each of its anchors
+	size_t kept = 0;
+	for (size_t k = 0; k < *num_hits; k++) {
+		if (kept and ((*hits)[kept - 1].frag == (*hits)[k].frag)
+			and ((*hits)[kept - 1].offset == (*hits)[k].offset))
+			continue;
+		(*hits)[kept++] = (*hits)[k];
+	}
+	*num_hits = kept;
+	rc = 0;
+
+out_free:
+	if (rc) {
+		free(*hits);
+		*hits = NULL;
+		*num_hits = 0;
+	}
+	U64Map_Free(&map);
+	for (size_t f = 0; pats and (f < num_frags); f++) {
+		free(pats[f].words);
+		free(pats[f].wild);
+	}
+	free(pats);
+	free(anchors);
+	return rc;
+}
@@ -0,0 +1,24 @@
+#ifndef _RAMSCAN_H_
+#define _RAMSCAN_H_
+#include <inttypes.h>
+#include <stddef.h>
+#include "fragment.h"
+#include "romview.h"
+
+// words per anchor window, and windows per fragment
+#define RAMSCAN_WINDOW	8
+#define RAMSCAN_ANCHORS	4
+
+// a fragment found in a ram dump
+struct ramhit_s {
+	size_t frag;		// index into the fragments searched for
+	uint64_t offset;	// where its header is in the dump
+	uint32_t matched;	// code words that match, relocations aside
+	uint32_t total;
+};
+
+enum rom_order_e Ram_DetectOrder(uint8_t *ram, uint64_t size);
+int Ram_Identify(uint8_t *ram, uint64_t size, struct RomView_s *rom,
+	struct fraginfo_s *frags, size_t num_frags,
+	struct ramhit_s **hits, size_t *num_hits);
+#endif
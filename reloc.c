@@ -0,0 +1,145 @@
+#ifdef __MINGW32__
+#include <winsock.h>
+#else
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#endif
+#include <iso646.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fragment.h"
+#include "hash.h"
+#include "reloc.h"
+
+/*
+ * Find the relocation table of a fragment that is size bytes long. The
+ * count is clamped to what fits, so a bad header can't run off the end.
+ * Returns a pointer to the first entry, or NULL.
+ */
+uint8_t *Reloc_Table(uint8_t *frag, size_t size, uint32_t *num_relocs)
+{
+	struct fragment_s *hdr = (struct fragment_s *)frag;
+	uint32_t off, num;
+
+	*num_relocs = 0;
+	if (size < sizeof(struct fragment_s)) return NULL;
+	off = ntohl(hdr->offset_relocs);
+	if ((off & 3) or (off > size - 4)) return NULL;
+	memcpy(&num, frag + off, 4);
+	num = ntohl(num);
+	if (num > (size - off - 4) / 4) num = (size - off - 4) / 4;
+	*num_relocs = num;
+	return frag + off + 4;
+}
+
+// read an entry of the table, which may not be aligned
+uint32_t Reloc_Get(uint8_t *table, uint32_t index)
+{
+	uint32_t reloc;
+	memcpy(&reloc, table + 4 * index, 4);
+	return ntohl(reloc);
+}
+
+char *Reloc_TypeName(uint32_t reloc)
+{
+	switch (reloc & RELOC_TYPE_MASK) {
+	case RELOC_PTR:
+		return "ptr";
+	case RELOC_J:
+		return "j";
+	case RELOC_LUI:
+		return "lui";
+	case RELOC_ADDIU:
+		return "addiu";
+	default:
+		return "unknown";
+	}
+}
+
+// the bits of the patched word that a relocation overwrites
+uint32_t Reloc_Mask(uint32_t reloc)
+{
+	switch (reloc & RELOC_TYPE_MASK) {
+	case RELOC_PTR:
+		return 0xFFFFFFFF;
+	case RELOC_J:
+		return 0x03FFFFFF;
+	case RELOC_LUI:
+	case RELOC_ADDIU:
+		return 0x0000FFFF;
+	default:
+		return 0;
+	}
+}
+
+// decode one (host order) relocation entry of a fragment
+void Reloc_Decode(struct reloc_s *r, uint32_t reloc, uint8_t *frag, size_t size)
+{
+	uint32_t target, loc;
+
+	r->foreign = reloc & RELOC_FOREIGN;
+	r->type = reloc & RELOC_TYPE_MASK;
+	r->addr = reloc & RELOC_ADDR_MASK;
+	r->type_name = Reloc_TypeName(reloc);
+	r->loc = -1;
+	r->target_frag = -2;
+
+	if ((r->addr & 3) or (size < 4) or (r->addr > size - 4)) return;
+	memcpy(&target, frag + r->addr, 4);
+	target = ntohl(target);
+
+	switch (r->type) {
+	case RELOC_PTR:
+		loc = target;
+		break;
+	case RELOC_J:
+		loc = (target & 0x03FFFFFF) << 2;
+		loc |= 0x80000000;
+		break;
+	case RELOC_LUI:
+		loc = (target & 0x0000FFFF) << 16;
+		loc |= 0x80000000;
+		break;
+	case RELOC_ADDIU:
+		loc = (target & 0x0000FFFF);
+		if (!r->foreign)
+			loc += get_vma((struct fragment_s *)frag);
+		break;
+	default:
+		return;
+	}
+
+	r->loc = loc;
+	r->target_frag = get_addr_frag_num(loc);
+}
+
+/*
+ * Hash a fragment with every relocated field masked out, so the same
+ * code linked against a different layout still hashes the same.
+ */
+uint64_t Reloc_Fingerprint(uint8_t *frag, size_t size)
+{
+	uint8_t *copy;
+	uint8_t *table;
+	uint32_t num;
+	uint64_t fp;
+
+	copy = malloc(size? size: 1);
+	if (!copy) return 0;
+	memcpy(copy, frag, size);
+
+	table = Reloc_Table(frag, size, &num);
+	for (uint32_t i = 0; i < num; i++) {
+		uint32_t reloc = Reloc_Get(table, i);
+		uint32_t addr = reloc & RELOC_ADDR_MASK;
+		uint32_t word;
+		if ((addr & 3) or (size < 4) or (addr > size - 4)) continue;
+		memcpy(&word, copy + addr, 4);
+		word &= ~htonl(Reloc_Mask(reloc));
+		memcpy(copy + addr, &word, 4);
+	}
+
+	fp = XXH64(copy, size, 0);
+	free(copy);
+	return fp;
+}
@@ -0,0 +1,38 @@
+#ifndef _RELOC_H_
+#define _RELOC_H_
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A fragment's relocation table is at offset_relocs: a count, then one
+ * word per relocation:
+ *	bit 31		target is in another fragment
+ *	bits 24-30	type
+ *	bits 0-23	offset of the patched word within the fragment
+ */
+#define RELOC_FOREIGN	0x80000000
+#define RELOC_TYPE_MASK	0x7F000000
+#define RELOC_ADDR_MASK	0x00FFFFFF
+
+#define RELOC_PTR	0x02000000	// whole word is an address
+#define RELOC_J		0x04000000	// j/jal target
+#define RELOC_LUI	0x05000000	// %hi
+#define RELOC_ADDIU	0x06000000	// %lo
+
+struct reloc_s {
+	bool foreign;
+	uint32_t type;
+	uint32_t addr;		// offset of the patched word
+	uint32_t loc;		// address it refers to, or -1
+	int target_frag;	// fragment number of loc, negative if none
+	char *type_name;
+};
+
+uint8_t *Reloc_Table(uint8_t *frag, size_t size, uint32_t *num_relocs);
+uint32_t Reloc_Get(uint8_t *table, uint32_t index);
+void Reloc_Decode(struct reloc_s *r, uint32_t reloc, uint8_t *frag, size_t size);
+char *Reloc_TypeName(uint32_t reloc);
+uint32_t Reloc_Mask(uint32_t reloc);
+uint64_t Reloc_Fingerprint(uint8_t *frag, size_t size);
+#endif
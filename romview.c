@@ -0,0 +1,179 @@
+#include <iso646.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "romview.h"
+
+enum rom_order_e RomView_DetectOrder(uint8_t *data, uint64_t size)
+{
+	if (size < 4) return ROM_ORDER_Z64;
+	if ((data[0] == 0x37) and (data[1] == 0x80)) return ROM_ORDER_V64;
+	if ((data[0] == 0x40) and (data[1] == 0x12)) return ROM_ORDER_N64;
+	return ROM_ORDER_Z64;
+}
+
+char *RomView_OrderName(enum rom_order_e order)
+{
+	switch (order) {
+	case ROM_ORDER_V64:
+		return "v64";
+	case ROM_ORDER_N64:
+		return "n64";
+	default:
+		return "z64";
+	}
+}
+
+void RomView_Init(struct RomView_s *rom, void *data, uint64_t size)
+{
+	rom->data = data;
+	rom->size = size;
+	rom->order = RomView_DetectOrder(data, size);
+	memset(rom->header, 0, sizeof(rom->header));
+	RomView_Read(rom, rom->header, 0,
+		size < sizeof(rom->header)? size: sizeof(rom->header));
+}
+
+/*
+ * Convert len bytes between big-endian and the given order. Swapping is
+ * its own inverse, so this works in both directions, and dst may equal
+ * src. len should be a multiple of 4 (2 for v64); a ragged tail is
+ * copied as-is.
+ */
+void RomView_Swap(void *dst, void *src, size_t len, enum rom_order_e order)
+{
+	uint8_t *d = dst, *s = src;
+	size_t i = 0;
+
+	switch (order) {
+	case ROM_ORDER_V64:
+#ifdef __SSE2__
+		for (; i + 16 <= len; i += 16) {
+			__m128i x = _mm_loadu_si128((__m128i *)(s + i));
+			x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+			_mm_storeu_si128((__m128i *)(d + i), x);
+		}
+#endif
+		for (; i + 2 <= len; i += 2) {
+			uint8_t t = s[i];
+			d[i] = s[i+1];
+			d[i+1] = t;
+		}
+		break;
+	case ROM_ORDER_N64:
+#ifdef __SSE2__
+		for (; i + 16 <= len; i += 16) {
+			__m128i x = _mm_loadu_si128((__m128i *)(s + i));
+			x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+			x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+			x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+			_mm_storeu_si128((__m128i *)(d + i), x);
+		}
+#endif
+		for (; i + 4 <= len; i += 4) {
+			uint32_t w;
+			memcpy(&w, s + i, 4);
+			w = __builtin_bswap32(w);
+			memcpy(d + i, &w, 4);
+		}
+		break;
+	default:
+		break;
+	}
+
+	if ((i < len) and (d != s))
+		memmove(d + i, s + i, len - i);
+}
+
+// copy normalized bytes out of the rom. off and len needn't be aligned.
+void RomView_Read(struct RomView_s *rom, void *dst, uint64_t off, size_t len)
+{
+	uint8_t bounce[4096 + 8];
+	uint8_t *d = dst;
+
+	if (rom->order == ROM_ORDER_Z64) {
+		memcpy(d, rom->data + off, len);
+		return;
+	}
+
+	if (((off | len) & 3) == 0) {
+		RomView_Swap(d, rom->data + off, len, rom->order);
+		return;
+	}
+
+	while (len) {
+		uint64_t aoff = off & ~3ULL;
+		size_t skip = off - aoff;
+		size_t n = len < 4096? len: 4096;
+		size_t alen = (skip + n + 3) & ~3ULL;
+		if (aoff + alen > rom->size) alen = rom->size - aoff;
+		RomView_Swap(bounce, rom->data + aoff, alen, rom->order);
+		memcpy(d, bounce + skip, n);
+		d += n;
+		off += n;
+		len -= n;
+	}
+}
+
+// store big-endian bytes into the rom in its own byte order
+void RomView_Write(struct RomView_s *rom, uint64_t off, void *src, size_t len)
+{
+	uint8_t bounce[4096 + 8];
+	uint8_t *s = src;
+
+	if (rom->order == ROM_ORDER_Z64) {
+		memcpy(rom->data + off, s, len);
+		return;
+	}
+
+	if (((off | len) & 3) == 0) {
+		RomView_Swap(rom->data + off, s, len, rom->order);
+		return;
+	}
+
+	// ragged edges are read, patched and written back a word at a time
+	while (len) {
+		uint64_t aoff = off & ~3ULL;
+		size_t skip = off - aoff;
+		size_t n = len < 4096? len: 4096;
+		size_t alen = (skip + n + 3) & ~3ULL;
+		if (aoff + alen > rom->size) alen = rom->size - aoff;
+		RomView_Swap(bounce, rom->data + aoff, alen, rom->order);
+		memcpy(bounce + skip, s, n);
+		RomView_Swap(rom->data + aoff, bounce, alen, rom->order);
+		s += n;
+		off += n;
+		len -= n;
+	}
+}
+
+/*
+ * Get a normalized pointer to [off, off+len). Big-endian roms are
+ * returned in place; others are swapped into scratch, which must hold
+ * len bytes. This is what scanners call for each chunk they look at.
+ */
+uint8_t *RomView_Chunk(struct RomView_s *rom, uint64_t off, size_t len, uint8_t *scratch)
+{
+	if (rom->order == ROM_ORDER_Z64) return rom->data + off;
+	RomView_Read(rom, scratch, off, len);
+	return scratch;
+}
+
+// like RomView_Chunk, but allocates. release with RomView_Put.
+uint8_t *RomView_Get(struct RomView_s *rom, uint64_t off, size_t len)
+{
+	uint8_t *p;
+
+	if (rom->order == ROM_ORDER_Z64) return rom->data + off;
+	p = malloc(len? len: 1);
+	if (!p) return NULL;
+	RomView_Read(rom, p, off, len);
+	return p;
+}
+
+void RomView_Put(struct RomView_s *rom, uint8_t *p)
+{
+	if (rom->order != ROM_ORDER_Z64) free(p);
+}
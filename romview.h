@@ -0,0 +1,37 @@
+#ifndef _ROMVIEW_H_
+#define _ROMVIEW_H_
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+ * N64 dumps come in three byte orders, told apart by the first word of
+ * the header:
+ *	.z64	80 37 12 40	big-endian, what the console sees
+ *	.v64	37 80 40 12	16-bit words swapped
+ *	.n64	40 12 37 80	32-bit words swapped
+ * Everything else in psfrag works on big-endian bytes, so reads from a
+ * rom go through a view that swaps on the fly.
+ */
+enum rom_order_e {
+	ROM_ORDER_Z64 = 0,
+	ROM_ORDER_V64,
+	ROM_ORDER_N64,
+};
+
+struct RomView_s {
+	uint8_t *data;
+	uint64_t size;
+	enum rom_order_e order;
+	uint8_t header[0x40];	// normalized copy of the rom header
+};
+
+enum rom_order_e RomView_DetectOrder(uint8_t *data, uint64_t size);
+char *RomView_OrderName(enum rom_order_e order);
+void RomView_Init(struct RomView_s *rom, void *data, uint64_t size);
+void RomView_Swap(void *dst, void *src, size_t len, enum rom_order_e order);
+void RomView_Read(struct RomView_s *rom, void *dst, uint64_t off, size_t len);
+void RomView_Write(struct RomView_s *rom, uint64_t off, void *src, size_t len);
+uint8_t *RomView_Chunk(struct RomView_s *rom, uint64_t off, size_t len, uint8_t *scratch);
+uint8_t *RomView_Get(struct RomView_s *rom, uint64_t off, size_t len);
+void RomView_Put(struct RomView_s *rom, uint8_t *p);
+#endif
@@ -0,0 +1,227 @@
+#include <iso646.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "fragindex.h"
+#include "hash.h"
+#include "profile.h"
+#include "search.h"
+
+static struct fragindex_s *search_index;
+
+// have Frag_Search take fragments from an index instead, for its rom
+void Frag_UseIndex(struct fragindex_s *fx)
+{
+	search_index = fx;
+}
+
+// for what scans without Frag_Search, to say the index given isn't used
+void Frag_IgnoreIndex(char *what)
+{
+	if (search_index)
+		fprintf(stderr, "index isn't used for %s, scanning\n", what);
+}
+
+/*
+ * The fragments that fragment num refers to, from the dependency graph
+ * of the index in use. Returns 0, or -1 if there's no index of this rom
+ * with a graph, and they have to be worked out from the relocations.
+ */
+int Frag_Depends(struct RomView_s *rom, int32_t num, const int32_t **deps,
+	size_t *n)
+{
+	if (!search_index or !FragIndex_Matches(search_index, rom)) return -1;
+	return FragIndex_Deps(search_index, num, deps, n)? -1: 0;
+}
+
+/*
+ * The ram ranges of the num fragments Frag_Search returned, sorted by vma,
+ * from the index in use. NULL if there's no index of this rom, and they
+ * have to be sorted.
+ */
+const struct fragindex_interval_s *Frag_Intervals(struct RomView_s *rom,
+	size_t num)
+{
+	if (!search_index or (search_index->hdr->num_frags != num)
+		or !FragIndex_Matches(search_index, rom))
+		return NULL;
+	return search_index->intervals;
+}
+
+/*
+ * Find every fragment header in a rom, then hash the payloads. The
+ * array is returned in rom order and must be freed by the caller. If an
+ * index of the rom is in use, or it's a known rom, the rom isn't scanned
+ * at all.
+ * Returns 0, or -1 if out of memory.
+ */
+int Frag_Search(struct RomView_s *rom, struct fraginfo_s **frags, size_t *num)
+{
+	const struct profile_s *prof;
+
+	if (search_index) {
+		if (FragIndex_Matches(search_index, rom))
+			return FragIndex_Frags(search_index, frags, num);
+		fprintf(stderr, "index is not of this rom, scanning\n");
+	}
+	prof = Profile_Match(rom);
+	if (prof) return Profile_Frags(prof, frags, num);
+	return Frag_SearchRange(rom, 0, rom->size, frags, num);
+}
+
+// like Frag_Search, for headers that start in [start, end)
+int Frag_SearchRange(struct RomView_s *rom, uint64_t start, uint64_t end,
+	struct fraginfo_s **frags, size_t *num)
+{
+	uint8_t *scratch, *chunk;
+	struct fraginfo_s *v = NULL, *newv;
+	size_t n = 0, cap = 0;
+
+	*frags = NULL;
+	*num = 0;
+
+	/*
+	 * Byteswapped roms are normalized one chunk at a time as they are
+	 * scanned. Each chunk overlaps the next by a header so none are
+	 * missed at the seams.
+	 */
+	scratch = malloc(FRAGSEARCH_CHUNK + sizeof(struct fragment_s));
+	if (!scratch) return -1;
+
+	start &= ~15ULL;
+	if (end > rom->size) end = rom->size;
+	for (uint64_t base = start; base < end; base += FRAGSEARCH_CHUNK) {
+		size_t len = FRAGSEARCH_CHUNK + sizeof(struct fragment_s);
+		if (len > rom->size - base) len = rom->size - base;
+		chunk = RomView_Chunk(rom, base, len, scratch);
+		for (size_t i = 0; (i < FRAGSEARCH_CHUNK) and
+		    (base + i < end) and
+		    (i + sizeof(struct fragment_s) <= len); i += 16) {
+			struct fragment_s *frag = (struct fragment_s *)(chunk + i);
+			if (!isfrag(frag)) continue;
+			if (n == cap) {
+				cap = cap? cap * 2: 256;
+				newv = realloc(v, cap * sizeof(*v));
+				if (!newv) {
+					free(v);
+					free(scratch);
+					return -1;
+				}
+				v = newv;
+			}
+			get_fraginfo(&v[n++], frag, base + i);
+		}
+	}
+	free(scratch);
+
+	// the payloads are hashed in parallel once all headers are known
+	Hash_Frags(rom, v, n);
+
+	*frags = v;
+	*num = n;
+	return 0;
+}
+
+// the next fragment header at or after *pos, in [*pos, end)
+static bool next_header(struct RomView_s *rom, uint64_t *pos, uint64_t end,
+	uint8_t *scratch)
+{
+	uint64_t base = (*pos + 15) & ~15ULL;
+
+	if (end > rom->size) end = rom->size;
+	for (; base < end; base += FRAGSEARCH_CHUNK) {
+		size_t len = FRAGSEARCH_CHUNK + sizeof(struct fragment_s);
+		if (len > rom->size - base) len = rom->size - base;
+		uint8_t *chunk = RomView_Chunk(rom, base, len, scratch);
+		for (size_t i = 0; (i < FRAGSEARCH_CHUNK) and (base + i < end)
+		    and (i + sizeof(struct fragment_s) <= len); i += 16) {
+			if (!isfrag((struct fragment_s *)(chunk + i))) continue;
+			*pos = base + i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool frag_sane(struct RomView_s *rom, struct fraginfo_s *fi)
+{
+	return (fi->romsize >= sizeof(struct fragment_s))
+		and (fi->romsize <= rom->size - fi->addr)
+		and (fi->offset_relocs <= fi->romsize - 4);
+}
+
+/*
+ * Find fragment num without finding all the others. Fragments are laid
+ * out one after another, so from each header the search jumps over the
+ * payload to where the next should start, and stops at the one wanted.
+ * It starts where the retail roms put the first fragment.
+ * If that doesn't turn it up, say because it's inside another fragment
+ * or a header was bogus, the whole rom is searched as Frag_Search would.
+ * With an index of the rom in use, or for a known rom, it's looked up
+ * there.
+ *
+ * If more than one fragment has that number, the index, the profile and
+ * the full search give the first in rom order, but the jumps give the
+ * first they land on. One below FRAGFIND_START, or nested in a payload
+ * that was jumped over, loses to it. verify reports such a number as a
+ * duplicate.
+ *
+ * Returns 0 with *fi filled in, hashes included, 1 if there's no such
+ * fragment, or -1 if out of memory.
+ */
+int Frag_Find(struct RomView_s *rom, int32_t num, struct fraginfo_s *fi)
+{
+	const struct profile_s *prof;
+	struct fraginfo_s *frags;
+	size_t n, i;
+	uint8_t *scratch;
+	uint64_t pos = 0;
+
+	if (search_index and FragIndex_Matches(search_index, rom)) {
+		for (i = 0; i < search_index->hdr->num_frags; i++) {
+			if (search_index->num[i] != num) continue;
+			FragIndex_Get(search_index, i, fi);
+			return 0;
+		}
+		return 1;
+	}
+	prof = Profile_Match(rom);
+	if (prof) {
+		for (i = 0; i < prof->num_frags; i++) {
+			if (prof->frags[i].num != num) continue;
+			*fi = prof->frags[i];
+			return 0;
+		}
+		return 1;
+	}
+
+	scratch = malloc(FRAGSEARCH_CHUNK + sizeof(struct fragment_s));
+	if (!scratch) return -1;
+	if (rom->size > FRAGFIND_START) pos = FRAGFIND_START;
+	while (next_header(rom, &pos, rom->size, scratch)) {
+		struct fragment_s hdr;
+		RomView_Read(rom, &hdr, pos, sizeof(hdr));
+		get_fraginfo(fi, &hdr, pos);
+		if (!frag_sane(rom, fi)) {
+			pos += 16;
+			continue;
+		}
+		if (fi->num == num) {
+			uint8_t *p = RomView_Get(rom, fi->addr, fi->romsize);
+			free(scratch);
+			if (!p) return -1;
+			Hash_Frag(fi, p, fi->romsize);
+			RomView_Put(rom, p);
+			return 0;
+		}
+		pos += fi->romsize;
+	}
+	free(scratch);
+
+	if (Frag_Search(rom, &frags, &n)) return -1;
+	for (i = 0; i < n; i++)
+		if (frags[i].num == num) break;
+	if (i < n) *fi = frags[i];
+	free(frags);
+	return (i < n)? 0: 1;
+}
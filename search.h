@@ -0,0 +1,24 @@
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+#include <stddef.h>
+#include "fragindex.h"
+#include "fragment.h"
+#include "romview.h"
+
+// bytes of rom that Frag_Search looks at per chunk
+#define FRAGSEARCH_CHUNK (65536)
+
+// where Frag_Find starts looking
+#define FRAGFIND_START (0x100000)
+
+int Frag_Search(struct RomView_s *rom, struct fraginfo_s **frags, size_t *num);
+int Frag_Find(struct RomView_s *rom, int32_t num, struct fraginfo_s *fi);
+void Frag_UseIndex(struct fragindex_s *fx);
+void Frag_IgnoreIndex(char *what);
+int Frag_Depends(struct RomView_s *rom, int32_t num, const int32_t **deps,
+	size_t *n);
+const struct fragindex_interval_s *Frag_Intervals(struct RomView_s *rom,
+	size_t num);
+int Frag_SearchRange(struct RomView_s *rom, uint64_t start, uint64_t end,
+	struct fraginfo_s **frags, size_t *num);
+#endif
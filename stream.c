@@ -0,0 +1,185 @@
+#ifdef __MINGW32__
+#include <winsock.h>
+#else
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#endif
+#include <errno.h>
+#include <iso646.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hash.h"
+#include "pcode.h"
+#include "romview.h"
+#include "stream.h"
+
+// a fragment whose payload hasn't gone past yet
+struct pending_s {
+	struct fraginfo_s fi;
+	uint8_t *payload;	// for hashing, NULL if too big
+	FILE *f;		// when extracting
+	uint64_t pos;
+	uint64_t end;
+};
+
+static ssize_t read_full(int fd, uint8_t *buf, size_t len)
+{
+	size_t got = 0;
+	ssize_t rc;
+
+	while (got < len) {
+		rc = read(fd, buf + got, len - got);
+		if (rc < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (rc == 0) break;
+		got += rc;
+	}
+	return got;
+}
+
+/*
+ * Scan a rom from a file descriptor that can't be mapped or seeked, like
+ * a pipe. Memory use is one block plus the open extract files no matter
+ * how big the input is.
+ *
+ * The callback for a fragment is made once its payload has gone past and
+ * been hashed, so they don't come in rom order.
+ *
+ * Returns 0, FRAGSTREAM_NOMEM if out of memory, -1 on another error, or
+ * whatever nonzero value the callback returned.
+ */
+int FragStream_Scan(int fd, fragstream_cb cb, void *ctx, bool extract)
+{
+	__label__ out_return;
+	uint8_t *buf;
+	uint64_t base = 0;	// stream offset of buf[0]
+	size_t len = 0;		// valid bytes in buf
+	size_t carry = 0;
+	ssize_t got;
+	bool eof = false;
+	char pcode[6] = "_____";
+	enum rom_order_e order = ROM_ORDER_Z64;
+	struct pending_s *pend = NULL;
+	size_t num_pend = 0;
+	int rc = 0;
+
+	buf = malloc(FRAGSTREAM_CARRY + FRAGSTREAM_BLOCK);
+	if (!buf) return FRAGSTREAM_NOMEM;
+
+	for (;;) {
+		got = read_full(fd, buf + carry, FRAGSTREAM_BLOCK);
+		if (got < 0) {
+			rc = -1;
+			goto out_return;
+		}
+		/*
+		 * A short read is the end of the input. Reading on could
+		 * get more from a tty, past the room left after an odd carry.
+		 */
+		eof = (got < FRAGSTREAM_BLOCK);
+		len = carry + got;
+		if (base == 0) {
+			if (len < 0x40) break;
+			order = RomView_DetectOrder(buf, len);
+		}
+		// blocks are whole words, so they can be swapped in place
+		RomView_Swap(buf + carry, buf + carry, got, order);
+		if (base == 0)
+			get_pcode(pcode, buf);
+
+		size_t i;
+		for (i = 0; i + sizeof(struct fragment_s) <= len; i += 16) {
+			struct fragment_s *frag = (struct fragment_s *)(buf + i);
+			if (!isfrag(frag)) continue;
+
+			struct pending_s *newpend;
+			newpend = realloc(pend, (num_pend + 1) * sizeof(*pend));
+			if (!newpend) {
+				rc = FRAGSTREAM_NOMEM;
+				goto out_return;
+			}
+			pend = newpend;
+			struct pending_s *p = &pend[num_pend++];
+			get_fraginfo(&p->fi, frag, base + i);
+			p->payload = NULL;
+			p->f = NULL;
+			p->pos = p->fi.addr;
+			p->end = p->fi.addr + p->fi.romsize;
+			if (p->fi.romsize <= FRAGSTREAM_MAXFRAG) {
+				p->payload = malloc(p->fi.romsize? p->fi.romsize: 1);
+				if (!p->payload) {
+					rc = FRAGSTREAM_NOMEM;
+					goto out_return;
+				}
+			}
+
+			if (!extract or (p->fi.num < 0)) continue;
+			char *outname = NULL;
+			if (asprintf(&outname, "%s-frag%03d.bin", pcode, p->fi.num) == -1) {
+				rc = -1;
+				goto out_return;
+			}
+			p->f = fopen(outname, "wb");
+			free(outname);
+			if (!p->f) {
+				rc = -1;
+				goto out_return;
+			}
+		}
+
+		// feed the payloads that overlap this block
+		for (size_t j = 0; j < num_pend; ) {
+			struct pending_s *p = &pend[j];
+			uint64_t stop = base + len;
+			if (p->end < stop) stop = p->end;
+			if (p->pos < stop) {
+				if (p->payload)
+					memcpy(p->payload + (p->pos - p->fi.addr),
+						buf + (p->pos - base), stop - p->pos);
+				if (p->f and (fwrite(buf + (p->pos - base), 1,
+				    stop - p->pos, p->f) != stop - p->pos)) {
+					rc = -1;
+					goto out_return;
+				}
+				p->pos = stop;
+			}
+			if ((p->pos < p->end) and not eof) {
+				j++;
+				continue;
+			}
+			if (p->payload)
+				Hash_Frag(&p->fi, p->payload, p->pos - p->fi.addr);
+			free(p->payload);
+			p->payload = NULL;
+			if (p->f and fclose(p->f)) {
+				p->f = NULL;
+				rc = -1;
+				goto out_return;
+			}
+			p->f = NULL;
+			rc = cb(ctx, pcode, &p->fi);
+			*p = pend[--num_pend];
+			if (rc) goto out_return;
+		}
+
+		if (eof) break;
+
+		// keep the bytes that may still start a header
+		carry = len - i;
+		memmove(buf, buf + i, carry);
+		base += i;
+	}
+
+out_return:
+	for (size_t j = 0; j < num_pend; j++) {
+		free(pend[j].payload);
+		if (pend[j].f) fclose(pend[j].f);
+	}
+	free(pend);
+	free(buf);
+	return rc;
+}
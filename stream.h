@@ -0,0 +1,28 @@
+#ifndef _STREAM_H_
+#define _STREAM_H_
+#include <inttypes.h>
+#include <stdbool.h>
+#include "fragment.h"
+
+// bytes read per block
+#define FRAGSTREAM_BLOCK (65536)
+
+/*
+ * A header that starts in the last 16 bytes of a block is finished by the
+ * next one, so that much is carried over between blocks.
+ */
+#define FRAGSTREAM_CARRY (sizeof(struct fragment_s) - 16)
+
+/*
+ * Payloads are buffered to be hashed. Nothing bigger than RDRAM can be a
+ * real fragment, so bigger ones are reported without hashes.
+ */
+#define FRAGSTREAM_MAXFRAG (8 * 1048576)
+
+// returned by FragStream_Scan when a buffer can't be allocated
+#define FRAGSTREAM_NOMEM (-2)
+
+typedef int (*fragstream_cb)(void *ctx, char *pcode, struct fraginfo_s *fi);
+
+int FragStream_Scan(int fd, fragstream_cb cb, void *ctx, bool extract);
+#endif
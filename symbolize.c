@@ -0,0 +1,250 @@
+#include <ctype.h>
+#include <iso646.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symbolize.h"
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(uint64_t *)a, y = *(uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int cmp_interval(const void *a, const void *b)
+{
+	const struct fragindex_interval_s *x = a, *y = b;
+	if (x->start != y->start) return (x->start > y->start)? 1: -1;
+	return (x->frag > y->frag) - (x->frag < y->frag);
+}
+
+static int cmp_sym(const void *a, const void *b)
+{
+	uint32_t x = ((struct sym_s *)a)->addr, y = ((struct sym_s *)b)->addr;
+	return (x > y) - (x < y);
+}
+
+static bool is_loaded(int num, int *loaded, size_t num_loaded)
+{
+	for (size_t i = 0; i < num_loaded; i++)
+		if (loaded[i] == num) return true;
+	return false;
+}
+
+// whether fragment i beats best, where lower numbers win
+static bool better(struct fraginfo_s *frags, uint32_t i, int32_t best)
+{
+	if (best < 0) return true;
+	if (frags[i].num != frags[best].num) return frags[i].num < frags[best].num;
+	return i < (uint32_t)best;
+}
+
+/*
+ * Index the ram ranges of frags, which have to stay around. Where
+ * fragments overlap, one whose number is in loaded wins, then the lowest
+ * numbered. intervals is the ranges sorted by vma, as an index has them,
+ * or NULL to sort them here. The segments are made in one sweep, with
+ * only the ranges that cover the current one looked at.
+ * Returns 0, or -1 if out of memory.
+ */
+int SymIndex_Build(struct symindex_s *si, struct fraginfo_s *frags,
+	size_t num_frags, const struct fragindex_interval_s *intervals,
+	int *loaded, size_t num_loaded)
+{
+	__label__ out_free;
+	struct fragindex_interval_s *sorted = NULL;
+	uint64_t *points;
+	uint32_t *active;	// into intervals
+	size_t num_points = 0, num_active = 0, next = 0;
+	int rc = -1;
+
+	memset(si, 0, sizeof(*si));
+	si->frags = frags;
+	points = malloc((2 * num_frags + 1) * sizeof(*points));
+	active = malloc((num_frags + 1) * sizeof(*active));
+	if (!points or !active) goto out_free;
+	if (!intervals) {
+		sorted = malloc((num_frags + 1) * sizeof(*sorted));
+		if (!sorted) goto out_free;
+		for (size_t i = 0; i < num_frags; i++) {
+			sorted[i].start = frags[i].vma;
+			sorted[i].end = (uint64_t)frags[i].vma + frags[i].ramsize;
+			sorted[i].frag = i;
+		}
+		qsort(sorted, num_frags, sizeof(*sorted), cmp_interval);
+		intervals = sorted;
+	}
+	for (size_t i = 0; i < num_frags; i++) {
+		if (!frags[i].ramsize) continue;
+		points[num_points++] = frags[i].vma;
+		points[num_points++] = (uint64_t)frags[i].vma + frags[i].ramsize;
+	}
+	qsort(points, num_points, sizeof(*points), cmp_u64);
+
+	si->segs = malloc((num_points + 1) * sizeof(*si->segs));
+	if (!si->segs) goto out_free;
+	for (size_t p = 0; p < num_points; p++) {
+		// the top of the address space ends the last segment
+		if ((p and (points[p] == points[p - 1])) or (points[p] > UINT32_MAX))
+			continue;
+		struct symseg_s *seg = &si->segs[si->num_segs++];
+		uint32_t loaded_count = 0;
+		int32_t loaded_best = -1;
+		seg->start = points[p];
+		seg->count = 0;
+		seg->best = -1;
+
+		// take in the ranges that have started, drop those that ended
+		while ((next < num_frags) and (intervals[next].start <= seg->start))
+			active[num_active++] = next++;
+		for (size_t a = 0; a < num_active; ) {
+			if (intervals[active[a]].end <= seg->start)
+				active[a] = active[--num_active];
+			else
+				a++;
+		}
+
+		for (size_t a = 0; a < num_active; a++) {
+			uint32_t i = intervals[active[a]].frag;
+			if (i >= num_frags) continue;
+			seg->count++;
+			if (better(frags, i, seg->best)) seg->best = i;
+			if (!is_loaded(frags[i].num, loaded, num_loaded)) continue;
+			loaded_count++;
+			if (better(frags, i, loaded_best)) loaded_best = i;
+		}
+		if (loaded_count) {
+			seg->count = loaded_count;
+			seg->best = loaded_best;
+		}
+	}
+	rc = 0;
+
+out_free:
+	free(points);
+	free(active);
+	free(sorted);
+	return rc;
+}
+
+/*
+ * Read symbols from a file of either "name = 0xaddr;" lines, as in a
+ * linker script, or "addr [type] name" lines, as nm writes them.
+ * Returns 0, or -1 if it couldn't be read.
+ */
+int SymIndex_LoadSymbols(struct symindex_s *si, char *filename)
+{
+	FILE *f;
+	char line[512];
+	size_t cap = si->num_syms;
+
+	f = fopen(filename, "r");
+	if (!f) return -1;
+	while (fgets(line, sizeof(line), f)) {
+		char *name, *end, *p;
+		unsigned long addr;
+
+		if ((p = strstr(line, "//"))) *p = '\0';
+		if ((p = strchr(line, ';'))) *p = '\0';
+		if ((p = strchr(line, '='))) {
+			*p = '\0';
+			addr = strtoul(p + 1, &end, 0);
+			if (end == p + 1) continue;
+			name = line;
+		} else {
+			addr = strtoul(line, &end, 16);
+			if (end == line) continue;
+			name = strrchr(line, ' ');
+			if (!name) name = strrchr(line, '\t');
+			if (!name) continue;
+		}
+		while (isspace((unsigned char)*name)) name++;
+		p = name + strlen(name);
+		while ((p > name) and isspace((unsigned char)p[-1])) *--p = '\0';
+		p = name;
+		while (*p and !isspace((unsigned char)*p)) p++;
+		*p = '\0';
+		if (!*name) continue;
+
+		if (si->num_syms == cap) {
+			struct sym_s *syms;
+			cap = cap? 2 * cap: 1024;
+			syms = realloc(si->syms, cap * sizeof(*syms));
+			if (!syms) break;
+			si->syms = syms;
+		}
+		si->syms[si->num_syms].addr = addr;
+		si->syms[si->num_syms].name = strdup(name);
+		if (si->syms[si->num_syms].name) si->num_syms++;
+	}
+	fclose(f);
+	qsort(si->syms, si->num_syms, sizeof(*si->syms), cmp_sym);
+	return 0;
+}
+
+static bool in_seg(struct symindex_s *si, size_t s, uint32_t addr)
+{
+	if (addr < si->segs[s].start) return false;
+	return (s + 1 == si->num_segs) or (addr < si->segs[s + 1].start);
+}
+
+/*
+ * The fragment addr is in, or NULL. ambiguous is set to how many
+ * fragments it could have been. Traces tend to stay put, so the last
+ * segment is tried first.
+ */
+struct fraginfo_s *SymIndex_Lookup(struct symindex_s *si, uint32_t addr,
+	uint32_t *ambiguous)
+{
+	size_t lo = 0, hi = si->num_segs;
+
+	*ambiguous = 0;
+	if (!si->num_segs or (addr < si->segs[0].start)) return NULL;
+	if ((si->last < si->num_segs) and in_seg(si, si->last, addr)) {
+		lo = si->last;
+	} else {
+		// last segment starting at or before addr
+		while (hi - lo > 1) {
+			size_t mid = (lo + hi) / 2;
+			if (si->segs[mid].start <= addr) lo = mid;
+			else hi = mid;
+		}
+		si->last = lo;
+	}
+	if (si->segs[lo].best < 0) return NULL;
+	*ambiguous = si->segs[lo].count;
+	return &si->frags[si->segs[lo].best];
+}
+
+/*
+ * The closest symbol at or before addr, or NULL. If fi is given the
+ * symbol has to be in it too, and if not the symbol can't be in any
+ * fragment.
+ */
+struct sym_s *SymIndex_Symbol(struct symindex_s *si, uint32_t addr,
+	struct fraginfo_s *fi)
+{
+	size_t lo = 0, hi = si->num_syms;
+
+	if (!si->num_syms or (addr < si->syms[0].addr)) return NULL;
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (si->syms[mid].addr <= addr) lo = mid;
+		else hi = mid;
+	}
+	if (fi and (si->syms[lo].addr < fi->vma)) return NULL;
+	if (!fi) {
+		uint32_t ambiguous;
+		if (SymIndex_Lookup(si, si->syms[lo].addr, &ambiguous)) return NULL;
+	}
+	return &si->syms[lo];
+}
+
+void SymIndex_Free(struct symindex_s *si)
+{
+	for (size_t i = 0; i < si->num_syms; i++)
+		free(si->syms[i].name);
+	free(si->syms);
+	free(si->segs);
+	memset(si, 0, sizeof(*si));
+}
@@ -0,0 +1,44 @@
+#ifndef _SYMBOLIZE_H_
+#define _SYMBOLIZE_H_
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "fragindex.h"
+#include "fragment.h"
+
+/*
+ * Which fragment a ram address is in. Fragments can overlap, so the
+ * [vma, vma+ramsize) ranges are cut at every start and end into
+ * segments, and each segment is resolved to one fragment up front. A
+ * lookup is a binary search over the segments.
+ */
+struct symseg_s {
+	uint32_t start;		// up to the next segment's start
+	uint32_t count;		// fragments it could be
+	int32_t best;		// index into frags, -1 if nothing covers it
+};
+
+struct sym_s {
+	uint32_t addr;
+	char *name;
+};
+
+struct symindex_s {
+	struct fraginfo_s *frags;
+	struct symseg_s *segs;
+	size_t num_segs;
+	struct sym_s *syms;	// sorted by address
+	size_t num_syms;
+	size_t last;		// segment of the last lookup
+};
+
+int SymIndex_Build(struct symindex_s *si, struct fraginfo_s *frags,
+	size_t num_frags, const struct fragindex_interval_s *intervals,
+	int *loaded, size_t num_loaded);
+int SymIndex_LoadSymbols(struct symindex_s *si, char *filename);
+struct fraginfo_s *SymIndex_Lookup(struct symindex_s *si, uint32_t addr,
+	uint32_t *ambiguous);
+struct sym_s *SymIndex_Symbol(struct symindex_s *si, uint32_t addr,
+	struct fraginfo_s *fi);
+void SymIndex_Free(struct symindex_s *si);
+#endif
@@ -0,0 +1,191 @@
+#ifdef __MINGW32__
+#include <winsock.h>
+#else
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#endif
+#include <iso646.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+#include "reloc.h"
+#include "verify.h"
+
+struct verify_s {
+	struct RomView_s *rom;
+	struct fraginfo_s *frags;
+	size_t num_frags;
+	int32_t by_num[256];	// first fragment with num - 16, -1 if none
+	struct outbuf_s *out;	// per fragment
+	size_t *relocs;
+	size_t *problems;
+};
+
+static uint32_t load_be32(uint8_t *p)
+{
+	uint32_t w;
+	memcpy(&w, p, 4);
+	return ntohl(w);
+}
+
+static struct fraginfo_s *frag_by_num(struct verify_s *v, int32_t num)
+{
+	if ((num < -16) or (num > 239) or (v->by_num[num + 16] < 0)) return NULL;
+	return &v->frags[v->by_num[num + 16]];
+}
+
+// one line of the report: what is wrong, where in the fragment, and the value
+static void problem(struct verify_s *v, size_t index, const char *check,
+	uint32_t offset, uint64_t value)
+{
+	struct fraginfo_s *fi = &v->frags[index];
+
+	OutBuf_Printf(&v->out[index], "%d,0x%" PRIx64 ",%s,0x%x,0x%" PRIx64 "\n",
+		fi->num, fi->addr, check, offset, value);
+	v->problems[index]++;
+}
+
+// does a relocation refer to somewhere that's there
+static bool target_resolves(struct verify_s *v, struct fraginfo_s *fi,
+	struct reloc_s *r)
+{
+	struct fraginfo_s *t;
+
+	// the %lo of a far address is only the low half, its %hi says where
+	if (r->foreign and (r->type == RELOC_ADDIU)) return true;
+	if (r->loc == (uint32_t)-1) return false;
+	if (!r->foreign and (r->target_frag != fi->num)) return false;
+	if (r->target_frag < 0) return r->loc >= 0x80000000;
+	t = frag_by_num(v, r->target_frag);
+	if (!t) return false;
+	if (r->type == RELOC_LUI) return true;
+	return (r->loc >= t->vma) and (r->loc - t->vma <= t->ramsize);
+}
+
+static void check_relocs(struct verify_s *v, size_t index, uint8_t *p,
+	uint32_t len)
+{
+	struct fraginfo_s *fi = &v->frags[index];
+	uint32_t off = fi->offset_relocs;
+	uint32_t num = load_be32(p + off);
+
+	if (num > (len - off - 4) / 4) {
+		problem(v, index, "num_relocs", off, num);
+		num = (len - off - 4) / 4;
+	}
+	v->relocs[index] = num;
+	for (uint32_t i = 0; i < num; i++) {
+		uint32_t at = off + 4 + 4 * i;
+		uint32_t reloc = load_be32(p + at);
+		struct reloc_s r;
+
+		switch (reloc & RELOC_TYPE_MASK) {
+		case RELOC_PTR:
+		case RELOC_J:
+		case RELOC_LUI:
+		case RELOC_ADDIU:
+			break;
+		default:
+			problem(v, index, "reloc_type", at, reloc);
+			continue;
+		}
+		// patched words are in the code or data, before the table
+		if (((reloc & RELOC_ADDR_MASK) & 3) or
+		    ((reloc & RELOC_ADDR_MASK) + 4 > off)) {
+			problem(v, index, "reloc_addr", at, reloc);
+			continue;
+		}
+		Reloc_Decode(&r, reloc, p, len);
+		if (!target_resolves(v, fi, &r))
+			problem(v, index, "reloc_target", at, r.loc);
+	}
+}
+
+static void verify_worker(void *ctx, size_t index)
+{
+	struct verify_s *v = ctx;
+	struct fraginfo_s *fi = &v->frags[index];
+	uint64_t left = v->rom->size - fi->addr;
+	uint32_t len = fi->romsize;
+	uint8_t *p;
+
+	if (frag_by_num(v, fi->num) != fi)
+		problem(v, index, "duplicate", 0, fi->num);
+	if ((index + 1 < v->num_frags) and
+	    (fi->addr + fi->romsize > v->frags[index + 1].addr))
+		problem(v, index, "overlap", 0x18, fi->romsize);
+	if ((fi->romsize < sizeof(struct fragment_s)) or (fi->romsize > left)) {
+		problem(v, index, "romsize", 0x18, fi->romsize);
+		return;
+	}
+	if ((fi->ramsize < fi->offset_relocs) or (fi->ramsize > VERIFY_SLOT))
+		problem(v, index, "ramsize", 0x1c, fi->ramsize);
+	if ((fi->offset_code & 3) or (fi->offset_code > fi->offset_relocs))
+		problem(v, index, "offset_code", 0x10, fi->offset_code);
+	if ((fi->entrypoint < fi->vma) or
+	    (fi->entrypoint - fi->vma >= get_text_end(fi)))
+		problem(v, index, "entrypoint", 0, fi->entrypoint);
+	if ((fi->offset_relocs & 3) or
+	    (fi->offset_relocs < sizeof(struct fragment_s)) or
+	    (fi->offset_relocs > len - 4)) {
+		problem(v, index, "offset_relocs", 0x14, fi->offset_relocs);
+		return;
+	}
+
+	p = RomView_Get(v->rom, fi->addr, len);
+	if (!p) {
+		v->out[index].error = true;
+		return;
+	}
+	check_relocs(v, index, p, len);
+	RomView_Put(v->rom, p);
+}
+
+/*
+ * Check that the headers and relocation tables of the fragments of a rom
+ * make sense, one fragment per thread. frags must be in rom order, as
+ * Frag_Search gives them. Each problem found is a line of
+ *	num,addr,check,offset,value
+ * in ob, in rom order, where offset is of the header field or relocation
+ * at fault within the fragment.
+ * Returns 0, or -1 if out of memory.
+ */
+int Verify_Frags(struct outbuf_s *ob, struct RomView_s *rom,
+	struct fraginfo_s *frags, size_t num, struct verify_totals_s *t)
+{
+	__label__ out_free;
+	struct verify_s v = { .rom = rom, .frags = frags, .num_frags = num };
+	int rc = 0;
+
+	memset(t, 0, sizeof(*t));
+	memset(v.by_num, 0xff, sizeof(v.by_num));
+	for (size_t i = num; i-- > 0; )
+		if ((frags[i].num >= -16) and (frags[i].num <= 239))
+			v.by_num[frags[i].num + 16] = i;
+
+	v.out = calloc(num? num: 1, sizeof(*v.out));
+	v.relocs = calloc(num? num: 1, sizeof(*v.relocs));
+	v.problems = calloc(num? num: 1, sizeof(*v.problems));
+	if (!v.out or !v.relocs or !v.problems) {
+		rc = -1;
+		goto out_free;
+	}
+	Pool_Run(num, verify_worker, &v);
+
+	t->frags = num;
+	for (size_t i = 0; i < num; i++) {
+		if (v.out[i].error) rc = -1;
+		if (v.out[i].len)
+			OutBuf_Write(ob, v.out[i].p, v.out[i].len);
+		OutBuf_Free(&v.out[i]);
+		t->relocs += v.relocs[i];
+		t->problems += v.problems[i];
+	}
+
+out_free:
+	free(v.out);
+	free(v.relocs);
+	free(v.problems);
+	return rc;
+}
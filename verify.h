@@ -0,0 +1,20 @@
+#ifndef _VERIFY_H_
+#define _VERIFY_H_
+#include <inttypes.h>
+#include <stddef.h>
+#include "fragment.h"
+#include "outbuf.h"
+#include "romview.h"
+
+// address space each fragment number is linked into
+#define VERIFY_SLOT (0x100000)
+
+struct verify_totals_s {
+	size_t frags;
+	size_t relocs;
+	size_t problems;
+};
+
+int Verify_Frags(struct outbuf_s *ob, struct RomView_s *rom,
+	struct fraginfo_s *frags, size_t num, struct verify_totals_s *t);
+#endif
@@ -0,0 +1,574 @@
+#ifdef __MINGW32__
+#include <winsock.h>
+#else
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#endif
+#include <iso646.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mapfile.h"
+#include "mips.h"
+#include "outbuf.h"
+#include "pcode.h"
+#include "reloc.h"
+#include "search.h"
+#include "vtab.h"
+
+/*
+ * rom_frags('<rom>') and rom_relocs('<rom>') read a rom straight from
+ * its file, with no mkdb first. Each rom named is mapped the first time
+ * it's used, scanned the first time a query wants all of its fragments,
+ * and kept for as long as the connection is open, so a join or a second
+ * query doesn't scan again. A num = constraint is handed down, so that
+ * one fragment is looked up with Frag_Find instead of scanning, and
+ * rom_relocs only reads its relocations. Once a rom has been scanned, or
+ * for a negative num that every header without an entrypoint has, all
+ * the fragments with that num are returned instead.
+ *
+ * There are also scalar functions for taking apart what's in the
+ * tables, with the same decoding psfrag uses:
+ *	reloc_type(reloc)		ptr, j, lui, addiu or unknown
+ *	reloc_target(rom, num, reloc)	address a relocation refers to
+ *	mips_disasm(insn, pc)		one instruction
+ *	frag_of_addr(addr)		fragment linked at an address
+ *	be32(blob, offset)		big-endian word
+ */
+
+// a rom that has been mapped and scanned
+struct romcache_s {
+	struct romcache_s *next;
+	char *filename;
+	struct MappedFile_s m;
+	struct RomView_s rom;
+	char pcode[6];
+	bool scanned;			// frags has all of them
+	struct fraginfo_s *frags;
+	size_t num_frags;
+};
+
+struct romtab_s {
+	sqlite3_vtab base;
+	struct romcache_s **cache;	// shared by both tables
+	bool relocs;
+};
+
+struct romcursor_s {
+	sqlite3_vtab_cursor base;
+	struct romcache_s *rc;
+	struct fraginfo_s *frags;	// the rom's, or just one
+	struct fraginfo_s one;		// what a num = lookup found
+	size_t frag, frag_end;		// fragments still to go
+	bool by_num;			// only those with this num
+	int64_t num;
+	uint8_t *bytes;			// of frag, for rom_relocs
+	size_t size;
+	uint8_t *table;
+	uint32_t reloc, num_relocs;
+	int64_t rowid;
+};
+
+// idxNum bits
+#define ROMTAB_ROM	1
+#define ROMTAB_NUM	2
+
+enum {
+	FRAGS_PCODE, FRAGS_ADDR, FRAGS_NUM, FRAGS_ENTRYPOINT,
+	FRAGS_OFFSET_CODE, FRAGS_OFFSET_RELOCS, FRAGS_ROMSIZE, FRAGS_RAMSIZE,
+	FRAGS_VMA, FRAGS_HASH, FRAGS_FINGERPRINT, FRAGS_ROM,
+};
+
+enum {
+	RELOCS_NUM, RELOCS_IDX, RELOCS_RELOC, RELOCS_FOREIGN, RELOCS_TYPE,
+	RELOCS_ADDR, RELOCS_TARGET_ADDR, RELOCS_TARGET_FRAG, RELOCS_ROM,
+};
+
+static void cache_free(void *p)
+{
+	struct romcache_s **cache = p, *rc, *next;
+
+	for (rc = *cache; rc; rc = next) {
+		next = rc->next;
+		free(rc->frags);
+		free(rc->filename);
+		MappedFile_Close(rc->m);
+		free(rc);
+	}
+	free(cache);
+}
+
+static struct romcache_s *cache_get(struct romcache_s **cache,
+	const char *filename, char **err)
+{
+	struct romcache_s *rc;
+
+	for (rc = *cache; rc; rc = rc->next)
+		if (!strcmp(rc->filename, filename)) return rc;
+
+	rc = calloc(1, sizeof(*rc));
+	if (!rc) return NULL;
+	rc->filename = strdup(filename);
+	rc->m = MappedFile_Open(rc->filename? rc->filename: "", false);
+	if (!rc->filename or !rc->m.data) {
+		*err = sqlite3_mprintf("couldn't open rom %s", filename);
+		free(rc->filename);
+		free(rc);
+		return NULL;
+	}
+	RomView_Init(&rc->rom, rc->m.data, rc->m.size);
+	get_pcode(rc->pcode, rc->rom.header);
+	rc->next = *cache;
+	*cache = rc;
+	return rc;
+}
+
+// find every fragment of a rom, once. Returns 0, or -1 if out of memory.
+static int cache_scan(struct romcache_s *rc)
+{
+	if (rc->scanned) return 0;
+	if (Frag_Search(&rc->rom, &rc->frags, &rc->num_frags)) return -1;
+	rc->scanned = true;
+	return 0;
+}
+
+/*
+ * Find fragment num of a rom: the first one in the full list if it's been
+ * scanned already, and with Frag_Find if not. Returns as Frag_Find.
+ */
+static int cache_find(struct romcache_s *rc, int64_t num,
+	struct fraginfo_s *fi)
+{
+	if (rc->scanned) {
+		for (size_t i = 0; i < rc->num_frags; i++) {
+			if (rc->frags[i].num != num) continue;
+			*fi = rc->frags[i];
+			return 0;
+		}
+		return 1;
+	}
+	if ((num < INT32_MIN) or (num > INT32_MAX)) return 1;
+	return Frag_Find(&rc->rom, num, fi);
+}
+
+static int romtab_connect(sqlite3 *db, void *aux, int argc,
+	const char *const *argv, sqlite3_vtab **vtab, char **err)
+{
+	struct romtab_s *t;
+	bool relocs = !strcmp(argv[0], "rom_relocs");
+	int rc;
+
+	rc = sqlite3_declare_vtab(db, relocs?
+		"create table x(num int, idx int, reloc int, far int, type text, "
+		"addr int, target_addr int, target_frag int, rom hidden)":
+		"create table x(pcode text, addr int, num int, entrypoint int, "
+		"offset_code int, offset_relocs int, romsize int, ramsize int, "
+		"vma int, hash int, fingerprint int, rom hidden)");
+	if (rc != SQLITE_OK) return rc;
+	t = sqlite3_malloc(sizeof(*t));
+	if (!t) return SQLITE_NOMEM;
+	memset(t, 0, sizeof(*t));
+	t->cache = aux;
+	t->relocs = relocs;
+	*vtab = &t->base;
+	return SQLITE_OK;
+}
+
+static int romtab_disconnect(sqlite3_vtab *vtab)
+{
+	sqlite3_free(vtab);
+	return SQLITE_OK;
+}
+
+static int romtab_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+	struct romtab_s *t = (struct romtab_s *)vtab;
+	int rom_col = t->relocs? RELOCS_ROM: FRAGS_ROM;
+	int num_col = t->relocs? RELOCS_NUM: FRAGS_NUM;
+	int rom = -1, num = -1;
+
+	for (int i = 0; i < info->nConstraint; i++) {
+		struct sqlite3_index_constraint *c = &info->aConstraint[i];
+		if (c->op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+		if (c->iColumn == rom_col) {
+			// without a usable rom there's nothing to read
+			if (!c->usable) return SQLITE_CONSTRAINT;
+			rom = i;
+		} else if ((c->iColumn == num_col) and c->usable) {
+			num = i;
+		}
+	}
+	if (rom < 0) {
+		sqlite3_free(vtab->zErrMsg);
+		vtab->zErrMsg = sqlite3_mprintf("%s needs a rom",
+			t->relocs? "rom_relocs": "rom_frags");
+		return SQLITE_ERROR;
+	}
+	info->idxNum = ROMTAB_ROM;
+	info->aConstraintUsage[rom].argvIndex = 1;
+	info->aConstraintUsage[rom].omit = 1;
+	info->estimatedCost = t->relocs? 100000: 1000;
+	if (num >= 0) {
+		info->idxNum |= ROMTAB_NUM;
+		info->aConstraintUsage[num].argvIndex = 2;
+		info->aConstraintUsage[num].omit = 1;
+		info->estimatedCost /= 100;
+		if (!t->relocs) info->estimatedRows = 1;
+	}
+	return SQLITE_OK;
+}
+
+static int romtab_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+	struct romcursor_s *c = sqlite3_malloc(sizeof(*c));
+	if (!c) return SQLITE_NOMEM;
+	memset(c, 0, sizeof(*c));
+	*cursor = &c->base;
+	return SQLITE_OK;
+}
+
+static void put_frag(struct romcursor_s *c)
+{
+	if (c->bytes) RomView_Put(&c->rc->rom, c->bytes);
+	c->bytes = NULL;
+	c->table = NULL;
+	c->reloc = c->num_relocs = 0;
+}
+
+static int romtab_close(sqlite3_vtab_cursor *cursor)
+{
+	put_frag((struct romcursor_s *)cursor);
+	sqlite3_free(cursor);
+	return SQLITE_OK;
+}
+
+// move on past the fragments a num = constraint leaves out
+static void skip_frags(struct romcursor_s *c)
+{
+	while (c->by_num and (c->frag < c->frag_end)
+		and (c->frags[c->frag].num != c->num))
+		c->frag++;
+}
+
+// move rom_relocs on to the next fragment that has relocations
+static int load_relocs(struct romcursor_s *c)
+{
+	for (skip_frags(c); c->frag < c->frag_end; c->frag++, skip_frags(c)) {
+		struct fraginfo_s *fi = &c->frags[c->frag];
+		c->size = fi->romsize;
+		if (c->size > c->rc->rom.size - fi->addr)
+			c->size = c->rc->rom.size - fi->addr;
+		c->bytes = RomView_Get(&c->rc->rom, fi->addr, c->size);
+		if (!c->bytes) return SQLITE_NOMEM;
+		c->table = Reloc_Table(c->bytes, c->size, &c->num_relocs);
+		c->reloc = 0;
+		if (c->num_relocs) return SQLITE_OK;
+		put_frag(c);
+	}
+	return SQLITE_OK;
+}
+
+static int romtab_next(sqlite3_vtab_cursor *cursor)
+{
+	struct romcursor_s *c = (struct romcursor_s *)cursor;
+	struct romtab_s *t = (struct romtab_s *)cursor->pVtab;
+
+	c->rowid++;
+	if (!t->relocs) {
+		c->frag++;
+		skip_frags(c);
+		return SQLITE_OK;
+	}
+	if (++c->reloc < c->num_relocs) return SQLITE_OK;
+	put_frag(c);
+	c->frag++;
+	return load_relocs(c);
+}
+
+static int romtab_filter(sqlite3_vtab_cursor *cursor, int idx_num,
+	const char *idx_str, int argc, sqlite3_value **argv)
+{
+	struct romcursor_s *c = (struct romcursor_s *)cursor;
+	struct romtab_s *t = (struct romtab_s *)cursor->pVtab;
+	const char *filename;
+	char *err = NULL;
+
+	if (c->rc) put_frag(c);
+	c->rc = NULL;
+	c->frag = c->frag_end = 0;
+	c->by_num = false;
+	c->rowid = 0;
+
+	filename = (const char *)sqlite3_value_text(argv[0]);
+	if (!filename) return SQLITE_OK;
+	c->rc = cache_get(t->cache, filename, &err);
+	if (!c->rc) {
+		if (!err) return SQLITE_NOMEM;
+		sqlite3_free(t->base.zErrMsg);
+		t->base.zErrMsg = err;
+		return SQLITE_ERROR;
+	}
+
+	if (idx_num & ROMTAB_NUM) {
+		if (sqlite3_value_type(argv[1]) != SQLITE_INTEGER) return SQLITE_OK;
+		c->num = sqlite3_value_int64(argv[1]);
+		c->by_num = c->rc->scanned or (c->num < 0);
+	}
+	if ((idx_num & ROMTAB_NUM) and !c->by_num) {
+		switch (cache_find(c->rc, c->num, &c->one)) {
+		case -1:
+			return SQLITE_NOMEM;
+		case 1:
+			return SQLITE_OK;
+		}
+		c->frags = &c->one;
+		c->frag_end = 1;
+	} else {
+		if (cache_scan(c->rc)) return SQLITE_NOMEM;
+		c->frags = c->rc->frags;
+		c->frag_end = c->rc->num_frags;
+	}
+	if (t->relocs) return load_relocs(c);
+	skip_frags(c);
+	return SQLITE_OK;
+}
+
+static int romtab_eof(sqlite3_vtab_cursor *cursor)
+{
+	struct romcursor_s *c = (struct romcursor_s *)cursor;
+	return !c->rc or (c->frag >= c->frag_end);
+}
+
+static void frags_column(struct romcursor_s *c, sqlite3_context *ctx, int col)
+{
+	struct fraginfo_s *fi = &c->frags[c->frag];
+
+	switch (col) {
+	case FRAGS_PCODE:
+		sqlite3_result_text(ctx, c->rc->pcode, -1, SQLITE_TRANSIENT);
+		break;
+	case FRAGS_ADDR:
+		sqlite3_result_int64(ctx, fi->addr);
+		break;
+	case FRAGS_NUM:
+		sqlite3_result_int64(ctx, fi->num);
+		break;
+	case FRAGS_ENTRYPOINT:
+		sqlite3_result_int64(ctx, fi->entrypoint);
+		break;
+	case FRAGS_OFFSET_CODE:
+		sqlite3_result_int64(ctx, fi->offset_code);
+		break;
+	case FRAGS_OFFSET_RELOCS:
+		sqlite3_result_int64(ctx, fi->offset_relocs);
+		break;
+	case FRAGS_ROMSIZE:
+		sqlite3_result_int64(ctx, fi->romsize);
+		break;
+	case FRAGS_RAMSIZE:
+		sqlite3_result_int64(ctx, fi->ramsize);
+		break;
+	case FRAGS_VMA:
+		sqlite3_result_int64(ctx, fi->vma);
+		break;
+	case FRAGS_HASH:
+		sqlite3_result_int64(ctx, fi->hash);
+		break;
+	case FRAGS_FINGERPRINT:
+		sqlite3_result_int64(ctx, fi->fingerprint);
+		break;
+	case FRAGS_ROM:
+		sqlite3_result_text(ctx, c->rc->filename, -1, SQLITE_TRANSIENT);
+		break;
+	}
+}
+
+// the same columns as the relocs table cmd_depends builds
+static void relocs_column(struct romcursor_s *c, sqlite3_context *ctx, int col)
+{
+	struct reloc_s r;
+	uint32_t reloc = Reloc_Get(c->table, c->reloc);
+
+	Reloc_Decode(&r, reloc, c->bytes, c->size);
+	switch (col) {
+	case RELOCS_NUM:
+		sqlite3_result_int64(ctx, c->frags[c->frag].num);
+		break;
+	case RELOCS_IDX:
+		sqlite3_result_int64(ctx, c->reloc);
+		break;
+	case RELOCS_RELOC:
+		sqlite3_result_int64(ctx, reloc);
+		break;
+	case RELOCS_FOREIGN:
+		sqlite3_result_int(ctx, r.foreign);
+		break;
+	case RELOCS_TYPE:
+		sqlite3_result_text(ctx, r.type_name, -1, SQLITE_STATIC);
+		break;
+	case RELOCS_ADDR:
+		sqlite3_result_int64(ctx, r.addr);
+		break;
+	case RELOCS_TARGET_ADDR:
+		if (r.loc != (uint32_t)-1) sqlite3_result_int64(ctx, r.loc);
+		break;
+	case RELOCS_TARGET_FRAG:
+		if (r.loc != (uint32_t)-1) sqlite3_result_int64(ctx, r.target_frag);
+		break;
+	case RELOCS_ROM:
+		sqlite3_result_text(ctx, c->rc->filename, -1, SQLITE_TRANSIENT);
+		break;
+	}
+}
+
+static int romtab_column(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx,
+	int col)
+{
+	struct romcursor_s *c = (struct romcursor_s *)cursor;
+	struct romtab_s *t = (struct romtab_s *)cursor->pVtab;
+
+	if (t->relocs)
+		relocs_column(c, ctx, col);
+	else
+		frags_column(c, ctx, col);
+	return SQLITE_OK;
+}
+
+static int romtab_rowid(sqlite3_vtab_cursor *cursor, sqlite_int64 *rowid)
+{
+	*rowid = ((struct romcursor_s *)cursor)->rowid;
+	return SQLITE_OK;
+}
+
+static void sql_reloc_type(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	if (sqlite3_value_type(argv[0]) != SQLITE_INTEGER) return;
+	sqlite3_result_text(ctx, Reloc_TypeName(sqlite3_value_int64(argv[0])),
+		-1, SQLITE_STATIC);
+}
+
+static void sql_reloc_target(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	struct romcache_s *rc;
+	struct fraginfo_s fi;
+	const char *filename = (const char *)sqlite3_value_text(argv[0]);
+	char *err = NULL;
+	struct reloc_s r;
+	uint8_t *bytes;
+	size_t size;
+
+	if (!filename or (sqlite3_value_type(argv[1]) != SQLITE_INTEGER)
+		or (sqlite3_value_type(argv[2]) != SQLITE_INTEGER))
+		return;
+	rc = cache_get(sqlite3_user_data(ctx), filename, &err);
+	if (!rc) {
+		if (err) sqlite3_result_error(ctx, err, -1);
+		else sqlite3_result_error_nomem(ctx);
+		sqlite3_free(err);
+		return;
+	}
+	switch (cache_find(rc, sqlite3_value_int64(argv[1]), &fi)) {
+	case -1:
+		sqlite3_result_error_nomem(ctx);
+		return;
+	case 1:
+		return;
+	}
+
+	size = fi.romsize;
+	if (size > rc->rom.size - fi.addr) size = rc->rom.size - fi.addr;
+	bytes = RomView_Get(&rc->rom, fi.addr, size);
+	if (!bytes) {
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	Reloc_Decode(&r, sqlite3_value_int64(argv[2]), bytes, size);
+	RomView_Put(&rc->rom, bytes);
+	if (r.loc != (uint32_t)-1) sqlite3_result_int64(ctx, r.loc);
+}
+
+static void sql_mips_disasm(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	struct outbuf_s ob;
+
+	if (sqlite3_value_type(argv[0]) != SQLITE_INTEGER) return;
+	OutBuf_Init(&ob);
+	Mips_Disasm(&ob, sqlite3_value_int64(argv[0]),
+		sqlite3_value_int64(argv[1]), NULL);
+	while (ob.len and (ob.p[ob.len - 1] == ' ')) ob.len--;
+	if (ob.error)
+		sqlite3_result_error_nomem(ctx);
+	else
+		sqlite3_result_text(ctx, ob.p, ob.len, SQLITE_TRANSIENT);
+	OutBuf_Free(&ob);
+}
+
+static void sql_frag_of_addr(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	int32_t num;
+
+	if (sqlite3_value_type(argv[0]) != SQLITE_INTEGER) return;
+	num = get_addr_frag_num(sqlite3_value_int64(argv[0]));
+	if (num >= 0) sqlite3_result_int64(ctx, num);
+}
+
+static void sql_be32(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	const uint8_t *blob = sqlite3_value_blob(argv[0]);
+	int len = sqlite3_value_bytes(argv[0]);
+	int64_t off = sqlite3_value_int64(argv[1]);
+	uint32_t w;
+
+	if (!blob or (off < 0) or (off > len - 4)) return;
+	memcpy(&w, blob + off, 4);
+	sqlite3_result_int64(ctx, ntohl(w));
+}
+
+// xCreate is NULL, so the tables are eponymous and can't be created
+static sqlite3_module romtab_module = {
+	.iVersion = 0,
+	.xConnect = romtab_connect,
+	.xBestIndex = romtab_best_index,
+	.xDisconnect = romtab_disconnect,
+	.xOpen = romtab_open,
+	.xClose = romtab_close,
+	.xFilter = romtab_filter,
+	.xNext = romtab_next,
+	.xEof = romtab_eof,
+	.xColumn = romtab_column,
+	.xRowid = romtab_rowid,
+};
+
+int VTab_Register(sqlite3 *db)
+{
+	struct romcache_s **cache;
+	int rc;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) return SQLITE_NOMEM;
+	rc = sqlite3_create_module_v2(db, "rom_frags", &romtab_module,
+		cache, cache_free);
+	if (rc != SQLITE_OK) return rc;
+	rc = sqlite3_create_module(db, "rom_relocs", &romtab_module, cache);
+	if (rc != SQLITE_OK) return rc;
+
+	static const struct {
+		char *name;
+		int argc;
+		void (*func)(sqlite3_context *, int, sqlite3_value **);
+	} funcs[] = {
+		{ "reloc_type", 1, sql_reloc_type },
+		{ "mips_disasm", 2, sql_mips_disasm },
+		{ "frag_of_addr", 1, sql_frag_of_addr },
+		{ "be32", 2, sql_be32 },
+	};
+	for (size_t i = 0; i < sizeof(funcs) / sizeof(funcs[0]); i++) {
+		rc = sqlite3_create_function(db, funcs[i].name, funcs[i].argc,
+			SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+			funcs[i].func, NULL, NULL);
+		if (rc != SQLITE_OK) return rc;
+	}
+	// reads files, so not deterministic
+	return sqlite3_create_function(db, "reloc_target", 3, SQLITE_UTF8,
+		cache, sql_reloc_target, NULL, NULL);
+}
@@ -0,0 +1,6 @@
+#ifndef _VTAB_H_
+#define _VTAB_H_
+#include "sqlite3.h"
+
+int VTab_Register(sqlite3 *db);
+#endif